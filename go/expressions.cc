@@ -6864,8 +6864,9 @@ Builtin_call_expression::do_lower(Gogo* gogo, Named_object* function,
 	    Expression* e2 = Expression::make_temporary_reference(key_temp,
 								  loc);
 	    e2 = Expression::make_unary(OPERATOR_AND, e2, loc);
-	    return Runtime::make_call(Runtime::MAPDELETE, this->location(),
-				      2, e1, e2);
+	    Runtime::Function code = Runtime::map_function(mt,
+							   Runtime::MAPDELETE);
+	    return Runtime::make_call(code, this->location(), 2, e1, e2);
 	  }
       }
       break;
@@ -7034,6 +7035,38 @@ Builtin_call_expression::lower_make()
       return Expression::make_error(this->location());
     }
 
+  // If a slice of constant size may go on the stack when it does not
+  // escape, make it as a slice of a new array, (*new([CAP]T))[0:LEN],
+  // which the escape analysis recognizes.
+  if (is_slice && !have_big_args && type->named_type() == NULL)
+    {
+      Expression* size_arg = cap_arg != NULL ? cap_arg : len_arg;
+      Numeric_constant nclen;
+      Numeric_constant nccap;
+      unsigned long vlen;
+      unsigned long vcap;
+      if (len_arg->numeric_constant_value(&nclen)
+	  && size_arg->numeric_constant_value(&nccap)
+	  && nclen.to_unsigned_long(&vlen) == Numeric_constant::NC_UL_VALID
+	  && nccap.to_unsigned_long(&vcap) == Numeric_constant::NC_UL_VALID
+	  && vlen <= vcap)
+	{
+	  Type* int_type = Type::lookup_integer_type("int");
+	  Expression* alen = Expression::make_integer_ul(vcap, int_type, loc);
+	  Type* atype = Type::make_array_type(type->array_type()->element_type(),
+					      alen);
+	  if (this->gogo_->may_allocate_on_stack(atype))
+	    {
+	      Expression* alloc = Expression::make_allocation(atype, loc);
+	      Expression* array = Expression::make_unary(OPERATOR_MULT, alloc,
+							 loc);
+	      Expression* zero = Expression::make_integer_ul(0, int_type, loc);
+	      return Expression::make_array_index(array, zero, len_arg, NULL,
+						  loc);
+	    }
+	}
+    }
+
   Location type_loc = first_arg->location();
   Expression* type_arg;
   if (is_slice || is_chan)
@@ -9758,86 +9791,6 @@ Expression::make_index(Expression* left, Expression* start, Expression* end,
   return new Index_expression(left, start, end, cap, location);
 }
 
-// An array index.  This is used for both indexing and slicing.
-
-class Array_index_expression : public Expression
-{
- public:
-  Array_index_expression(Expression* array, Expression* start,
-			 Expression* end, Expression* cap, Location location)
-    : Expression(EXPRESSION_ARRAY_INDEX, location),
-      array_(array), start_(start), end_(end), cap_(cap), type_(NULL)
-  { }
-
- protected:
-  int
-  do_traverse(Traverse*);
-
-  Expression*
-  do_flatten(Gogo*, Named_object*, Statement_inserter*);
-
-  Type*
-  do_type();
-
-  void
-  do_determine_type(const Type_context*);
-
-  void
-  do_check_types(Gogo*);
-
-  Expression*
-  do_copy()
-  {
-    return Expression::make_array_index(this->array_->copy(),
-					this->start_->copy(),
-					(this->end_ == NULL
-					 ? NULL
-					 : this->end_->copy()),
-					(this->cap_ == NULL
-					 ? NULL
-					 : this->cap_->copy()),
-					this->location());
-  }
-
-  bool
-  do_must_eval_subexpressions_in_order(int* skip) const
-  {
-    *skip = 1;
-    return true;
-  }
-
-  bool
-  do_is_addressable() const;
-
-  void
-  do_address_taken(bool escapes)
-  { this->array_->address_taken(escapes); }
-
-  void
-  do_issue_nil_check()
-  { this->array_->issue_nil_check(); }
-
-  Bexpression*
-  do_get_backend(Translate_context*);
-
-  void
-  do_dump_expression(Ast_dump_context*) const;
-  
- private:
-  // The array we are getting a value from.
-  Expression* array_;
-  // The start or only index.
-  Expression* start_;
-  // The end index of a slice.  This may be NULL for a simple array
-  // index, or it may be a nil expression for the length of the array.
-  Expression* end_;
-  // The capacity argument of a slice.  This may be NULL for an array index or
-  // slice.
-  Expression* cap_;
-  // The type of the expression.
-  Type* type_;
-};
-
 // Array index traversal.
 
 int
@@ -10764,9 +10717,10 @@ Map_index_expression::get_value_pointer(bool insert)
 
       Expression* index_ptr = Expression::make_unary(OPERATOR_AND, this->index_,
                                                      loc);
+      Runtime::Function code = Runtime::map_function(type,
+                                                     Runtime::MAP_INDEX);
       Expression* map_index =
-          Runtime::make_call(Runtime::MAP_INDEX, loc, 3,
-                             map_ref, index_ptr,
+          Runtime::make_call(code, loc, 3, map_ref, index_ptr,
                              Expression::make_boolean(insert, loc));
 
       Type* val_type = type->val_type();
@@ -11538,51 +11492,34 @@ Expression::make_selector(Expression* left, const std::string& name,
   return new Selector_expression(left, name, location);
 }
 
-// Implement the builtin function new.
-
-class Allocation_expression : public Expression
-{
- public:
-  Allocation_expression(Type* type, Location location)
-    : Expression(EXPRESSION_ALLOCATION, location),
-      type_(type)
-  { }
-
- protected:
-  int
-  do_traverse(Traverse* traverse)
-  { return Type::traverse(this->type_, traverse); }
-
-  Type*
-  do_type()
-  { return Type::make_pointer_type(this->type_); }
-
-  void
-  do_determine_type(const Type_context*)
-  { }
-
-  Expression*
-  do_copy()
-  { return new Allocation_expression(this->type_, this->location()); }
-
-  Bexpression*
-  do_get_backend(Translate_context*);
-
-  void
-  do_dump_expression(Ast_dump_context*) const;
-  
- private:
-  // The type we are allocating.
-  Type* type_;
-};
-
 // Return the backend representation for an allocation expression.
+// If the memory does not escape, it is a zeroed temporary variable
+// in the current block.  The escape analysis only permits that when
+// the pointer is stored in a variable declared in the same block, so
+// the temporary lives as long as anything which can refer to it.
 
 Bexpression*
 Allocation_expression::do_get_backend(Translate_context* context)
 {
   Gogo* gogo = context->gogo();
   Location loc = this->location();
+
+  if (this->allocate_on_stack_)
+    {
+      Btype* btype = this->type_->get_backend(gogo);
+      Bexpression* zero = gogo->backend()->zero_expression(btype);
+      Named_object* fn = context->function();
+      go_assert(fn != NULL);
+      Bfunction* fndecl = fn->func_value()->get_or_make_decl(gogo, fn);
+      Bstatement* decl;
+      Bvariable* temp =
+	gogo->backend()->temporary_variable(fndecl, context->bblock(), btype,
+					    zero, true, loc, &decl);
+      Bexpression* ret = gogo->backend()->var_expression(temp, loc);
+      ret = gogo->backend()->address_expression(ret, loc);
+      return gogo->backend()->compound_expression(decl, ret, loc);
+    }
+
   Bexpression* space = 
     gogo->allocate_memory(this->type_, loc)->get_backend(context);
   Btype* pbtype = gogo->backend()->pointer_type(this->type_->get_backend(gogo));
@@ -13625,55 +13562,8 @@ Expression::make_type_guard(Expression* expr, Type* type,
 
 // Class Heap_expression.
 
-// When you take the address of an escaping expression, it is allocated
-// on the heap.  This class implements that.
-
-class Heap_expression : public Expression
-{
- public:
-  Heap_expression(Expression* expr, Location location)
-    : Expression(EXPRESSION_HEAP, location),
-      expr_(expr)
-  { }
-
- protected:
-  int
-  do_traverse(Traverse* traverse)
-  { return Expression::traverse(&this->expr_, traverse); }
-
-  Type*
-  do_type()
-  { return Type::make_pointer_type(this->expr_->type()); }
-
-  void
-  do_determine_type(const Type_context*)
-  { this->expr_->determine_type_no_context(); }
-
-  Expression*
-  do_copy()
-  {
-    return Expression::make_heap_expression(this->expr_->copy(),
-                                            this->location());
-  }
-
-  Bexpression*
-  do_get_backend(Translate_context*);
-
-  // We only export global objects, and the parser does not generate
-  // this in global scope.
-  void
-  do_export(Export*) const
-  { go_unreachable(); }
-
-  void
-  do_dump_expression(Ast_dump_context*) const;
-
- private:
-  // The expression which is being put on the heap.
-  Expression* expr_;
-};
-
-// Return the backend representation for allocating an expression on the heap.
+// Return the backend representation for allocating an expression on
+// the heap, or on the stack if it does not escape.
 
 Bexpression*
 Heap_expression::do_get_backend(Translate_context* context)
@@ -13684,8 +13574,10 @@ Heap_expression::do_get_backend(Translate_context* context)
   Location loc = this->location();
   Gogo* gogo = context->gogo();
   Btype* btype = this->type()->get_backend(gogo);
-  Bexpression* space = Expression::make_allocation(this->expr_->type(),
-						   loc)->get_backend(context);
+  Expression* alloc = Expression::make_allocation(this->expr_->type(), loc);
+  if (this->allocate_on_stack_)
+    alloc->allocation_expression()->set_allocate_on_stack();
+  Bexpression* space = alloc->get_backend(context);
 
   Bstatement* decl;
   Named_object* fn = context->function();
@@ -38,11 +38,14 @@ class Func_expression;
 class Func_descriptor_expression;
 class Unknown_expression;
 class Index_expression;
+class Array_index_expression;
 class Map_index_expression;
 class Bound_method_expression;
 class Field_reference_expression;
 class Interface_field_reference_expression;
 class Type_guard_expression;
+class Allocation_expression;
+class Heap_expression;
 class Receive_expression;
 class Numeric_constant;
 class Named_object;
@@ -606,6 +609,13 @@ class Expression
   index_expression()
   { return this->convert<Index_expression, EXPRESSION_INDEX>(); }
 
+  // If this is an index into an array or a slice, or a slice of
+  // one, return the Array_index_expression structure.  Otherwise,
+  // return NULL.
+  Array_index_expression*
+  array_index_expression()
+  { return this->convert<Array_index_expression, EXPRESSION_ARRAY_INDEX>(); }
+
   // If this is an expression which refers to indexing in a map,
   // return the Map_index_expression structure.  Otherwise, return
   // NULL.
@@ -644,6 +654,18 @@ class Expression
   type_guard_expression()
   { return this->convert<Type_guard_expression, EXPRESSION_TYPE_GUARD>(); }
 
+  // If this is a call to the builtin function new, return the
+  // Allocation_expression structure.  Otherwise, return NULL.
+  Allocation_expression*
+  allocation_expression()
+  { return this->convert<Allocation_expression, EXPRESSION_ALLOCATION>(); }
+
+  // If this is the address of a value put on the heap, return the
+  // Heap_expression structure.  Otherwise, return NULL.
+  Heap_expression*
+  heap_expression()
+  { return this->convert<Heap_expression, EXPRESSION_HEAP>(); }
+
   // If this is a receive expression, return the Receive_expression
   // structure.  Otherwise, return NULL.
   Receive_expression*
@@ -2069,6 +2091,107 @@ class Index_expression : public Parser_expression
   bool is_lvalue_;
 };
 
+// An array index.  This is used for both indexing and slicing.
+
+class Array_index_expression : public Expression
+{
+ public:
+  Array_index_expression(Expression* array, Expression* start,
+			 Expression* end, Expression* cap, Location location)
+    : Expression(EXPRESSION_ARRAY_INDEX, location),
+      array_(array), start_(start), end_(end), cap_(cap), type_(NULL)
+  { }
+
+  // Return the array.
+  Expression*
+  array()
+  { return this->array_; }
+
+  // Return the start or only index.
+  Expression*
+  start()
+  { return this->start_; }
+
+  // Return the end index of a slice.  This is NULL for a simple
+  // array index.
+  Expression*
+  end()
+  { return this->end_; }
+
+  // Return the capacity argument of a slice, which may be NULL.
+  Expression*
+  cap()
+  { return this->cap_; }
+
+ protected:
+  int
+  do_traverse(Traverse*);
+
+  Expression*
+  do_flatten(Gogo*, Named_object*, Statement_inserter*);
+
+  Type*
+  do_type();
+
+  void
+  do_determine_type(const Type_context*);
+
+  void
+  do_check_types(Gogo*);
+
+  Expression*
+  do_copy()
+  {
+    return Expression::make_array_index(this->array_->copy(),
+					this->start_->copy(),
+					(this->end_ == NULL
+					 ? NULL
+					 : this->end_->copy()),
+					(this->cap_ == NULL
+					 ? NULL
+					 : this->cap_->copy()),
+					this->location());
+  }
+
+  bool
+  do_must_eval_subexpressions_in_order(int* skip) const
+  {
+    *skip = 1;
+    return true;
+  }
+
+  bool
+  do_is_addressable() const;
+
+  void
+  do_address_taken(bool escapes)
+  { this->array_->address_taken(escapes); }
+
+  void
+  do_issue_nil_check()
+  { this->array_->issue_nil_check(); }
+
+  Bexpression*
+  do_get_backend(Translate_context*);
+
+  void
+  do_dump_expression(Ast_dump_context*) const;
+  
+ private:
+  // The array we are getting a value from.
+  Expression* array_;
+  // The start or only index.
+  Expression* start_;
+  // The end index of a slice.  This may be NULL for a simple array
+  // index, or it may be a nil expression for the length of the array.
+  Expression* end_;
+  // The capacity argument of a slice.  This may be NULL for an array index or
+  // slice.
+  Expression* cap_;
+  // The type of the expression.
+  Type* type_;
+};
+
 // An index into a map.
 
 class Map_index_expression : public Expression
@@ -2509,6 +2632,113 @@ class Type_guard_expression : public Expression
   Type* type_;
 };
 
+// Implement the builtin function new.
+
+class Allocation_expression : public Expression
+{
+ public:
+  Allocation_expression(Type* type, Location location)
+    : Expression(EXPRESSION_ALLOCATION, location),
+      type_(type), allocate_on_stack_(false)
+  { }
+
+  // Note that the allocated memory does not escape the function, so
+  // that it may be put on the stack.
+  void
+  set_allocate_on_stack()
+  { this->allocate_on_stack_ = true; }
+
+ protected:
+  int
+  do_traverse(Traverse* traverse)
+  { return Type::traverse(this->type_, traverse); }
+
+  Type*
+  do_type()
+  { return Type::make_pointer_type(this->type_); }
+
+  void
+  do_determine_type(const Type_context*)
+  { }
+
+  Expression*
+  do_copy()
+  { return new Allocation_expression(this->type_, this->location()); }
+
+  Bexpression*
+  do_get_backend(Translate_context*);
+
+  void
+  do_dump_expression(Ast_dump_context*) const;
+
+ private:
+  // The type we are allocating.
+  Type* type_;
+  // Whether the memory may be allocated on the stack.
+  bool allocate_on_stack_;
+};
+
+// When you take the address of an escaping expression, it is allocated
+// on the heap.  This class implements that.
+
+class Heap_expression : public Expression
+{
+ public:
+  Heap_expression(Expression* expr, Location location)
+    : Expression(EXPRESSION_HEAP, location),
+      expr_(expr), allocate_on_stack_(false)
+  { }
+
+  // Return the expression which is being put on the heap.
+  Expression*
+  expr() const
+  { return this->expr_; }
+
+  // Note that the allocated memory does not escape the function, so
+  // that it may be put on the stack after all.
+  void
+  set_allocate_on_stack()
+  { this->allocate_on_stack_ = true; }
+
+ protected:
+  int
+  do_traverse(Traverse* traverse)
+  { return Expression::traverse(&this->expr_, traverse); }
+
+  Type*
+  do_type()
+  { return Type::make_pointer_type(this->expr_->type()); }
+
+  void
+  do_determine_type(const Type_context*)
+  { this->expr_->determine_type_no_context(); }
+
+  Expression*
+  do_copy()
+  {
+    return Expression::make_heap_expression(this->expr_->copy(),
+                                            this->location());
+  }
+
+  Bexpression*
+  do_get_backend(Translate_context*);
+
+  // We only export global objects, and the parser does not generate
+  // this in global scope.
+  void
+  do_export(Export*) const
+  { go_unreachable(); }
+
+  void
+  do_dump_expression(Ast_dump_context*) const;
+
+ private:
+  // The expression which is being put on the heap.
+  Expression* expr_;
+  // Whether the memory may be allocated on the stack.
+  bool allocate_on_stack_;
+};
+
 // A receive expression.
 
 class Receive_expression : public Expression
@@ -109,6 +109,9 @@ go_parse_input_files(const char** filenames, unsigned int filename_count,
   if (only_check_syntax)
     return;
 
+  // Find allocations which may be put on the stack.
+  ::gogo->analyze_escape();
+
   // Export global identifiers as appropriate.
   ::gogo->do_exports();
 
@@ -10,6 +10,7 @@
 
 #include "go-c.h"
 #include "go-dump.h"
+#include "go-optimize.h"
 #include "lex.h"
 #include "types.h"
 #include "statements.h"
@@ -3116,6 +3117,418 @@ Gogo::check_types_in_block(Block* block)
   block->traverse(&traverse);
 }
 
+// The -fgo-optimize-allocs option, which puts values which do not
+// escape on the stack.
+
+Go_optimize optimize_allocation_flag("allocs");
+
+// A traversal class used to find local variables which hold the only
+// pointer to memory allocated by new(T), &T{...}, or make([]T, N)
+// with a constant N, and which do not let that pointer escape.  This
+// is deliberately simple: a pointer escapes whenever it is used for
+// anything other than indirecting through it, indexing it, taking its
+// length, comparing it to nil, or passing it to a parameter which
+// does not escape.  In particular storing the pointer anywhere,
+// taking the address of anything it points to, or passing it in a go
+// or defer statement makes it escape.
+//
+// The parameters of the functions of this package get the same
+// treatment, which gives a summary of each function: a parameter
+// does not escape if the function only uses it in the ways above.
+// The summaries are not exported, so passing a pointer to a function
+// of another package, to a method, or to a function value makes it
+// escape.
+
+class Escape_analysis : public Traverse
+{
+ public:
+  Escape_analysis(Gogo* gogo)
+    : Traverse(traverse_variables
+	       | traverse_statements
+	       | traverse_expressions),
+      gogo_(gogo), len_(gogo->lookup_global("len")),
+      cap_(gogo->lookup_global("cap")), candidates_(), uses_(),
+      thunk_calls_()
+  { }
+
+  int
+  variable(Named_object*);
+
+  int
+  statement(Block*, size_t*, Statement*);
+
+  int
+  expression(Expression**);
+
+  // Mark the allocations which do not escape.
+  void
+  finish();
+
+ private:
+  // What we know about the uses of a variable.
+  struct Var_uses
+  {
+    Var_uses()
+      : refs(0), safe_refs(0), escapes(false), params()
+    { }
+
+    // The number of references to the variable.
+    size_t refs;
+    // The number of references which do not let the value escape.
+    size_t safe_refs;
+    // Whether the address of the variable, or of something it points
+    // to, is taken.
+    bool escapes;
+    // The parameters the variable is passed to, one for each
+    // reference which does so.
+    std::vector<Named_object*> params;
+  };
+
+  typedef Unordered_map(Named_object*, Var_uses) Uses;
+
+  typedef Unordered_set(Named_object*) Escaping_params;
+
+  static Expression*
+  allocation(Expression*);
+
+  void
+  safe_use(Expression*);
+
+  void
+  address_taken(Expression*);
+
+  void
+  pass_arguments(Named_object*, const Expression_list*);
+
+  bool
+  stays_local(Named_object*, const Escaping_params&) const;
+
+  // The IR.
+  Gogo* gogo_;
+  // The predeclared functions len and cap.
+  Named_object* len_;
+  Named_object* cap_;
+  // The local variables initialized by an allocation.
+  std::vector<Named_object*> candidates_;
+  // The uses of all variables.
+  Uses uses_;
+  // The calls made by go and defer statements.
+  Unordered_set(const Expression*) thunk_calls_;
+};
+
+// If INIT allocates memory which may go on the stack, return the
+// Allocation_expression or Heap_expression which does so.  Otherwise
+// return NULL.
+
+Expression*
+Escape_analysis::allocation(Expression* init)
+{
+  if (init->allocation_expression() != NULL
+      || init->heap_expression() != NULL)
+    return init;
+
+  // make([]T, N) is (*new([N]T))[:N]; see
+  // Builtin_call_expression::lower_make.
+  Array_index_expression* aie = init->array_index_expression();
+  if (aie != NULL && aie->end() != NULL)
+    {
+      Unary_expression* ue = aie->array()->unary_expression();
+      if (ue != NULL
+	  && ue->op() == OPERATOR_MULT
+	  && ue->operand()->allocation_expression() != NULL)
+	return ue->operand();
+    }
+
+  return NULL;
+}
+
+// Note a local variable which is initialized by an allocation.
+
+int
+Escape_analysis::variable(Named_object* no)
+{
+  if (!no->is_variable())
+    return TRAVERSE_CONTINUE;
+  Variable* var = no->var_value();
+  if (var->is_global()
+      || var->is_parameter()
+      || var->is_closure()
+      || var->is_address_taken()
+      || var->is_non_escaping_address_taken()
+      || var->has_pre_init()
+      || var->init() == NULL)
+    return TRAVERSE_CONTINUE;
+
+  Expression* alloc = Escape_analysis::allocation(var->init());
+  if (alloc == NULL)
+    return TRAVERSE_CONTINUE;
+  Type* type = alloc->type()->points_to();
+  if (type != NULL && this->gogo_->may_allocate_on_stack(type))
+    this->candidates_.push_back(no);
+  return TRAVERSE_CONTINUE;
+}
+
+// Note the call of a go or defer statement.  Its arguments outlive
+// the caller, or at least the statement, so they may not be passed to
+// parameters which do not escape.
+
+int
+Escape_analysis::statement(Block*, size_t*, Statement* s)
+{
+  Thunk_statement* ts = s->thunk_statement();
+  if (ts != NULL)
+    this->thunk_calls_.insert(ts->call());
+  return TRAVERSE_CONTINUE;
+}
+
+// Classify the uses of variables in an expression.  Each reference to
+// a variable is counted when we reach it; the expressions which use
+// it safely count it again.
+
+int
+Escape_analysis::expression(Expression** pexpr)
+{
+  Expression* e = *pexpr;
+
+  Var_expression* ve = e->var_expression();
+  if (ve != NULL)
+    {
+      ++this->uses_[ve->named_object()].refs;
+      return TRAVERSE_CONTINUE;
+    }
+
+  Unary_expression* ue = e->unary_expression();
+  if (ue != NULL)
+    {
+      if (ue->op() == OPERATOR_MULT)
+	this->safe_use(ue->operand());
+      else if (ue->op() == OPERATOR_AND)
+	this->address_taken(ue->operand());
+      return TRAVERSE_CONTINUE;
+    }
+
+  Array_index_expression* aie = e->array_index_expression();
+  if (aie != NULL)
+    {
+      Type* type = aie->array()->type();
+      if (aie->end() == NULL)
+	{
+	  if (type->is_slice_type())
+	    this->safe_use(aie->array());
+	}
+      else if (type->array_type() != NULL && !type->is_slice_type())
+	{
+	  // Slicing an array takes its address.
+	  this->address_taken(aie->array());
+	}
+      return TRAVERSE_CONTINUE;
+    }
+
+  Binary_expression* be = e->binary_expression();
+  if (be != NULL)
+    {
+      if (be->op() == OPERATOR_EQEQ || be->op() == OPERATOR_NOTEQ)
+	{
+	  if (be->right()->is_nil_expression())
+	    this->safe_use(be->left());
+	  else if (be->left()->is_nil_expression())
+	    this->safe_use(be->right());
+	}
+      return TRAVERSE_CONTINUE;
+    }
+
+  Call_expression* ce = e->call_expression();
+  if (ce != NULL && ce->args() != NULL)
+    {
+      Func_expression* fe = ce->fn()->func_expression();
+      if (fe == NULL)
+	return TRAVERSE_CONTINUE;
+      Named_object* fn = fe->named_object();
+      if (fn == this->len_ || fn == this->cap_)
+	{
+	  if (ce->args()->size() == 1)
+	    this->safe_use(ce->args()->front());
+	}
+      else if (fn->is_function()
+	       && !ce->is_varargs()
+	       && this->thunk_calls_.find(ce) == this->thunk_calls_.end())
+	this->pass_arguments(fn, ce->args());
+    }
+
+  return TRAVERSE_CONTINUE;
+}
+
+// Note that E, if it is a variable, is used in a way which does not
+// let its value escape.
+
+void
+Escape_analysis::safe_use(Expression* e)
+{
+  Var_expression* ve = e->var_expression();
+  if (ve != NULL)
+    ++this->uses_[ve->named_object()].safe_refs;
+}
+
+// Note that the address of E is taken.  If E is a variable, or
+// something reached by indirecting through a variable, the value of
+// the variable escapes.
+
+void
+Escape_analysis::address_taken(Expression* e)
+{
+  while (true)
+    {
+      Var_expression* ve = e->var_expression();
+      if (ve != NULL)
+	{
+	  this->uses_[ve->named_object()].escapes = true;
+	  return;
+	}
+
+      Unary_expression* ue = e->unary_expression();
+      Field_reference_expression* fre = e->field_reference_expression();
+      Array_index_expression* aie = e->array_index_expression();
+      if (ue != NULL && ue->op() == OPERATOR_MULT)
+	e = ue->operand();
+      else if (fre != NULL)
+	e = fre->expr();
+      else if (aie != NULL)
+	e = aie->array();
+      else
+	return;
+    }
+}
+
+// Note the variables passed as arguments ARGS in a direct call to the
+// function FN, along with the parameters they are passed to.  A
+// parameter is only used if it has the same type as the argument, so
+// that no conversion happens on the way.
+
+void
+Escape_analysis::pass_arguments(Named_object* fn, const Expression_list* args)
+{
+  Function* func = fn->func_value();
+  const Function_type* fntype = func->type();
+  const Typed_identifier_list* params = fntype->parameters();
+  if (fntype->is_method()
+      || fntype->is_varargs()
+      || params == NULL
+      || params->size() != args->size()
+      || func->block() == NULL)
+    return;
+
+  Bindings* bindings = func->block()->bindings();
+  Expression_list::const_iterator pa = args->begin();
+  for (Typed_identifier_list::const_iterator pp = params->begin();
+       pp != params->end();
+       ++pp, ++pa)
+    {
+      Var_expression* ve = (*pa)->var_expression();
+      if (ve == NULL || pp->name().empty())
+	continue;
+      Named_object* param = bindings->lookup_local(pp->name());
+      if (param == NULL
+	  || !param->is_variable()
+	  || !param->var_value()->is_parameter()
+	  || !Type::are_identical(ve->type(), param->var_value()->type(),
+				  false, NULL))
+	continue;
+      this->uses_[ve->named_object()].params.push_back(param);
+    }
+}
+
+// Return whether the value of the variable NO stays in its function,
+// given the parameters known to escape.
+
+bool
+Escape_analysis::stays_local(Named_object* no,
+			     const Escaping_params& escaping) const
+{
+  Variable* var = no->var_value();
+  if (var->is_address_taken()
+      || var->is_non_escaping_address_taken()
+      || escaping.find(no) != escaping.end())
+    return false;
+
+  Uses::const_iterator pu = this->uses_.find(no);
+  if (pu == this->uses_.end())
+    return true;
+  const Var_uses& uses(pu->second);
+  if (uses.escapes || uses.refs != uses.safe_refs + uses.params.size())
+    return false;
+  for (std::vector<Named_object*>::const_iterator pp = uses.params.begin();
+       pp != uses.params.end();
+       ++pp)
+    {
+      Variable* pvar = (*pp)->var_value();
+      if (pvar->is_address_taken()
+	  || pvar->is_non_escaping_address_taken()
+	  || escaping.find(*pp) != escaping.end())
+	return false;
+    }
+  return true;
+}
+
+// Mark the allocations of the variables whose values do not escape.
+
+void
+Escape_analysis::finish()
+{
+  // Find the parameters which escape.  Start by assuming that none
+  // do, and add those which are passed to one which escapes, until
+  // nothing changes.
+  Escaping_params escaping;
+  bool changed = true;
+  while (changed)
+    {
+      changed = false;
+      for (Uses::const_iterator pu = this->uses_.begin();
+	   pu != this->uses_.end();
+	   ++pu)
+	{
+	  Named_object* no = pu->first;
+	  if (no->is_variable()
+	      && no->var_value()->is_parameter()
+	      && escaping.find(no) == escaping.end()
+	      && !this->stays_local(no, escaping))
+	    {
+	      escaping.insert(no);
+	      changed = true;
+	    }
+	}
+    }
+
+  for (std::vector<Named_object*>::const_iterator p =
+	 this->candidates_.begin();
+       p != this->candidates_.end();
+       ++p)
+    {
+      if (!this->stays_local(*p, escaping))
+	continue;
+
+      Expression* alloc =
+	Escape_analysis::allocation((*p)->var_value()->init());
+      if (alloc->allocation_expression() != NULL)
+	alloc->allocation_expression()->set_allocate_on_stack();
+      else
+	alloc->heap_expression()->set_allocate_on_stack();
+    }
+}
+
+// Find allocations which do not escape.  This runs after the types
+// have been checked, so that the address_taken flags of variables are
+// set.
+
+void
+Gogo::analyze_escape()
+{
+  if (!optimize_allocation_flag.is_enabled())
+    return;
+  Escape_analysis escape_analysis(this);
+  this->traverse(&escape_analysis);
+  escape_analysis.finish();
+}
+
 // A traversal class used to find a single shortcut operator within an
 // expression.
 
@@ -4267,6 +4680,21 @@ Gogo::allocate_memory(Type* type, Location location)
 			    location, 2, td, size);
 }
 
+// Return whether a value of type TYPE which does not escape may be
+// put on the stack.  Very large values stay on the heap, so that they
+// do not overflow the stack.
+
+bool
+Gogo::may_allocate_on_stack(Type* type)
+{
+  if (!optimize_allocation_flag.is_enabled())
+    return false;
+  const unsigned long max_stack_allocation_size = 64 * 1024;
+  unsigned long size;
+  return (type->backend_type_size(this, &size)
+	  && size <= max_stack_allocation_size);
+}
+
 // Traversal class used to check for return statements.
 
 class Check_return_statements_traverse : public Traverse
@@ -4434,7 +4862,8 @@ Function::Function(Function_type* type, Function* enclosing, Block* block,
   : type_(type), enclosing_(enclosing), results_(NULL),
     closure_var_(NULL), block_(block), location_(location), labels_(),
     local_type_count_(0), descriptor_(NULL), fndecl_(NULL), defer_stack_(NULL),
-    is_sink_(false), results_are_named_(false), nointerface_(false),
+    preempt_count_(NULL), stack_map_vars_(), stack_map_(NULL), is_sink_(false),
+    results_are_named_(false), nointerface_(false),
     is_unnamed_type_stub_method_(false), calls_recover_(false),
     is_recover_thunk_(false), has_recover_thunk_(false),
     calls_defer_retaddr_(false), is_type_specific_function_(false),
@@ -4679,6 +5108,7 @@ Function::swap_for_recover(Function *x)
   std::swap(this->results_, x->results_);
   std::swap(this->closure_var_, x->closure_var_);
   std::swap(this->block_, x->block_);
+  std::swap(this->preempt_count_, x->preempt_count_);
   go_assert(this->location_ == x->location_);
   go_assert(this->fndecl_ == NULL && x->fndecl_ == NULL);
   go_assert(this->defer_stack_ == NULL && x->defer_stack_ == NULL);
@@ -4762,6 +5192,23 @@ Function::defer_stack(Location location)
   return Expression::make_unary(OPERATOR_AND, ref, location);
 }
 
+// Get the loop iteration counter.  Like the defer stack, it is
+// declared and zeroed when the function is entered, so that a loop
+// nested in another one does not start counting again from zero each
+// time the outer loop enters it.
+
+Temporary_statement*
+Function::preempt_count(Location location)
+{
+  if (this->preempt_count_ == NULL)
+    {
+      Type* t = Type::lookup_integer_type("uint32");
+      Expression* zero = Expression::make_integer_ul(0, t, location);
+      this->preempt_count_ = Statement::make_temporary(t, zero, location);
+    }
+  return this->preempt_count_;
+}
+
 // Export the function.
 
 void
@@ -5101,6 +5548,187 @@ Function::get_decl() const
   return this->fndecl_;
 }
 
+// The -fgo-optimize-stackmaps option.  The garbage collector scans
+// goroutine stacks conservatively, so any word which looks like a
+// pointer keeps heap memory alive.  With this option a function whose
+// outermost block declares large variables describes them in a stack
+// map, and the collector scans those variables using their type
+// descriptors, or skips them if they hold no pointers.  The rest of
+// the frame is still scanned conservatively, since the backend is
+// free to keep copies of pointers in registers and spill slots.
+
+Go_optimize optimize_stackmap_flag("stackmaps");
+
+// A variable must be at least this large to be described.  A
+// described variable has to live in memory, and smaller ones are
+// better off in registers.
+
+static const unsigned long stack_map_min_size = 64;
+
+// Choose the variables for the stack map of this function, and create
+// the map variable.  Only the variables of the outermost block are
+// described, because their scope is the whole function, so the
+// backend does not share their stack slots with other variables.
+// Return the initial value of the map, or NULL if the function does
+// not need one.
+
+Bexpression*
+Function::make_stack_map(Gogo* gogo, Named_object* named_function)
+{
+  std::vector<Named_object*> locals;
+  for (Bindings::const_definitions_iterator p =
+	 this->block_->bindings()->begin_definitions();
+       p != this->block_->bindings()->end_definitions();
+       ++p)
+    {
+      Type* type;
+      bool is_local;
+      if ((*p)->is_variable())
+	{
+	  Variable* var = (*p)->var_value();
+	  if (var->is_in_heap() || var->is_global())
+	    continue;
+	  type = var->type();
+	  is_local = !var->is_parameter();
+	}
+      else if ((*p)->is_result_variable())
+	{
+	  if ((*p)->result_var_value()->is_in_heap())
+	    continue;
+	  type = (*p)->result_var_value()->type();
+	  is_local = false;
+	}
+      else
+	continue;
+
+      unsigned long size;
+      if (!type->backend_type_size(gogo, &size) || size < stack_map_min_size)
+	continue;
+
+      if ((*p)->is_variable())
+	(*p)->var_value()->set_non_escaping_address_taken();
+      else
+	(*p)->result_var_value()->set_non_escaping_address_taken();
+
+      if (is_local)
+	locals.push_back(*p);
+      else
+	this->stack_map_vars_.push_back(*p);
+    }
+  if (this->stack_map_vars_.empty() && locals.empty())
+    return NULL;
+
+  // This must match FrameMap in libgo/runtime/runtime.h.
+  Location loc = this->location_;
+  Type* pointer_type = Type::make_pointer_type(Type::make_void_type());
+  Type* uintptr_type = Type::lookup_integer_type("uintptr");
+  Struct_type* entry_type =
+    Type::make_builtin_struct_type(2,
+				   "addr", pointer_type,
+				   "type", pointer_type);
+  size_t count = this->stack_map_vars_.size() + locals.size();
+  Expression* length = Expression::make_integer_ul(count, NULL, loc);
+  Type* array_type = Type::make_array_type(entry_type, length);
+  Struct_type* map_type =
+    Type::make_builtin_struct_type(3,
+				   "next", pointer_type,
+				   "n", uintptr_type,
+				   "vars", array_type);
+
+  Variable* map_var = new Variable(map_type, NULL, false, false, false, loc);
+  map_var->set_non_escaping_address_taken();
+  this->stack_map_ = Named_object::make_variable("$stackmap", NULL, map_var);
+
+  // Parameters and results are described from the start.  Until the
+  // declaration of a local variable has run its memory may hold
+  // anything, so its entry is left nil until then; see
+  // stack_map_entry.
+  std::vector<unsigned long> indexes;
+  std::vector<Bexpression*> entries;
+  for (size_t i = 0; i < this->stack_map_vars_.size(); ++i)
+    {
+      indexes.push_back(i);
+      entries.push_back(this->stack_map_value(gogo, named_function,
+					      this->stack_map_vars_[i], loc));
+    }
+  this->stack_map_vars_.insert(this->stack_map_vars_.end(), locals.begin(),
+			       locals.end());
+
+  Translate_context context(gogo, named_function, NULL, NULL);
+  Expression* n = Expression::make_integer_ul(count, uintptr_type, loc);
+  std::vector<Bexpression*> vals;
+  vals.push_back(gogo->backend()->nil_pointer_expression());
+  vals.push_back(n->get_backend(&context));
+  vals.push_back(gogo->backend()->
+		 array_constructor_expression(array_type->get_backend(gogo),
+					      indexes, entries, loc));
+  return gogo->backend()->constructor_expression(map_type->get_backend(gogo),
+						 vals, loc);
+}
+
+// Return the stack map entry for VAR, which holds its address and its
+// type descriptor.
+
+Bexpression*
+Function::stack_map_value(Gogo* gogo, Named_object* named_function,
+			  Named_object* var, Location loc)
+{
+  Type* type = (var->is_variable()
+		? var->var_value()->type()
+		: var->result_var_value()->type());
+  Type* entry_type = this->stack_map_->var_value()->type()->struct_type()->
+    field(2)->type()->array_type()->element_type();
+  Btype* pointer_btype =
+    Type::make_pointer_type(Type::make_void_type())->get_backend(gogo);
+
+  Bvariable* bvar = var->get_backend_variable(gogo, named_function);
+  Bexpression* addr = gogo->backend()->var_expression(bvar, loc);
+  addr = gogo->backend()->address_expression(addr, loc);
+  addr = gogo->backend()->convert_expression(pointer_btype, addr, loc);
+
+  Bexpression* td = type->type_descriptor_pointer(gogo, loc);
+  td = gogo->backend()->convert_expression(pointer_btype, td, loc);
+
+  std::vector<Bexpression*> vals;
+  vals.push_back(addr);
+  vals.push_back(td);
+  return gogo->backend()->constructor_expression(entry_type->get_backend(gogo),
+						 vals, loc);
+}
+
+// Return the statement which adds the local variable VAR to the stack
+// map once its declaration has run, or NULL if the stack map does not
+// describe VAR.
+
+Bstatement*
+Function::stack_map_entry(Gogo* gogo, Named_object* named_function,
+			  Named_object* var, Location loc)
+{
+  if (this->stack_map_ == NULL)
+    return NULL;
+  std::vector<Named_object*>::const_iterator p =
+    std::find(this->stack_map_vars_.begin(), this->stack_map_vars_.end(),
+	      var);
+  if (p == this->stack_map_vars_.end())
+    return NULL;
+
+  Translate_context context(gogo, named_function, NULL, NULL);
+  Type* uintptr_type = Type::lookup_integer_type("uintptr");
+  Expression* index =
+    Expression::make_integer_ul(p - this->stack_map_vars_.begin(),
+				uintptr_type, loc);
+
+  Bvariable* bmap =
+    this->stack_map_->get_backend_variable(gogo, named_function);
+  Bexpression* ref = gogo->backend()->var_expression(bmap, loc);
+  ref = gogo->backend()->struct_field_expression(ref, 2, loc);
+  ref = gogo->backend()->array_index_expression(ref,
+						index->get_backend(&context),
+						loc);
+  Bexpression* val = this->stack_map_value(gogo, named_function, var, loc);
+  return gogo->backend()->assignment_statement(ref, val, loc);
+}
+
 // Build the backend representation for the function code.
 
 void
@@ -5108,6 +5736,12 @@ Function::build(Gogo* gogo, Named_object* named_function)
 {
   Translate_context context(gogo, named_function, NULL, NULL);
 
+  // The variables in the stack map must live in memory, so choose
+  // them before building any of them.
+  Bexpression* stack_map_init = NULL;
+  if (optimize_stackmap_flag.is_enabled() && this->block_ != NULL)
+    stack_map_init = this->make_stack_map(gogo, named_function);
+
   // A list of parameter variables for this function.
   std::vector<Bvariable*> param_vars;
 
@@ -5187,6 +5821,12 @@ Function::build(Gogo* gogo, Named_object* named_function)
           var_inits.push_back(init);
 	}
     }
+  if (stack_map_init != NULL)
+    {
+      vars.push_back(this->stack_map_->get_backend_variable(gogo,
+							     named_function));
+      var_inits.push_back(stack_map_init);
+    }
   if (!gogo->backend()->function_set_parameters(this->fndecl_, param_vars))
     {
       go_assert(saw_errors());
@@ -5207,7 +5847,10 @@ Function::build(Gogo* gogo, Named_object* named_function)
       Bblock* var_decls = NULL;
 
       Bstatement* defer_init = NULL;
-      if (!vars.empty() || this->defer_stack_ != NULL)
+      Bstatement* preempt_init = NULL;
+      if (!vars.empty()
+	  || this->defer_stack_ != NULL
+	  || this->preempt_count_ != NULL)
 	{
           var_decls =
               gogo->backend()->block(this->fndecl_, NULL, vars,
@@ -5220,6 +5863,13 @@ Function::build(Gogo* gogo, Named_object* named_function)
                                          var_decls);
               defer_init = this->defer_stack_->get_backend(&dcontext);
 	    }
+
+	  if (this->preempt_count_ != NULL)
+	    {
+	      Translate_context pcontext(gogo, named_function, this->block_,
+					 var_decls);
+	      preempt_init = this->preempt_count_->get_backend(&pcontext);
+	    }
 	}
 
       // Build the backend representation for all the statements in the
@@ -5238,6 +5888,22 @@ Function::build(Gogo* gogo, Named_object* named_function)
 	}
       if (defer_init != NULL)
 	init.push_back(defer_init);
+      if (preempt_init != NULL)
+	init.push_back(preempt_init);
+
+      // Once the stack map is initialized, link it into the goroutine.
+      Expression* stack_map_addr = NULL;
+      if (this->stack_map_ != NULL)
+	{
+	  Location loc = this->location_;
+	  Expression* ref =
+	    Expression::make_var_reference(this->stack_map_, loc);
+	  stack_map_addr = Expression::make_unary(OPERATOR_AND, ref, loc);
+	  Expression* call = Runtime::make_call(Runtime::PUSH_STACKMAP, loc, 1,
+						stack_map_addr);
+	  Bexpression* bcall = call->get_backend(&context);
+	  init.push_back(gogo->backend()->expression_statement(bcall));
+	}
       Bstatement* var_init = gogo->backend()->statement_list(init);
 
       // Initialize all variables before executing this code block.
@@ -5261,6 +5927,20 @@ Function::build(Gogo* gogo, Named_object* named_function)
                                                            this->location_);
 	}
 
+      // Unlink the stack map however we leave the function, after
+      // the deferred functions have run.
+      if (stack_map_addr != NULL)
+	{
+	  Expression* call = Runtime::make_call(Runtime::POP_STACKMAP,
+						this->location_, 1,
+						stack_map_addr->copy());
+	  Bexpression* bcall = call->get_backend(&context);
+	  Bstatement* pop = gogo->backend()->expression_statement(bcall);
+	  code_stmt =
+	    gogo->backend()->exception_handler_statement(code_stmt, NULL, pop,
+							 this->location_);
+	}
+
       // Stick the code into the block we built for the receiver, if
       // we built one.
       if (var_decls != NULL)
@@ -538,6 +538,11 @@ class Gogo
   void
   check_types_in_block(Block*);
 
+  // Find allocations which do not escape the function which makes
+  // them, so that they may be put on the stack.
+  void
+  analyze_escape();
+
   // Check for return statements.
   void
   check_return_statements();
@@ -621,6 +626,11 @@ class Gogo
   Expression*
   allocate_memory(Type *type, Location);
 
+  // Return whether a value of type TYPE which does not escape may be
+  // allocated on the stack.
+  bool
+  may_allocate_on_stack(Type*);
+
   // Get the name of the magic initialization function.
   const std::string&
   get_init_fn_name();
@@ -1138,6 +1148,18 @@ class Function
   Expression*
   defer_stack(Location);
 
+  // Get the temporary variable which counts the loop iterations of
+  // the function for -fgo-optimize-preempt.  All the loops share it.
+  Temporary_statement*
+  preempt_count(Location);
+
+  // Get the statement which adds the local variable VAR to the
+  // function's stack map once it has been declared.  This returns
+  // NULL if the stack map does not describe VAR.
+  Bstatement*
+  stack_map_entry(Gogo*, Named_object* function, Named_object* var,
+		  Location);
+
   // Export the function.
   void
   export_func(Export*, const std::string& name) const;
@@ -1160,6 +1182,12 @@ class Function
   void
   build_defer_wrapper(Gogo*, Named_object*, Bstatement**, Bstatement**);
 
+  Bexpression*
+  make_stack_map(Gogo*, Named_object*);
+
+  Bexpression*
+  stack_map_value(Gogo*, Named_object*, Named_object*, Location);
+
   typedef std::vector<std::pair<Named_object*,
 				Location> > Closure_fields;
 
@@ -1193,6 +1221,15 @@ class Function
   // distinguish the defer stack for one function from another.  This
   // is NULL unless we actually need a defer stack.
   Temporary_statement* defer_stack_;
+  // The loop iteration counter, with -fgo-optimize-preempt.  This is
+  // NULL unless the function has a loop.
+  Temporary_statement* preempt_count_;
+  // The variables described by the stack map, with
+  // -fgo-optimize-stackmaps.  Parameters and results come first.
+  std::vector<Named_object*> stack_map_vars_;
+  // The stack map variable.  This is NULL unless the function has a
+  // stack map.
+  Named_object* stack_map_;
   // True if this function is sink-named.  No code is generated.
   bool is_sink_ : 1;
   // True if the result variables are named.
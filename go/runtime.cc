@@ -390,15 +390,62 @@ Runtime::make_call(Runtime::Function code, Location loc,
 }
 
 // The type we use for a map iteration.  This is really a struct which
-// is four pointers long.  This must match the runtime struct
+// is five pointers long.  This must match the runtime struct
 // __go_hash_iter.
 
 Type*
 Runtime::map_iteration_type()
 {
-  const unsigned long map_iteration_size = 4;
+  const unsigned long map_iteration_size = 5;
   Expression* iexpr =
     Expression::make_integer_ul(map_iteration_size, NULL,
 				Linemap::predeclared_location());
   return Type::make_array_type(runtime_function_type(RFT_POINTER), iexpr);
 }
+
+// Return the function to call for the map operation CODE on a map of
+// type MT.  The runtime has versions of the map functions which hash
+// and compare keys inline rather than calling the functions of the
+// key type descriptor.  They may only be used when they agree with
+// those functions, which is true of strings and of the types of 32 or
+// 64 bits which are compared by identity and are never structs or
+// arrays: integers, pointers and channels.
+
+Runtime::Function
+Runtime::map_function(Map_type* mt, Function code)
+{
+  Type* key_type = mt->key_type();
+  int bits = 0;
+  bool is_string = false;
+  if (key_type->is_string_type())
+    is_string = true;
+  else if (key_type->integer_type() != NULL)
+    bits = key_type->integer_type()->bits();
+  else if (key_type->points_to() != NULL || key_type->channel_type() != NULL)
+    bits = Type::lookup_integer_type("uintptr")->integer_type()->bits();
+
+  if (!is_string && bits != 32 && bits != 64)
+    return code;
+
+  switch (code)
+    {
+    case MAP_INDEX:
+      return (is_string ? MAP_INDEX_FASTSTR
+	      : bits == 32 ? MAP_INDEX_FAST32
+	      : MAP_INDEX_FAST64);
+    case MAPACCESS2:
+      return (is_string ? MAPACCESS2_FASTSTR
+	      : bits == 32 ? MAPACCESS2_FAST32
+	      : MAPACCESS2_FAST64);
+    case MAPASSIGN2:
+      return (is_string ? MAPASSIGN2_FASTSTR
+	      : bits == 32 ? MAPASSIGN2_FAST32
+	      : MAPASSIGN2_FAST64);
+    case MAPDELETE:
+      return (is_string ? MAPDELETE_FASTSTR
+	      : bits == 32 ? MAPDELETE_FAST32
+	      : MAPDELETE_FAST64);
+    default:
+      go_unreachable();
+    }
+}
@@ -9,6 +9,7 @@
 
 class Gogo;
 class Type;
+class Map_type;
 class Named_object;
 class Call_expression;
 
@@ -43,6 +44,12 @@ class Runtime
   static Type*
   map_iteration_type();
 
+  // Return the function to call for the map operation CODE on a map
+  // of type MT.  This is either CODE or a version of it specialized
+  // for the key type.
+  static Function
+  map_function(Map_type* mt, Function code);
+
  private:
   static Named_object*
   runtime_declaration(Function);
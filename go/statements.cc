@@ -6,6 +6,8 @@
 
 #include "go-system.h"
 
+#include <algorithm>
+
 #include "go-c.h"
 #include "types.h"
 #include "expressions.h"
@@ -14,6 +16,7 @@
 #include "backend.h"
 #include "statements.h"
 #include "ast-dump.h"
+#include "go-optimize.h"
 
 // Class Statement.
 
@@ -269,7 +272,17 @@ Variable_declaration_statement::do_get_backend(Translate_context* context)
   if (!var->is_in_heap())
     {
       go_assert(binit != NULL);
-      return context->backend()->init_statement(bvar, binit);
+      Bstatement* binit_stmt = context->backend()->init_statement(bvar, binit);
+
+      // If the function describes this variable in its stack map,
+      // the entry becomes valid now that the variable is initialized.
+      Function* func = context->function()->func_value();
+      Bstatement* entry = func->stack_map_entry(context->gogo(),
+						context->function(),
+						this->var_, this->location());
+      if (entry != NULL)
+	binit_stmt = context->backend()->compound_statement(binit_stmt, entry);
+      return binit_stmt;
     }
 
   // Something takes the address of this variable, so the value is
@@ -1187,8 +1200,9 @@ Tuple_map_assignment_statement::do_lower(Gogo*, Named_object*,
   Expression* a3 = Expression::make_unary(OPERATOR_AND, ref, loc);
   ref = Expression::make_temporary_reference(val_temp, loc);
   Expression* a4 = Expression::make_unary(OPERATOR_AND, ref, loc);
-  Expression* call = Runtime::make_call(Runtime::MAPACCESS2, loc, 4,
-					a1, a2, a3, a4);
+  Runtime::Function code = Runtime::map_function(map_type,
+						 Runtime::MAPACCESS2);
+  Expression* call = Runtime::make_call(code, loc, 4, a1, a2, a3, a4);
   ref = Expression::make_temporary_reference(present_temp, loc);
   ref->set_is_lvalue();
   Statement* s = Statement::make_assignment(ref, call, loc);
@@ -1333,8 +1347,9 @@ Map_assignment_statement::do_lower(Gogo*, Named_object*, Block* enclosing,
   ref = Expression::make_temporary_reference(val_temp, loc);
   Expression* p3 = Expression::make_unary(OPERATOR_AND, ref, loc);
   Expression* p4 = Expression::make_temporary_reference(insert_temp, loc);
-  Expression* call = Runtime::make_call(Runtime::MAPASSIGN2, loc, 4,
-					p1, p2, p3, p4);
+  Runtime::Function code = Runtime::map_function(map_type,
+						 Runtime::MAPASSIGN2);
+  Expression* call = Runtime::make_call(code, loc, 4, p1, p2, p3, p4);
   Statement* s = Statement::make_statement(call, true);
   b->add_statement(s);
 
@@ -3413,6 +3428,23 @@ Case_clauses::Case_clause::lower(Block* b, Temporary_statement* val_temp,
       b->add_statement(s);
     }
 
+  this->lower_statements(b, start_label, finish_label);
+
+  if (next_case_label != NULL)
+    b->add_statement(Statement::make_unnamed_label_statement(next_case_label));
+}
+
+// Add the statements of a case clause to B.  If START_LABEL is not
+// NULL, it goes before them.  We branch to FINISH_LABEL at the end of
+// the statements.
+
+void
+Case_clauses::Case_clause::lower_statements(Block* b,
+					    Unnamed_label* start_label,
+					    Unnamed_label* finish_label) const
+{
+  Location loc = this->location_;
+
   if (start_label != NULL)
     b->add_statement(Statement::make_unnamed_label_statement(start_label));
 
@@ -3421,9 +3453,6 @@ Case_clauses::Case_clause::lower(Block* b, Temporary_statement* val_temp,
 
   Statement* s = Statement::make_goto_unnamed_statement(finish_label, loc);
   b->add_statement(s);
-
-  if (next_case_label != NULL)
-    b->add_statement(Statement::make_unnamed_label_statement(next_case_label));
 }
 
 // Determine types.
@@ -3663,6 +3692,211 @@ Case_clauses::lower(Block* b, Temporary_statement* val_temp,
 			default_finish_label);
 }
 
+// Check whether all the case values are string constants which may
+// be compared with a value of type TYPE without a conversion, and
+// whether there are enough of them to search.  If there are too few,
+// or if the types do not match, we lower to comparisons, which will
+// report any errors.
+
+bool
+Case_clauses::is_constant_string(Type* type) const
+{
+  if (!type->is_string_type())
+    return false;
+  size_t count = 0;
+  for (Clauses::const_iterator p = this->clauses_.begin();
+       p != this->clauses_.end();
+       ++p)
+    {
+      const Expression_list* cases = p->cases();
+      if (cases == NULL)
+	continue;
+      for (Expression_list::const_iterator pc = cases->begin();
+	   pc != cases->end();
+	   ++pc)
+	{
+	  std::string val;
+	  if (!(*pc)->string_constant_value(&val))
+	    return false;
+	  Type* ctype = (*pc)->type();
+	  if (!ctype->is_abstract()
+	      && !Type::are_identical(type, ctype, false, NULL))
+	    return false;
+	  ++count;
+	}
+    }
+  return count >= string_search_min_cases;
+}
+
+// Order the case values of a switch on a string by length, and then
+// by value.  Like __go_strcmp, this compares the bytes as unsigned
+// values, which the binary search relies on.
+
+bool
+Case_clauses::String_case::operator<(const String_case& c) const
+{
+  if (this->val.length() != c.val.length())
+    return this->val.length() < c.val.length();
+  return this->val.compare(c.val) < 0;
+}
+
+// Lower a switch on a string whose case values are all constants.
+// VAL_TEMP is the value we are switching on.  Rather than comparing
+// the value with each case in turn, we switch on its length, which
+// the backend turns into a jump table or a decision tree, and then
+// do a binary search of the case values with that length.  The
+// statements of the clauses follow in their original order, so that
+// fallthrough works as usual.
+
+void
+Case_clauses::lower_string(Gogo* gogo, Block* b,
+			   Temporary_statement* val_temp,
+			   Unnamed_label* break_label) const
+{
+  Location loc = val_temp->location();
+
+  // Give each clause a label, and collect the case values.  The
+  // first clause with a given value is the one which matches, and a
+  // stable sort keeps it first.
+  std::vector<Unnamed_label*> labels;
+  labels.reserve(this->clauses_.size());
+  Unnamed_label* default_label = NULL;
+  String_cases cases;
+  for (size_t i = 0; i < this->clauses_.size(); ++i)
+    {
+      const Case_clause& c(this->clauses_[i]);
+      labels.push_back(new Unnamed_label(Linemap::unknown_location()));
+      if (c.is_default())
+	default_label = labels.back();
+      const Expression_list* exprs = c.cases();
+      if (exprs == NULL)
+	continue;
+      for (Expression_list::const_iterator p = exprs->begin();
+	   p != exprs->end();
+	   ++p)
+	{
+	  String_case sc;
+	  bool ok = (*p)->string_constant_value(&sc.val);
+	  go_assert(ok);
+	  sc.expr = *p;
+	  sc.clause = i;
+	  cases.push_back(sc);
+	}
+    }
+  std::stable_sort(cases.begin(), cases.end());
+
+  // switch len(VAL_TEMP) { case LEN: SEARCH ... }
+  Case_clauses* len_clauses = new Case_clauses();
+  size_t i = 0;
+  while (i < cases.size())
+    {
+      size_t len = cases[i].val.length();
+      String_cases same_len;
+      for (; i < cases.size() && cases[i].val.length() == len; ++i)
+	if (same_len.empty() || same_len.back().val != cases[i].val)
+	  same_len.push_back(cases[i]);
+
+      Block* search = new Block(b, loc);
+      Case_clauses::lower_string_search(search, val_temp, same_len, 0,
+					same_len.size(), labels);
+      Expression_list* vals = new Expression_list();
+      vals->push_back(Expression::make_integer_ul(len, NULL, loc));
+      len_clauses->add(vals, false, search, false, loc);
+    }
+
+  Named_object* len_fn = gogo->lookup_global("len");
+  go_assert(len_fn != NULL && len_fn->is_function_declaration());
+  Expression_list* params = new Expression_list();
+  params->push_back(Expression::make_temporary_reference(val_temp, loc));
+  Expression* len_call =
+    Expression::make_call(Expression::make_func_reference(len_fn, NULL, loc),
+			  params, false, loc);
+  Switch_statement* len_switch = Statement::make_switch_statement(len_call,
+								   loc);
+  len_switch->add_clauses(len_clauses);
+  b->add_statement(len_switch);
+
+  // Nothing matched.
+  Unnamed_label* no_match = (default_label != NULL
+			     ? default_label
+			     : break_label);
+  b->add_statement(Statement::make_goto_unnamed_statement(no_match, loc));
+
+  for (size_t i = 0; i < this->clauses_.size(); ++i)
+    {
+      const Case_clause& c(this->clauses_[i]);
+      Unnamed_label* finish_label = break_label;
+      if (c.is_fallthrough() && i + 1 < this->clauses_.size())
+	finish_label = labels[i + 1];
+      c.lower_statements(b, labels[i], finish_label);
+    }
+}
+
+// Add to B a search of the case values [FIRST, LAST) of a switch on a
+// string, which are sorted, distinct, and all of the same length.
+// VAL_TEMP is the value we are switching on.  If it matches, we jump
+// to the label in LABELS of the clause of the value; otherwise we
+// fall off the end of B.
+
+void
+Case_clauses::lower_string_search(Block* b, Temporary_statement* val_temp,
+				  const String_cases& cases,
+				  size_t first, size_t last,
+				  const std::vector<Unnamed_label*>& labels)
+{
+  // A binary search only pays once it saves a comparison.
+  if (last - first <= 3)
+    {
+      for (size_t i = first; i < last; ++i)
+	{
+	  Location loc = cases[i].expr->location();
+	  Expression* ref = Expression::make_temporary_reference(val_temp,
+								 loc);
+	  Expression* cond = Expression::make_binary(OPERATOR_EQEQ, ref,
+						     cases[i].expr, loc);
+	  Block* then_block = new Block(b, loc);
+	  then_block->add_statement(
+	      Statement::make_goto_unnamed_statement(labels[cases[i].clause],
+						     loc));
+	  b->add_statement(Statement::make_if_statement(cond, then_block, NULL,
+							loc));
+	}
+      return;
+    }
+
+  size_t mid = first + (last - first) / 2;
+  Location loc = cases[mid].expr->location();
+
+  // cmp := __go_strcmp(VAL_TEMP, CASE)
+  Expression* ref = Expression::make_temporary_reference(val_temp, loc);
+  Expression* call = Runtime::make_call(Runtime::STRCMP, loc, 2, ref,
+					cases[mid].expr);
+  Temporary_statement* cmp_temp = Statement::make_temporary(NULL, call, loc);
+  b->add_statement(cmp_temp);
+
+  // if cmp == 0 { goto LABEL }
+  Expression* zero = Expression::make_integer_ul(0, NULL, loc);
+  ref = Expression::make_temporary_reference(cmp_temp, loc);
+  Expression* cond = Expression::make_binary(OPERATOR_EQEQ, ref, zero, loc);
+  Block* then_block = new Block(b, loc);
+  then_block->add_statement(
+      Statement::make_goto_unnamed_statement(labels[cases[mid].clause], loc));
+  b->add_statement(Statement::make_if_statement(cond, then_block, NULL, loc));
+
+  // if cmp < 0 { SEARCH [FIRST, MID) } else { SEARCH [MID + 1, LAST) }
+  zero = Expression::make_integer_ul(0, NULL, loc);
+  ref = Expression::make_temporary_reference(cmp_temp, loc);
+  cond = Expression::make_binary(OPERATOR_LT, ref, zero, loc);
+  then_block = new Block(b, loc);
+  Case_clauses::lower_string_search(then_block, val_temp, cases, first, mid,
+				    labels);
+  Block* else_block = new Block(b, loc);
+  Case_clauses::lower_string_search(else_block, val_temp, cases, mid + 1,
+				    last, labels);
+  b->add_statement(Statement::make_if_statement(cond, then_block, else_block,
+						loc));
+}
+
 // Determine types.
 
 void
@@ -3876,11 +4110,11 @@ Switch_statement::do_traverse(Traverse* traverse)
   return this->clauses_->traverse(traverse);
 }
 
-// Lower a Switch_statement to a Constant_switch_statement or a series
-// of if statements.
+// Lower a Switch_statement to a Constant_switch_statement, a search
+// of constant strings, or a series of if statements.
 
 Statement*
-Switch_statement::do_lower(Gogo*, Named_object*, Block* enclosing,
+Switch_statement::do_lower(Gogo* gogo, Named_object*, Block* enclosing,
 			   Statement_inserter*)
 {
   Location loc = this->location();
@@ -3928,7 +4162,10 @@ Switch_statement::do_lower(Gogo*, Named_object*, Block* enclosing,
   Temporary_statement* val_temp = Statement::make_temporary(type, val, loc);
   b->add_statement(val_temp);
 
-  this->clauses_->lower(b, val_temp, this->break_label());
+  if (this->val_ != NULL && this->clauses_->is_constant_string(type))
+    this->clauses_->lower_string(gogo, b, val_temp, this->break_label());
+  else
+    this->clauses_->lower(b, val_temp, this->break_label());
 
   Statement* s = Statement::make_unnamed_label_statement(this->break_label_);
   b->add_statement(s);
@@ -4009,6 +4246,58 @@ Type_case_clauses::Type_case_clause::traverse(Traverse* traverse)
   return TRAVERSE_CONTINUE;
 }
 
+// Check that the type of a clause in a type switch is one which the
+// switch value may have.
+
+void
+Type_case_clauses::Type_case_clause::check_possible(Type* switch_val_type)
+  const
+{
+  Type* type = this->type_;
+  std::string reason;
+  if (switch_val_type->interface_type() != NULL
+      && !type->is_nil_constant_as_type()
+      && type->interface_type() == NULL
+      && !switch_val_type->interface_type()->implements_interface(type,
+								  &reason))
+    {
+      if (reason.empty())
+	error_at(this->location_, "impossible type switch case");
+      else
+	error_at(this->location_, "impossible type switch case (%s)",
+		 reason.c_str());
+    }
+}
+
+// Return the condition for a clause in a type switch to match.  The
+// type descriptor we are switching on is in DESCRIPTOR_TEMP.
+
+Expression*
+Type_case_clauses::Type_case_clause::match_condition(
+    Temporary_statement* descriptor_temp) const
+{
+  Location loc = this->location_;
+  Type* type = this->type_;
+
+  Expression* ref = Expression::make_temporary_reference(descriptor_temp,
+							 loc);
+
+  // The language permits case nil, which is of course a constant
+  // rather than a type.  It will appear here as an invalid
+  // forwarding type.
+  if (type->is_nil_constant_as_type())
+    return Expression::make_binary(OPERATOR_EQEQ, ref,
+				   Expression::make_nil(loc),
+				   loc);
+
+  return Runtime::make_call((type->interface_type() == NULL
+			     ? Runtime::IFACETYPEEQ
+			     : Runtime::IFACEI2TP),
+			    loc, 2,
+			    Expression::make_type_descriptor(type, loc),
+			    ref);
+}
+
 // Lower one clause in a type switch.  Add statements to the block B.
 // The type descriptor we are switching on is in DESCRIPTOR_TEMP.
 // BREAK_LABEL is the label at the end of the type switch.
@@ -4027,40 +4316,9 @@ Type_case_clauses::Type_case_clause::lower(Type* switch_val_type,
   Unnamed_label* next_case_label = NULL;
   if (!this->is_default_)
     {
-      Type* type = this->type_;
-
-      std::string reason;
-      if (switch_val_type->interface_type() != NULL
-	  && !type->is_nil_constant_as_type()
-	  && type->interface_type() == NULL
-	  && !switch_val_type->interface_type()->implements_interface(type,
-								      &reason))
-	{
-	  if (reason.empty())
-	    error_at(this->location_, "impossible type switch case");
-	  else
-	    error_at(this->location_, "impossible type switch case (%s)",
-		     reason.c_str());
-	}
+      this->check_possible(switch_val_type);
 
-      Expression* ref = Expression::make_temporary_reference(descriptor_temp,
-							     loc);
-
-      Expression* cond;
-      // The language permits case nil, which is of course a constant
-      // rather than a type.  It will appear here as an invalid
-      // forwarding type.
-      if (type->is_nil_constant_as_type())
-	cond = Expression::make_binary(OPERATOR_EQEQ, ref,
-				       Expression::make_nil(loc),
-				       loc);
-      else
-	cond = Runtime::make_call((type->interface_type() == NULL
-				   ? Runtime::IFACETYPEEQ
-				   : Runtime::IFACEI2TP),
-				  loc, 2,
-				  Expression::make_type_descriptor(type, loc),
-				  ref);
+      Expression* cond = this->match_condition(descriptor_temp);
 
       Unnamed_label* dest;
       if (!this->is_fallthrough_)
@@ -4123,6 +4381,32 @@ Type_case_clauses::Type_case_clause::lower(Type* switch_val_type,
     }
 }
 
+// Add the statements of a clause in a type switch to B, preceded by
+// STMTS_LABEL if it is not NULL and followed by a jump to
+// BREAK_LABEL.
+
+void
+Type_case_clauses::Type_case_clause::lower_statements(
+    Block* b,
+    Unnamed_label* stmts_label,
+    Unnamed_label* break_label) const
+{
+  go_assert(!this->is_fallthrough_);
+  Location loc = this->location_;
+  if (stmts_label != NULL)
+    {
+      if (this->statements_ != NULL)
+	stmts_label->set_location(this->statements_->start_location());
+      b->add_statement(Statement::make_unnamed_label_statement(stmts_label));
+    }
+  if (this->statements_ != NULL)
+    b->add_statement(Statement::make_block_statement(this->statements_, loc));
+  Location gloc = (this->statements_ == NULL
+		   ? loc
+		   : this->statements_->end_location());
+  b->add_statement(Statement::make_goto_unnamed_statement(break_label, gloc));
+}
+
 // Return true if this type clause may fall through to the statements
 // following the switch.
 
@@ -4209,22 +4493,168 @@ Type_case_clauses::check_duplicates() const
     }
 }
 
+// Return whether clause I in a type switch may be dispatched on the
+// hash code of its type.  That is possible for a concrete type,
+// since every type descriptor for a type holds the same hash code;
+// __go_type_descriptors_equal already relies on that.
+
+bool
+Type_case_clauses::can_hash_dispatch(size_t i) const
+{
+  const Type_case_clause& c(this->clauses_[i]);
+  if (c.is_default())
+    return false;
+  Type* type = c.type();
+  return (!type->is_nil_constant_as_type()
+	  && !type->is_error()
+	  && type->interface_type() == NULL);
+}
+
+// Lower the clauses [FIRST, LAST) of a type switch, which are all for
+// concrete types, by switching on the hash code of the type
+// descriptor we are switching on, which is in DESCRIPTOR_TEMP.  Each
+// case of the switch compares the descriptor with the types which
+// have that hash code, in order.  This makes a long type switch take
+// one comparison rather than one for each case.  If no type matches,
+// execution continues after the statements added to B.  The last
+// clause must not fall through to the next clause.
+
+void
+Type_case_clauses::lower_hash_dispatch(Gogo* gogo, Type* switch_val_type,
+				       Block* b,
+				       Temporary_statement* descriptor_temp,
+				       Unnamed_label* break_label,
+				       size_t first, size_t last) const
+{
+  go_assert(!this->clauses_[last - 1].is_fallthrough());
+  Location loc = this->clauses_[first].location();
+
+  // Give each clause which has statements a label, and note which
+  // hash codes we need.  Sorting by hash code and then by clause
+  // keeps the clauses for one hash code in order.
+  std::vector<Unnamed_label*> labels(last - first);
+  std::vector<std::pair<unsigned int, size_t> > hashes;
+  hashes.reserve(last - first);
+  for (size_t i = first; i < last; ++i)
+    {
+      const Type_case_clause& c(this->clauses_[i]);
+      c.check_possible(switch_val_type);
+      if (!c.is_fallthrough())
+	labels[i - first] = new Unnamed_label(Linemap::unknown_location());
+      // This is the hash code stored in the type descriptor.
+      unsigned int h = c.type()->hash_for_method(gogo);
+      hashes.push_back(std::make_pair(h, i));
+    }
+  std::sort(hashes.begin(), hashes.end());
+
+  // A case which falls through goes to the next clause with
+  // statements.
+  for (size_t i = last - 1; i > first; --i)
+    if (labels[i - 1 - first] == NULL)
+      labels[i - 1 - first] = labels[i - first];
+
+  // switch DESCRIPTOR_TEMP.hash { case H: if DESCRIPTOR_TEMP == T ||
+  // ifacetypeeq(T, DESCRIPTOR_TEMP) { goto LABEL } ... }
+  Case_clauses* cases = new Case_clauses();
+  for (size_t i = 0; i < hashes.size(); )
+    {
+      unsigned int h = hashes[i].first;
+      Block* case_block = new Block(b, loc);
+      for (; i < hashes.size() && hashes[i].first == h; ++i)
+	{
+	  const Type_case_clause& c(this->clauses_[hashes[i].second]);
+	  Location cloc = c.location();
+	  Expression* ref =
+	    Expression::make_temporary_reference(descriptor_temp, cloc);
+	  Expression* td = Expression::make_type_descriptor(c.type(), cloc);
+	  Expression* cond = Expression::make_binary(OPERATOR_EQEQ, ref, td,
+						     cloc);
+	  cond = Expression::make_binary(OPERATOR_OROR, cond,
+					 c.match_condition(descriptor_temp),
+					 cloc);
+	  Block* then_block = new Block(case_block, cloc);
+	  Unnamed_label* dest = labels[hashes[i].second - first];
+	  then_block->add_statement(Statement::make_goto_unnamed_statement(dest,
+									   cloc));
+	  case_block->add_statement(Statement::make_if_statement(cond,
+								 then_block,
+								 NULL, cloc));
+	}
+      Expression_list* vals = new Expression_list();
+      vals->push_back(Expression::make_integer_ul(h,
+						  Type::lookup_integer_type("uint32"),
+						  loc));
+      cases->add(vals, false, case_block, false, loc);
+    }
+
+  // The hash code is the fifth field of the type descriptor.
+  Expression* ref = Expression::make_temporary_reference(descriptor_temp,
+							 loc);
+  ref = Expression::make_unary(OPERATOR_MULT, ref, loc);
+  Expression* hash = Expression::make_field_reference(ref, 4, loc);
+  Switch_statement* switch_statement =
+    Statement::make_switch_statement(hash, loc);
+  switch_statement->add_clauses(cases);
+
+  // if DESCRIPTOR_TEMP != nil { switch ... }
+  ref = Expression::make_temporary_reference(descriptor_temp, loc);
+  Expression* cond = Expression::make_binary(OPERATOR_NOTEQ, ref,
+					     Expression::make_nil(loc), loc);
+  Block* then_block = new Block(b, loc);
+  then_block->add_statement(switch_statement);
+  b->add_statement(Statement::make_if_statement(cond, then_block, NULL, loc));
+
+  // goto NO_MATCH; LABEL: STATEMENTS; goto BREAK_LABEL; ...; NO_MATCH:
+  Unnamed_label* no_match = new Unnamed_label(Linemap::unknown_location());
+  b->add_statement(Statement::make_goto_unnamed_statement(no_match, loc));
+  for (size_t i = first; i < last; ++i)
+    {
+      const Type_case_clause& c(this->clauses_[i]);
+      if (!c.is_fallthrough())
+	c.lower_statements(b, labels[i - first], break_label);
+    }
+  b->add_statement(Statement::make_unnamed_label_statement(no_match));
+}
+
 // Lower the clauses in a type switch.  Add statements to the block B.
 // The type descriptor we are switching on is in DESCRIPTOR_TEMP.
-// BREAK_LABEL is the label at the end of the type switch.
+// BREAK_LABEL is the label at the end of the type switch.  Runs of at
+// least hash_dispatch_min_cases clauses for concrete types are
+// dispatched on the type hash code; the other clauses are tested in
+// order.
 
 void
-Type_case_clauses::lower(Type* switch_val_type, Block* b,
+Type_case_clauses::lower(Gogo* gogo, Type* switch_val_type, Block* b,
 			 Temporary_statement* descriptor_temp,
 			 Unnamed_label* break_label) const
 {
   const Type_case_clause* default_case = NULL;
 
   Unnamed_label* stmts_label = NULL;
-  for (Type_clauses::const_iterator p = this->clauses_.begin();
-       p != this->clauses_.end();
-       ++p)
-    {
+  size_t count = this->clauses_.size();
+  for (size_t i = 0; i < count; )
+    {
+      // Find the run of concrete types starting here.  It may not
+      // start with the statements of a clause which an earlier one
+      // falls through to, and it may not end with a clause which
+      // falls through to a later one.
+      size_t last = i;
+      if (stmts_label == NULL)
+	{
+	  while (last < count && this->can_hash_dispatch(last))
+	    ++last;
+	  while (last > i && this->clauses_[last - 1].is_fallthrough())
+	    --last;
+	}
+      if (last - i >= hash_dispatch_min_cases)
+	{
+	  this->lower_hash_dispatch(gogo, switch_val_type, b,
+				    descriptor_temp, break_label, i, last);
+	  i = last;
+	  continue;
+	}
+
+      const Type_case_clause* p = &this->clauses_[i];
       if (!p->is_default())
 	p->lower(switch_val_type, b, descriptor_temp, break_label,
 		 &stmts_label);
@@ -4232,8 +4662,9 @@ Type_case_clauses::lower(Type* switch_val_type, Block* b,
 	{
 	  // We are generating a series of tests, which means that we
 	  // need to move the default case to the end.
-	  default_case = &*p;
+	  default_case = p;
 	}
+      ++i;
     }
   go_assert(stmts_label == NULL);
 
@@ -4289,14 +4720,14 @@ Type_switch_statement::do_traverse(Traverse* traverse)
   return TRAVERSE_CONTINUE;
 }
 
-// Lower a type switch statement to a series of if statements.  The gc
-// compiler is able to generate a table in some cases.  However, that
-// does not work for us because we may have type descriptors in
-// different shared libraries, so we can't compare them with simple
-// equality testing.
+// Lower a type switch statement to a series of if statements.  We
+// may have type descriptors in different shared libraries, so we
+// can't compare them with simple equality testing.  However, all the
+// descriptors for a type hold the same hash code, so long runs of
+// cases switch on that first; see Type_case_clauses::lower.
 
 Statement*
-Type_switch_statement::do_lower(Gogo*, Named_object*, Block* enclosing,
+Type_switch_statement::do_lower(Gogo* gogo, Named_object*, Block* enclosing,
 				Statement_inserter*)
 {
   const Location loc = this->location();
@@ -4342,7 +4773,8 @@ Type_switch_statement::do_lower(Gogo*, Named_object*, Block* enclosing,
   b->add_statement(s);
 
   if (this->clauses_ != NULL)
-    this->clauses_->lower(val_type, b, descriptor_temp, this->break_label());
+    this->clauses_->lower(gogo, val_type, b, descriptor_temp,
+			  this->break_label());
 
   s = Statement::make_unnamed_label_statement(this->break_label_);
   b->add_statement(s);
@@ -5171,11 +5603,24 @@ For_statement::do_traverse(Traverse* traverse)
   return this->statements_->traverse(traverse);
 }
 
+// With -fgo-optimize-preempt, loops check every so often whether the
+// scheduler wants to stop the goroutine.  A goroutine is otherwise
+// only stopped when it calls into the runtime, so a loop that does
+// not can hold up the garbage collector indefinitely.
+
+Go_optimize optimize_preempt_flag("preempt");
+
+// The number of iterations between checks.  This must be a power of
+// 2.  The counting is cheap, but calling the runtime on every
+// iteration is not.
+
+static const unsigned long preempt_check_interval = 1024;
+
 // Lower a For_statement into if statements and gotos.  Getting rid of
 // complex statements make it easier to handle garbage collection.
 
 Statement*
-For_statement::do_lower(Gogo*, Named_object*, Block* enclosing,
+For_statement::do_lower(Gogo*, Named_object* function, Block* enclosing,
 			Statement_inserter*)
 {
   Statement* s;
@@ -5189,6 +5634,17 @@ For_statement::do_lower(Gogo*, Named_object*, Block* enclosing,
       b->add_statement(s);
     }
 
+  // The check counts the iterations in a temporary rather than
+  // testing a flag that the runtime sets, because nothing would stop
+  // the backend from loading such a flag once before the loop.  The
+  // loops of a function share one counter, so that the back-edges of
+  // nested loops all count towards the next check.
+  Temporary_statement* count = NULL;
+  if (optimize_preempt_flag.is_enabled()
+      && function != NULL
+      && function->is_function())
+    count = function->func_value()->preempt_count(loc);
+
   Unnamed_label* entry = NULL;
   if (this->cond_ != NULL)
     {
@@ -5217,6 +5673,38 @@ For_statement::do_lower(Gogo*, Named_object*, Block* enclosing,
       end_loc = this->post_->end_location();
     }
 
+  if (count != NULL)
+    {
+      //   count++
+      //   if count & (preempt_check_interval - 1) == 0 {
+      //           __go_preempt_check()
+      //   }
+      Type* uint32_type = count->type();
+      Temporary_reference_expression* ref =
+	Expression::make_temporary_reference(count, end_loc);
+      ref->set_is_lvalue();
+      b->add_statement(Statement::make_inc_statement(ref));
+
+      Expression* mask =
+	Expression::make_integer_ul(preempt_check_interval - 1, uint32_type,
+				    end_loc);
+      Expression* cond =
+	Expression::make_binary(OPERATOR_AND,
+				Expression::make_temporary_reference(count,
+								     end_loc),
+				mask, end_loc);
+      cond = Expression::make_binary(OPERATOR_EQEQ, cond,
+				     Expression::make_integer_ul(0, uint32_type,
+								 end_loc),
+				     end_loc);
+
+      Block* then_block = new Block(b, end_loc);
+      Expression* call = Runtime::make_call(Runtime::PREEMPT_CHECK, end_loc, 0);
+      then_block->add_statement(Statement::make_statement(call, true));
+      b->add_statement(Statement::make_if_statement(cond, then_block, NULL,
+						    end_loc));
+    }
+
   if (this->cond_ == NULL)
     b->add_statement(Statement::make_goto_unnamed_statement(top, end_loc));
   else
@@ -1307,6 +1307,17 @@ class Case_clauses
   void
   lower(Block*, Temporary_statement*, Unnamed_label*) const;
 
+  // Return true if all the case values are string constants which
+  // may be compared with a value of type TYPE, and there are enough
+  // of them to be worth searching.
+  bool
+  is_constant_string(Type*) const;
+
+  // Lower for a switch on a string when all the case values are
+  // constants.
+  void
+  lower_string(Gogo*, Block*, Temporary_statement*, Unnamed_label*) const;
+
   // Determine types of expressions.  The Type parameter is the type
   // of the switch value.
   void
@@ -1344,6 +1355,35 @@ class Case_clauses
   typedef Unordered_set_hash(Expression*, Hash_integer_value,
 			     Eq_integer_value) Case_constants;
 
+  // The smallest number of case values for which a switch on a
+  // string is lowered to a search rather than a series of
+  // comparisons.
+  static const size_t string_search_min_cases = 4;
+
+  // A case value in a switch on a string.
+  struct String_case
+  {
+    // The value of the constant.
+    std::string val;
+    // The case expression.
+    Expression* expr;
+    // The index of the clause.
+    size_t clause;
+
+    // Order by length, and then by value.
+    bool
+    operator<(const String_case&) const;
+  };
+
+  typedef std::vector<String_case> String_cases;
+
+  // Search the case values [FIRST, LAST) of a switch on a string,
+  // which all have the same length.
+  static void
+  lower_string_search(Block*, Temporary_statement*, const String_cases&,
+		      size_t first, size_t last,
+		      const std::vector<Unnamed_label*>& labels);
+
   // One case clause.
   class Case_clause
   {
@@ -1369,6 +1409,11 @@ class Case_clauses
     is_default() const
     { return this->is_default_; }
 
+    // The case expressions.  This is NULL for the default case.
+    const Expression_list*
+    cases() const
+    { return this->cases_; }
+
     // The location of this clause.
     Location
     location() const
@@ -1382,6 +1427,12 @@ class Case_clauses
     void
     lower(Block*, Temporary_statement*, Unnamed_label*, Unnamed_label*) const;
 
+    // Add the statements of this clause to B, after START_LABEL if it
+    // is not NULL, followed by a jump to FINISH_LABEL.
+    void
+    lower_statements(Block*, Unnamed_label* start_label,
+		     Unnamed_label* finish_label) const;
+
     // Determine types.
     void
     determine_types(Type*);
@@ -1518,7 +1569,7 @@ class Type_case_clauses
 
   // Lower to if and goto statements.
   void
-  lower(Type*, Block*, Temporary_statement* descriptor_temp,
+  lower(Gogo*, Type*, Block*, Temporary_statement* descriptor_temp,
 	Unnamed_label* break_label) const;
 
   // Return true if these clauses may fall through to the statements
@@ -1531,6 +1582,22 @@ class Type_case_clauses
   dump_clauses(Ast_dump_context*) const;
 
  private:
+  // The smallest number of consecutive cases for concrete types which
+  // are dispatched on the type hash code rather than tested one by
+  // one.
+  static const size_t hash_dispatch_min_cases = 4;
+
+  // Return whether clause I may be dispatched on its hash code.
+  bool
+  can_hash_dispatch(size_t i) const;
+
+  // Lower clauses [FIRST, LAST) by dispatching on the type hash code.
+  void
+  lower_hash_dispatch(Gogo*, Type*, Block*,
+		      Temporary_statement* descriptor_temp,
+		      Unnamed_label* break_label, size_t first,
+		      size_t last) const;
+
   // One type case clause.
   class Type_case_clause
   {
@@ -1556,6 +1623,28 @@ class Type_case_clauses
     is_default() const
     { return this->is_default_; }
 
+    // Whether this falls through to the next clause, as in "case T1,
+    // T2".
+    bool
+    is_fallthrough() const
+    { return this->is_fallthrough_; }
+
+    // Check that the type is one which the switch value may have.
+    void
+    check_possible(Type* switch_val_type) const;
+
+    // Return the condition for this clause to match, given the type
+    // descriptor of the value in DESCRIPTOR_TEMP.
+    Expression*
+    match_condition(Temporary_statement* descriptor_temp) const;
+
+    // Add the statements of this clause to B.  STMTS_LABEL, if not
+    // NULL, is the label to put before them.  This ends with a jump
+    // to BREAK_LABEL.
+    void
+    lower_statements(Block* b, Unnamed_label* stmts_label,
+		     Unnamed_label* break_label) const;
+
     // The location of this type clause.
     Location
     location() const
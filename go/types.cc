@@ -5308,13 +5308,46 @@ Struct_type::write_hash_function(Gogo* gogo, Named_type*,
   // Loop over the struct fields.
   bool first = true;
   const Struct_field_list* fields = this->fields_;
+  unsigned int index = 0;
   for (Struct_field_list::const_iterator pf = fields->begin();
        pf != fields->end();
-       ++pf)
+       ++pf, ++index)
     {
       if (Gogo::is_sink_name(pf->field_name()))
 	continue;
 
+      // A run of adjacent fields which can be compared using the
+      // identity function, with no padding between them, can be
+      // hashed as a single block of memory.  Find the last field of
+      // the run starting with this one.
+      Struct_field_list::const_iterator plast = pf;
+      unsigned int last_index = index;
+      unsigned long run_size = 0;
+      unsigned int run_offset = 0;
+      if (pf->type()->compare_is_identity(gogo)
+	  && this->backend_field_offset(gogo, index, &run_offset)
+	  && pf->type()->backend_type_size(gogo, &run_size))
+	{
+	  Struct_field_list::const_iterator pnext = pf;
+	  ++pnext;
+	  while (pnext != fields->end())
+	    {
+	      unsigned int next_offset;
+	      unsigned long next_size;
+	      if (Gogo::is_sink_name(pnext->field_name())
+		  || !pnext->type()->compare_is_identity(gogo)
+		  || !this->backend_field_offset(gogo, last_index + 1,
+						 &next_offset)
+		  || next_offset != run_offset + run_size
+		  || !pnext->type()->backend_type_size(gogo, &next_size))
+		break;
+	      run_size += next_size;
+	      plast = pnext;
+	      ++last_index;
+	      ++pnext;
+	    }
+	}
+
       if (first)
 	first = false;
       else
@@ -5335,11 +5368,16 @@ Struct_type::write_hash_function(Gogo* gogo, Named_type*,
 						   bloc);
       subkey = Expression::make_cast(key_arg_type, subkey, bloc);
 
-      // Get the size of this field.
-      Expression* size = Expression::make_type_info(pf->type(),
-						    Expression::TYPE_INFO_SIZE);
+      // Get the size of this field, or of the whole run.
+      Expression* size;
+      if (plast == pf)
+	size = Expression::make_type_info(pf->type(),
+					  Expression::TYPE_INFO_SIZE);
+      else
+	size = Expression::make_integer_ul(run_size, uintptr_type, bloc);
 
-      // Get the hash function to use for the type of this field.
+      // Get the hash function to use for the type of this field.  For
+      // a run this is the identity hash function.
       Named_object* hash_fn;
       Named_object* equal_fn;
       pf->type()->type_functions(gogo, pf->type()->named_type(), hash_fntype,
@@ -5359,6 +5397,9 @@ Struct_type::write_hash_function(Gogo* gogo, Named_type*,
       Statement* s = Statement::make_assignment_operation(OPERATOR_PLUSEQ,
 							  tref, call, bloc);
       gogo->add_statement(s);
+
+      pf = plast;
+      index = last_index;
     }
 
   // Return retval to the caller of the hash function.
@@ -6588,7 +6629,7 @@ Map_type::do_get_backend(Gogo* gogo)
   static Btype* backend_map_type;
   if (backend_map_type == NULL)
     {
-      std::vector<Backend::Btyped_identifier> bfields(4);
+      std::vector<Backend::Btyped_identifier> bfields(8);
 
       Location bloc = Linemap::predeclared_location();
 
@@ -6602,16 +6643,31 @@ Map_type::do_get_backend(Gogo* gogo)
       bfields[1].btype = uintptr_type->get_backend(gogo);
       bfields[1].location = bloc;
 
-      bfields[2].name = "__bucket_count";
+      bfields[2].name = "__growth_left";
       bfields[2].btype = bfields[1].btype;
       bfields[2].location = bloc;
 
+      bfields[3].name = "__flags";
+      bfields[3].btype = bfields[1].btype;
+      bfields[3].location = bloc;
+
       Btype* bvt = gogo->backend()->void_type();
       Btype* bpvt = gogo->backend()->pointer_type(bvt);
-      Btype* bppvt = gogo->backend()->pointer_type(bpvt);
-      bfields[3].name = "__buckets";
-      bfields[3].btype = bppvt;
-      bfields[3].location = bloc;
+      bfields[4].name = "__table";
+      bfields[4].btype = bpvt;
+      bfields[4].location = bloc;
+
+      bfields[5].name = "__old_table";
+      bfields[5].btype = bpvt;
+      bfields[5].location = bloc;
+
+      bfields[6].name = "__evacuated";
+      bfields[6].btype = bfields[1].btype;
+      bfields[6].location = bloc;
+
+      bfields[7].name = "__gc_next";
+      bfields[7].btype = bfields[1].btype;
+      bfields[7].location = bloc;
 
       Btype *bt = gogo->backend()->struct_type(bfields);
       bt = gogo->backend()->named_type("__go_map", bt, bloc);
@@ -6707,13 +6763,11 @@ Map_type::map_descriptor(Gogo* gogo)
 
   // The map entry type is a struct with three fields.  Build that
   // struct so that we can get the offsets of the key and value within
-  // a map entry.  The first field should technically be a pointer to
-  // this type itself, but since we only care about field offsets we
-  // just use pointer to bool.
-  Type* pbool = Type::make_pointer_type(Type::make_boolean_type());
+  // a map entry.  The first field holds the hash code of the key.
+  Type* uintptr_type = Type::lookup_integer_type("uintptr");
   Struct_type* map_entry_type =
     Type::make_builtin_struct_type(3,
-				   "__next", pbool,
+				   "__hash", uintptr_type,
 				   "__key", key_type,
 				   "__val", val_type);
 
@@ -12,6 +12,8 @@ import (
 type pollDesc struct {
 	fd      *netFD
 	closing bool
+
+	readIO, writeIO bool // never set
 }
 
 func (pd *pollDesc) Init(fd *netFD) error { pd.fd = fd; return nil }
@@ -54,6 +56,8 @@ func (pd *pollDesc) WaitRead() error { return pd.Wait('r') }
 
 func (pd *pollDesc) WaitWrite() error { return pd.Wait('w') }
 
+func (pd *pollDesc) IO(op int, p []byte) (int, error) { return 0, syscall.EAGAIN }
+
 func (pd *pollDesc) WaitCanceled(mode int) {}
 
 func (pd *pollDesc) WaitCanceledRead() {}
@@ -23,9 +23,14 @@ func runtime_pollWaitCanceled(ctx uintptr, mode int) int
 func runtime_pollReset(ctx uintptr, mode int) int
 func runtime_pollSetDeadline(ctx uintptr, d int64, mode int)
 func runtime_pollUnblock(ctx uintptr)
+func runtime_pollCompletion() bool
+func runtime_pollIO(ctx uintptr, op int, p *byte, n int) (int, int)
 
 type pollDesc struct {
 	runtimeCtx uintptr
+
+	// Whether IO may be used to read or accept, and to write.
+	readIO, writeIO bool
 }
 
 var serverInit sync.Once
@@ -37,6 +42,8 @@ func (pd *pollDesc) Init(fd *netFD) error {
 		return syscall.Errno(errno)
 	}
 	pd.runtimeCtx = ctx
+	pd.readIO = runtime_pollCompletion()
+	pd.writeIO = pd.readIO
 	return nil
 }
 
@@ -93,6 +100,41 @@ func (pd *pollDesc) WaitWrite() error {
 	return pd.Wait('w')
 }
 
+// IO lets the poller read into p, write from p or accept a connection,
+// as op is 'r', 'w' or 'a', once the descriptor is ready, and waits
+// for the result.  It returns syscall.EAGAIN if the caller should wait
+// for readiness and make the system call itself, which also reports a
+// deadline or close that cancelled the operation.
+func (pd *pollDesc) IO(op int, p []byte) (int, error) {
+	var b *byte
+	if len(p) > 0 {
+		b = &p[0]
+	}
+	res, errno := runtime_pollIO(pd.runtimeCtx, op, b, len(p))
+	if errno != 0 {
+		return 0, convertErr(errno)
+	}
+	if res >= 0 {
+		return res, nil
+	}
+	switch err := syscall.Errno(-res); err {
+	case syscall.ECANCELED:
+		return 0, syscall.EAGAIN
+	case syscall.EAGAIN:
+		// The kernel does not wait for this descriptor
+		// either, as older kernels do not for accept on a
+		// non-blocking socket.
+		if op == 'w' {
+			pd.writeIO = false
+		} else {
+			pd.readIO = false
+		}
+		return 0, err
+	default:
+		return 0, err
+	}
+}
+
 func (pd *pollDesc) WaitCanceled(mode int) {
 	runtime_pollWaitCanceled(pd.runtimeCtx, mode)
 }
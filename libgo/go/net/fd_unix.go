@@ -236,6 +236,10 @@ func (fd *netFD) Read(p []byte) (n int, err error) {
 	}
 	for {
 		n, err = syscall.Read(int(fd.sysfd), p)
+		if err == syscall.EAGAIN && fd.pd.readIO {
+			// Let the poller read when the data comes.
+			n, err = fd.pd.IO('r', p)
+		}
 		if err != nil {
 			n = 0
 			if err == syscall.EAGAIN {
@@ -325,6 +329,10 @@ func (fd *netFD) Write(p []byte) (nn int, err error) {
 	for {
 		var n int
 		n, err = syscall.Write(int(fd.sysfd), p[nn:])
+		if err == syscall.EAGAIN && fd.pd.writeIO {
+			// Let the poller write when there is room.
+			n, err = fd.pd.IO('w', p[nn:])
+		}
 		if n > 0 {
 			nn += n
 		}
@@ -414,6 +422,10 @@ func (fd *netFD) accept() (netfd *netFD, err error) {
 	}
 	for {
 		s, rsa, err = accept(fd.sysfd)
+		if err == syscall.EAGAIN && fd.pd.readIO {
+			// Let the poller accept when a connection comes.
+			s, rsa, err = fd.acceptIO()
+		}
 		if err != nil {
 			if err == syscall.EAGAIN {
 				if err = fd.pd.WaitRead(); err == nil {
@@ -442,6 +454,22 @@ func (fd *netFD) accept() (netfd *netFD, err error) {
 	return netfd, nil
 }
 
+// acceptIO accepts a connection through the poller, which sets the
+// new descriptor nonblocking and close-on-exec.
+func (fd *netFD) acceptIO() (int, syscall.Sockaddr, error) {
+	s, err := fd.pd.IO('a', nil)
+	if err != nil {
+		return -1, nil, err
+	}
+	rsa, err := syscall.Getpeername(s)
+	if err != nil {
+		// The connection was reset before we asked.
+		closesocket(s)
+		return -1, nil, syscall.ECONNABORTED
+	}
+	return s, rsa, nil
+}
+
 // tryDupCloexec indicates whether F_DUPFD_CLOEXEC should be used.
 // If the kernel doesn't support it, this is set to 0.
 var tryDupCloexec = int32(1)
@@ -0,0 +1,191 @@
+// Copyright 2014 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package net
+
+import (
+	"bytes"
+	"fmt"
+	"io"
+	"os"
+	"os/exec"
+	"strings"
+	"testing"
+	"time"
+)
+
+// TestIOUring runs the test binary again with GODEBUG=netpolluring=1,
+// where reads, writes and accepts that would block are done by the
+// io_uring poller, and checks that data, deadlines and close work.
+func TestIOUring(t *testing.T) {
+	if os.Getenv("GO_TEST_IO_URING") == "1" {
+		ioUringChild()
+		return
+	}
+	cmd := exec.Command(os.Args[0], "-test.run=^TestIOUring$")
+	for _, s := range os.Environ() {
+		if !strings.HasPrefix(s, "GODEBUG=") {
+			cmd.Env = append(cmd.Env, s)
+		}
+	}
+	cmd.Env = append(cmd.Env, "GODEBUG=netpolluring=1", "GO_TEST_IO_URING=1")
+	out, err := cmd.CombinedOutput()
+	output := string(out)
+	if strings.Contains(output, "SKIP\n") {
+		t.Skip("io_uring poller is not supported")
+	}
+	if err != nil {
+		t.Fatalf("%v\n%s", err, output)
+	}
+	if !strings.Contains(output, "OK\n") {
+		t.Fatalf("child did not report OK:\n%s", output)
+	}
+}
+
+func ioUringChild() {
+	serverInit.Do(runtime_pollServerInit)
+	if !runtime_pollCompletion() {
+		fmt.Println("SKIP")
+		return
+	}
+	for _, f := range []func() error{ioUringEcho, ioUringDeadline, ioUringClose} {
+		if err := f(); err != nil {
+			fmt.Println(err)
+			return
+		}
+	}
+	fmt.Println("OK")
+}
+
+// ioUringPair returns both ends of a TCP connection.  The accept is
+// started before the dial, so that it waits in the poller.
+func ioUringPair() (ln Listener, c, s Conn, err error) {
+	ln, err = Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		return nil, nil, nil, err
+	}
+	type accepted struct {
+		c   Conn
+		err error
+	}
+	ch := make(chan accepted)
+	go func() {
+		c, err := ln.Accept()
+		ch <- accepted{c, err}
+	}()
+	time.Sleep(10 * time.Millisecond)
+	c, err = Dial("tcp", ln.Addr().String())
+	if err != nil {
+		ln.Close()
+		return nil, nil, nil, err
+	}
+	a := <-ch
+	if a.err != nil {
+		ln.Close()
+		c.Close()
+		return nil, nil, nil, a.err
+	}
+	return ln, c, a.c, nil
+}
+
+// ioUringEcho sends more data than the socket buffers hold through an
+// echo server, so that both sides wait to read and to write.
+func ioUringEcho() error {
+	ln, c, s, err := ioUringPair()
+	if err != nil {
+		return err
+	}
+	defer ln.Close()
+	defer c.Close()
+	go func() {
+		defer s.Close()
+		io.Copy(s, s)
+	}()
+
+	want := make([]byte, 4<<20)
+	for i := range want {
+		want[i] = byte(i * 7)
+	}
+	errc := make(chan error, 1)
+	go func() {
+		_, err := c.Write(want)
+		errc <- err
+	}()
+	got := make([]byte, len(want))
+	if _, err := io.ReadFull(c, got); err != nil {
+		return fmt.Errorf("echo: Read failed: %v", err)
+	}
+	if err := <-errc; err != nil {
+		return fmt.Errorf("echo: Write failed: %v", err)
+	}
+	if !bytes.Equal(got, want) {
+		return fmt.Errorf("echo: data differs")
+	}
+	return nil
+}
+
+func ioUringTimeout(err error) bool {
+	e, ok := err.(Error)
+	return ok && e.Timeout()
+}
+
+// ioUringDeadline checks that deadlines cancel reads and accepts, and
+// that nothing is lost by the cancelled read.
+func ioUringDeadline() error {
+	ln, c, s, err := ioUringPair()
+	if err != nil {
+		return err
+	}
+	defer ln.Close()
+	defer c.Close()
+	defer s.Close()
+
+	var b [16]byte
+	c.SetReadDeadline(time.Now().Add(50 * time.Millisecond))
+	if _, err := c.Read(b[:]); !ioUringTimeout(err) {
+		return fmt.Errorf("deadline: Read returned %v, want timeout", err)
+	}
+	c.SetReadDeadline(time.Time{})
+	go func() {
+		time.Sleep(10 * time.Millisecond)
+		s.Write([]byte("x"))
+	}()
+	if n, err := c.Read(b[:]); n != 1 || b[0] != 'x' || err != nil {
+		return fmt.Errorf("deadline: Read after timeout returned %q, %v", b[:n], err)
+	}
+
+	ln.(*TCPListener).SetDeadline(time.Now().Add(50 * time.Millisecond))
+	if _, err := ln.Accept(); !ioUringTimeout(err) {
+		return fmt.Errorf("deadline: Accept returned %v, want timeout", err)
+	}
+	return nil
+}
+
+// ioUringClose checks that Close ends a read waiting in the poller.
+func ioUringClose() error {
+	ln, c, s, err := ioUringPair()
+	if err != nil {
+		return err
+	}
+	defer ln.Close()
+	defer s.Close()
+
+	errc := make(chan error, 1)
+	go func() {
+		var b [16]byte
+		_, err := c.Read(b[:])
+		errc <- err
+	}()
+	time.Sleep(50 * time.Millisecond)
+	c.Close()
+	select {
+	case err := <-errc:
+		if err == nil || ioUringTimeout(err) {
+			return fmt.Errorf("close: Read returned %v, want an error", err)
+		}
+	case <-time.After(5 * time.Second):
+		return fmt.Errorf("close: Read did not return")
+	}
+	return nil
+}
@@ -283,6 +283,84 @@ func benchmarkTCPConcurrentReadWrite(b *testing.B, laddr string) {
 	wg.Wait()
 }
 
+// The echo benchmarks exercise the network poller with many busy
+// connections, each of which waits for its echo before it sends
+// again.  Run them with and without GODEBUG=netpolluring=1 to compare
+// the io_uring and epoll pollers.
+
+func BenchmarkTCP4Echo(b *testing.B) {
+	benchmarkTCPEcho(b, "127.0.0.1:0")
+}
+
+func BenchmarkTCP6Echo(b *testing.B) {
+	if !supportsIPv6 {
+		b.Skip("ipv6 is not supported")
+	}
+	benchmarkTCPEcho(b, "[::1]:0")
+}
+
+func benchmarkTCPEcho(b *testing.B, laddr string) {
+	// The benchmark sends b.N messages over 64 connections to an
+	// echo server, with one client goroutine and one server
+	// goroutine for each connection.
+	const conns = 64
+	const msgLen = 64
+
+	ln, err := Listen("tcp", laddr)
+	if err != nil {
+		b.Fatalf("Listen failed: %v", err)
+	}
+	defer ln.Close()
+	go func() {
+		for {
+			c, err := ln.Accept()
+			if err != nil {
+				return
+			}
+			go func(c Conn) {
+				defer c.Close()
+				io.Copy(c, c)
+			}(c)
+		}
+	}()
+
+	clients := make([]Conn, conns)
+	for i := range clients {
+		c, err := Dial("tcp", ln.Addr().String())
+		if err != nil {
+			b.Fatalf("Dial failed: %v", err)
+		}
+		defer c.Close()
+		clients[i] = c
+	}
+
+	b.SetBytes(msgLen)
+	b.ResetTimer()
+	var wg sync.WaitGroup
+	wg.Add(conns)
+	for i, c := range clients {
+		n := b.N / conns
+		if i < b.N%conns {
+			n++
+		}
+		go func(c Conn, n int) {
+			defer wg.Done()
+			var buf [msgLen]byte
+			for ; n > 0; n-- {
+				if _, err := c.Write(buf[:]); err != nil {
+					b.Errorf("Write failed: %v", err)
+					return
+				}
+				if _, err := io.ReadFull(c, buf[:]); err != nil {
+					b.Errorf("Read failed: %v", err)
+					return
+				}
+			}
+		}(c, n)
+	}
+	wg.Wait()
+}
+
 type resolveTCPAddrTest struct {
 	net           string
 	litAddrOrName string
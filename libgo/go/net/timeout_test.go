@@ -709,6 +709,69 @@ func TestProlongTimeout(t *testing.T) {
 	}
 }
 
+func TestDeadlineExtendFromManyProcs(t *testing.T) {
+	switch runtime.GOOS {
+	case "nacl", "plan9":
+		t.Skipf("skipping test on %q", runtime.GOOS)
+	}
+
+	// Several goroutines keep pushing the read deadline out while a
+	// read is blocked.  Each push only moves the deadline past the
+	// pending timer, which fires early and is added again, possibly
+	// to the timer heap of another P.  The read must not time out
+	// while the deadline keeps moving, and must time out once it
+	// stops.
+	defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(4))
+	ln := newLocalListener(t)
+	defer ln.Close()
+	c, err := Dial("tcp", ln.Addr().String())
+	if err != nil {
+		t.Fatalf("Dial: %v", err)
+	}
+	defer c.Close()
+	const extend = 500 * time.Millisecond
+	c.SetReadDeadline(time.Now().Add(extend))
+	done := make(chan error, 1)
+	go func() {
+		var buf [1]byte
+		_, err := c.Read(buf[:])
+		done <- err
+	}()
+	stop := time.Now().Add(3 * extend)
+	var last [4]time.Time
+	finished := make(chan bool)
+	for i := range last {
+		go func(i int) {
+			for time.Now().Before(stop) {
+				last[i] = time.Now().Add(extend)
+				c.SetReadDeadline(last[i])
+				time.Sleep(extend / 50)
+			}
+			finished <- true
+		}(i)
+	}
+	for range last {
+		<-finished
+	}
+	latest := last[0]
+	for _, d := range last[1:] {
+		if d.After(latest) {
+			latest = d
+		}
+	}
+	select {
+	case err := <-done:
+		if !isTimeout(err) {
+			t.Fatalf("Read: got %v; want timeout", err)
+		}
+		if now := time.Now(); now.Before(latest.Add(-extend / 2)) {
+			t.Errorf("Read timed out %v before the last deadline", latest.Sub(now))
+		}
+	case <-time.After(10 * time.Second):
+		t.Fatal("Read did not time out after the deadline stopped moving")
+	}
+}
+
 func TestDeadlineRace(t *testing.T) {
 	switch runtime.GOOS {
 	case "nacl", "plan9":
@@ -21,8 +21,10 @@ type GCStats struct {
 
 // Implemented in package runtime.
 func readGCStats(*[]time.Duration)
+func readGCPauseHistogram(*[]int64)
 func enableGC(bool) bool
 func setGCPercent(int) int
+func setMemoryLimit(int64) int64
 func freeOSMemory()
 func setMaxStack(int) int
 func setMaxThreads(int) int
@@ -77,6 +79,18 @@ func ReadGCStats(stats *GCStats) {
 	}
 }
 
+// GCPauseHistogram returns a histogram of the times the garbage
+// collector has stopped the world.  Element i counts the pauses which
+// took at least 2^i and less than 2^(i+1) microseconds; element 0 also
+// counts shorter pauses.  A collection which marks concurrently (see
+// GODEBUG=gcconcurrent=1 in the runtime package) stops the world twice,
+// and both pauses are counted.
+func GCPauseHistogram() []int64 {
+	hist := make([]int64, 32)
+	readGCPauseHistogram(&hist)
+	return hist
+}
+
 type byDuration []time.Duration
 
 func (x byDuration) Len() int           { return len(x) }
@@ -96,6 +110,23 @@ func SetGCPercent(percent int) int {
 	return old
 }
 
+// SetMemoryLimit sets a soft limit, in bytes, on the memory the
+// runtime maps from the operating system, and returns the previous
+// limit. As the program approaches the limit, collections start earlier
+// than the GC percentage alone would start them, and idle heap memory is
+// returned to the operating system. The limit is soft: a program whose
+// live data exceeds it keeps running, collecting about every time its
+// heap grows by a sixteenth.
+// A negative limit leaves the setting unchanged, so SetMemoryLimit(-1)
+// reports the current limit. math.MaxInt64 means no limit.
+// The initial setting is the value of the GOMEMLIMIT environment
+// variable at startup, or no limit if the variable is not set.
+// A limit works together with SetGCPercent(-1): the collector then
+// runs only when the limit requires it.
+func SetMemoryLimit(limit int64) int64 {
+	return setMemoryLimit(limit)
+}
+
 // FreeOSMemory forces a garbage collection followed by an
 // attempt to return as much memory to the operating system
 // as possible. (Even if this is not called, the runtime gradually
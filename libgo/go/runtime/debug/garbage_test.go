@@ -100,3 +100,62 @@ func TestSetGCPercent(t *testing.T) {
 		t.Errorf("SetGCPercent(123); SetGCPercent(x) = %d, want 123", new)
 	}
 }
+
+func TestSetMemoryLimit(t *testing.T) {
+	old := SetMemoryLimit(1 << 40)
+	if cur := SetMemoryLimit(-1); cur != 1<<40 {
+		t.Errorf("SetMemoryLimit(1<<40); SetMemoryLimit(-1) = %d, want %d", cur, 1<<40)
+	}
+
+	// With the proportional pacer off, only the limit can start a
+	// collection.
+	oldpercent := SetGCPercent(-1)
+	var ms runtime.MemStats
+	runtime.ReadMemStats(&ms)
+	SetMemoryLimit(int64(ms.Sys) + 32<<20)
+	numgc := ms.NumGC
+	allocate := func() {
+		var sink []byte
+		for i := 0; i < 128; i++ {
+			sink = make([]byte, 1<<20)
+		}
+		_ = sink
+	}
+	allocate()
+	runtime.ReadMemStats(&ms)
+	if ms.NumGC == numgc {
+		t.Errorf("allocated 128 MB under a 32 MB headroom limit with GOGC=off; no collection ran")
+	}
+
+	// Once the limit is gone and the percentage is back, the
+	// proportional pacer must start collections on its own again.
+	SetMemoryLimit(old)
+	SetGCPercent(oldpercent)
+	if oldpercent < 0 {
+		return
+	}
+	runtime.ReadMemStats(&ms)
+	numgc = ms.NumGC
+	allocate()
+	runtime.ReadMemStats(&ms)
+	if ms.NumGC == numgc {
+		t.Errorf("allocated 128 MB after restoring GOGC=%d; no collection ran (NextGC=%d)", oldpercent, ms.NextGC)
+	}
+}
+
+func TestGCPauseHistogram(t *testing.T) {
+	const n = 4
+	count := func() (c int64) {
+		for _, v := range GCPauseHistogram() {
+			c += v
+		}
+		return c
+	}
+	before := count()
+	for i := 0; i < n; i++ {
+		runtime.GC()
+	}
+	if after := count(); after < before+n {
+		t.Errorf("pause count before=%d; after=%d; want at least %d more", before, after, n)
+	}
+}
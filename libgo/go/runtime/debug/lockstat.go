@@ -0,0 +1,41 @@
+// Copyright 2014 The Go Authors.  All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package debug
+
+import "time"
+
+// LockStat reports the contention on one of the locks which the
+// runtime uses internally, such as the scheduler and heap locks.
+type LockStat struct {
+	Addr      uintptr       // address of the lock
+	Contended int64         // number of acquisitions which found the lock held
+	Wait      time.Duration // total time those acquisitions waited
+}
+
+// Implemented in package runtime.
+func readLockStats([]uint64) int
+
+// LockStats returns the contention on the runtime's internal locks
+// since the program started.  The runtime only records it when the
+// GODEBUG environment variable contains lockprof=1, so LockStats
+// otherwise returns nil.
+func LockStats() []LockStat {
+	// Grow the buffer until it is not filled.
+	buf := make([]uint64, 3*64)
+	n := readLockStats(buf)
+	for n+3 > len(buf) {
+		buf = make([]uint64, 2*len(buf))
+		n = readLockStats(buf)
+	}
+	var stats []LockStat
+	for i := 0; i < n; i += 3 {
+		stats = append(stats, LockStat{
+			Addr:      uintptr(buf[i]),
+			Contended: int64(buf[i+1]),
+			Wait:      time.Duration(buf[i+2]),
+		})
+	}
+	return stats
+}
@@ -0,0 +1,31 @@
+// Copyright 2014 The Go Authors.  All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package debug
+
+import (
+	"os"
+	"strings"
+	"testing"
+)
+
+func TestLockStats(t *testing.T) {
+	stats := LockStats()
+	if !strings.Contains(os.Getenv("GODEBUG"), "lockprof=1") {
+		if stats != nil {
+			t.Errorf("LockStats returned %d entries without lockprof=1", len(stats))
+		}
+		return
+	}
+	seen := make(map[uintptr]bool)
+	for _, s := range stats {
+		if s.Addr == 0 || s.Contended <= 0 || s.Wait < 0 {
+			t.Errorf("bad LockStat %+v", s)
+		}
+		if seen[s.Addr] {
+			t.Errorf("lock %#x reported twice", s.Addr)
+		}
+		seen[s.Addr] = true
+	}
+}
@@ -0,0 +1,44 @@
+// Copyright 2014 The Go Authors.  All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package debug
+
+import "runtime"
+
+// CPUDomain is a group of CPUs which share a last level cache.  The
+// scheduler prefers to move goroutines between processors running in
+// the same domain, then between domains on the same NUMA node.
+type CPUDomain struct {
+	Node int   // NUMA node of the CPUs
+	CPUs []int // CPU numbers, in increasing order
+}
+
+// Implemented in package runtime.
+func readCPUTopology([]int) int
+
+// CPUTopology returns the domains of the CPUs the program may run
+// on, as found by the runtime at startup, or nil if the runtime does
+// not know the topology on this system.
+func CPUTopology() []CPUDomain {
+	// readCPUTopology passes back a CPU number, domain and node
+	// for each CPU.  NumCPU may be lower than the number of CPUs,
+	// because of a CPU quota, so grow the buffer until it is not
+	// filled.
+	buf := make([]int, 3*runtime.NumCPU())
+	n := readCPUTopology(buf)
+	for n == len(buf) {
+		buf = make([]int, 2*len(buf))
+		n = readCPUTopology(buf)
+	}
+	var domains []CPUDomain
+	for i := 0; i < n; i += 3 {
+		cpu, d, node := buf[i], buf[i+1], buf[i+2]
+		for len(domains) <= d {
+			domains = append(domains, CPUDomain{})
+		}
+		domains[d].Node = node
+		domains[d].CPUs = append(domains[d].CPUs, cpu)
+	}
+	return domains
+}
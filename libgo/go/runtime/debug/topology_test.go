@@ -0,0 +1,33 @@
+// Copyright 2014 The Go Authors.  All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package debug
+
+import (
+	"runtime"
+	"testing"
+)
+
+func TestCPUTopology(t *testing.T) {
+	domains := CPUTopology()
+	if domains == nil {
+		t.Skip("CPU topology not known")
+	}
+	seen := make(map[int]bool)
+	for i, d := range domains {
+		if len(d.CPUs) == 0 {
+			t.Errorf("domain %d has no CPUs", i)
+		}
+		for _, cpu := range d.CPUs {
+			if seen[cpu] {
+				t.Errorf("CPU %d is in more than one domain", cpu)
+			}
+			seen[cpu] = true
+		}
+	}
+	// A CPU quota can make NumCPU lower.
+	if len(seen) < runtime.NumCPU() {
+		t.Errorf("domains have %d CPUs, NumCPU is %d", len(seen), runtime.NumCPU())
+	}
+}
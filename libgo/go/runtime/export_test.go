@@ -60,6 +60,10 @@ func ParForIters(desc *ParFor, tid uint32) (uint32, uint32) {
 	return uint32(begin), uint32(end)
 }
 
+func itabCacheStats() (hits, misses uint64)
+
+var ItabCacheStats = itabCacheStats
+
 func testSchedLocalQueue()
 func testSchedLocalQueueSteal()
 
@@ -85,6 +89,10 @@ func memclrBytes(b []byte)
 
 var MemclrBytes = memclrBytes
 
+func sysTrackWrites() bool
+
+var SysTrackWrites = sysTrackWrites
+
 // func gogoBytes() int32
 
 // var GogoBytes = gogoBytes
@@ -21,6 +21,14 @@ is GOGC=100. Setting GOGC=off disables the garbage collector entirely.
 The runtime/debug package's SetGCPercent function allows changing this
 percentage at run time. See http://golang.org/pkg/runtime/debug/#SetGCPercent.
 
+The GOMEMLIMIT variable sets a soft limit on the memory the runtime maps from
+the operating system, as a number of bytes with an optional B, KiB, MiB, GiB
+or TiB suffix, for example GOMEMLIMIT=512MiB. Near the limit collections run
+more often and idle memory is returned to the operating system. The default,
+GOMEMLIMIT=off, is no limit. Combined with GOGC=off the collector runs only
+when the limit requires it. The runtime/debug package's SetMemoryLimit
+function allows changing the limit at run time.
+
 The GODEBUG variable controls debug output from the runtime. GODEBUG value is
 a comma-separated list of name=val pairs. Supported names are:
 
@@ -31,14 +39,35 @@ a comma-separated list of name=val pairs. Supported names are:
 	where each object is allocated on a unique page and addresses are
 	never recycled.
 
+	gcconcurrent: setting gcconcurrent=1 causes the garbage collector to mark
+	most of the heap while goroutines keep running, stopping the world only
+	briefly at the start and end of each collection. It relies on the kernel's
+	soft-dirty page tracking to find pointers written during marking, so it is
+	only supported on Linux; elsewhere collections stop the world as usual.
+	Setting gcconcurrent=1 also makes gctrace=1 print a second line for each
+	such collection.
+
 	gctrace: setting gctrace=1 causes the garbage collector to emit a single line to standard
 	error at each collection, summarizing the amount of memory collected and the
-	length of the pause. Setting gctrace=2 emits the same summary but also
+	length of the pause, including the time taken to stop the running goroutines.
+	When several threads mark the heap, a second line shows how many kilobytes
+	each of them scanned and how many work buffers each stole from the others.
+	Setting gctrace=2 emits the same summary but also
 	repeats each collection.
 
 	gcdead: setting gcdead=1 causes the garbage collector to clobber all stack slots
 	that it thinks are dead.
 
+	lockprof: setting lockprof=1 causes the runtime to count, for each of its
+	internal locks, how often a thread found the lock held and how long it waited
+	for it. runtime/debug.LockStats returns the counts. Only Linux, FreeBSD and
+	DragonFly BSD record them.
+
+	netpolluring: setting netpolluring=1 causes the network poller to use io_uring
+	instead of epoll on Linux, if the kernel supports it (Linux 5.13 or later).
+	Network reads, writes and accepts that would block are then done by the kernel
+	through io_uring as well.
+
 	scheddetail: setting schedtrace=X and scheddetail=1 causes the scheduler to emit
 	detailed multiline info every X milliseconds, describing state of the scheduler,
 	processors, threads and goroutines.
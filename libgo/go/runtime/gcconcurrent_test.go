@@ -0,0 +1,196 @@
+// Copyright 2014 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package runtime_test
+
+import (
+	"fmt"
+	"math/rand"
+	"os"
+	"os/exec"
+	"runtime"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+// TestGCConcurrent runs the test binary again with
+// GODEBUG=gcconcurrent=1, because runtime.GC always stops the world.
+// The child lets allocation start the collections while goroutines
+// keep changing a pointer graph, and checks that nothing it can reach
+// was freed.
+func TestGCConcurrent(t *testing.T) {
+	if os.Getenv("GO_TEST_GC_CONCURRENT") == "1" {
+		gcConcurrentChild()
+		return
+	}
+	cmd := testEnv(exec.Command(os.Args[0], "-test.run=^TestGCConcurrent$"))
+	cmd.Env = append(cmd.Env, "GODEBUG=gcconcurrent=1,gctrace=1", "GO_TEST_GC_CONCURRENT=1")
+	out, err := cmd.CombinedOutput()
+	output := string(out)
+	if strings.Contains(output, "SKIP\n") {
+		t.Skip("concurrent mark is not supported: the kernel does not track soft-dirty pages")
+	}
+	if err != nil {
+		t.Fatalf("%v\n%s", err, output)
+	}
+	if !strings.Contains(output, "OK\n") {
+		t.Fatalf("child did not report OK:\n%s", output)
+	}
+	if !strings.Contains(output, "concurrent mark") {
+		t.Fatalf("no concurrent mark in gctrace output:\n%s", output)
+	}
+}
+
+type gcNode struct {
+	left, right *gcNode
+	id          int
+	data        []byte
+}
+
+func newGCNode(id int) *gcNode {
+	n := &gcNode{id: id, data: make([]byte, 16+id%64)}
+	for i := range n.data {
+		n.data[i] = byte(id)
+	}
+	return n
+}
+
+func newGCTree(id *int, depth int) *gcNode {
+	*id++
+	n := newGCNode(*id)
+	if depth > 0 {
+		n.left = newGCTree(id, depth-1)
+		n.right = newGCTree(id, depth-1)
+	}
+	return n
+}
+
+// checkGCTree reports a node of the tree n whose memory was freed and
+// reused.
+func checkGCTree(n *gcNode) error {
+	for n != nil {
+		if len(n.data) != 16+n.id%64 {
+			return fmt.Errorf("node %d has %d bytes of data, want %d", n.id, len(n.data), 16+n.id%64)
+		}
+		for i, b := range n.data {
+			if b != byte(n.id) {
+				return fmt.Errorf("node %d data[%d] = %d, want %d", n.id, i, b, byte(n.id))
+			}
+		}
+		if err := checkGCTree(n.left); err != nil {
+			return err
+		}
+		n = n.right
+	}
+	return nil
+}
+
+// randomGCLink returns the address of a random link in the forest.
+// If leaf is set, the link is nil.
+func randomGCLink(r *rand.Rand, roots []*gcNode, leaf bool) **gcNode {
+	p := &roots[r.Intn(len(roots))]
+	for *p != nil && (leaf || r.Intn(4) != 0) {
+		if r.Intn(2) == 0 {
+			p = &(*p).left
+		} else {
+			p = &(*p).right
+		}
+	}
+	return p
+}
+
+var gcGarbage []byte
+
+func gcConcurrentChild() {
+	if !runtime.SysTrackWrites() {
+		fmt.Println("SKIP")
+		return
+	}
+
+	const (
+		G     = 4
+		Roots = 64
+		Depth = 8
+	)
+	var ms runtime.MemStats
+	runtime.ReadMemStats(&ms)
+	numgc := ms.NumGC
+
+	var stop uint32
+	var wg sync.WaitGroup
+	errc := make(chan error, G)
+	for g := 0; g < G; g++ {
+		wg.Add(1)
+		go func(g int) {
+			defer wg.Done()
+			r := rand.New(rand.NewSource(int64(g)))
+			id := g << 24
+			roots := make([]*gcNode, Roots)
+			for i := range roots {
+				roots[i] = newGCTree(&id, Depth)
+			}
+			for i := 0; atomic.LoadUint32(&stop) == 0; i++ {
+				// Move a subtree to another place in the
+				// forest, so that the only pointer to it may
+				// be stored in an object that was already
+				// scanned.
+				from := randomGCLink(r, roots, false)
+				sub := *from
+				*from = nil
+				*randomGCLink(r, roots, true) = sub
+				// Replace a subtree with new objects.
+				*randomGCLink(r, roots, false) = newGCTree(&id, r.Intn(4))
+				for j := range roots {
+					if roots[j] == nil {
+						roots[j] = newGCTree(&id, Depth)
+					}
+				}
+				// Garbage to start the collections.
+				gcGarbage = make([]byte, 1024)
+				if i%1000 == 0 {
+					for _, n := range roots {
+						if err := checkGCTree(n); err != nil {
+							errc <- err
+							return
+						}
+					}
+				}
+			}
+			for _, n := range roots {
+				if err := checkGCTree(n); err != nil {
+					errc <- err
+					return
+				}
+			}
+		}(g)
+	}
+	// Let allocation start a few collections.
+	deadline := time.Now().Add(10 * time.Second)
+	for time.Now().Before(deadline) {
+		time.Sleep(100 * time.Millisecond)
+		runtime.ReadMemStats(&ms)
+		if ms.NumGC >= numgc+5 {
+			break
+		}
+	}
+	atomic.StoreUint32(&stop, 1)
+	wg.Wait()
+	close(errc)
+	failed := false
+	for err := range errc {
+		fmt.Println(err)
+		failed = true
+	}
+	runtime.ReadMemStats(&ms)
+	if ms.NumGC == numgc {
+		fmt.Println("no collections ran")
+		failed = true
+	}
+	if !failed {
+		fmt.Println("OK")
+	}
+}
@@ -5,6 +5,7 @@
 package runtime_test
 
 import (
+	"runtime"
 	"testing"
 )
 
@@ -28,6 +29,11 @@ func (TM) Method2() {}
 func (TL) Method1() {}
 func (TL) Method2() {}
 
+// TC implements I1 but not I2.
+type TC int
+
+func (TC) Method1() {}
+
 var (
 	e  interface{}
 	e_ interface{}
@@ -36,6 +42,7 @@ var (
 	ts TS
 	tm TM
 	tl TL
+	tc TC
 )
 
 func BenchmarkConvT2ESmall(b *testing.B) {
@@ -109,6 +116,24 @@ func BenchmarkAssertE2I(b *testing.B) {
 	}
 }
 
+func BenchmarkAssertE2I2(b *testing.B) {
+	e = ts
+	var ok bool
+	for i := 0; i < b.N; i++ {
+		i2, ok = e.(I2)
+	}
+	_ = ok
+}
+
+func BenchmarkAssertE2I2Fail(b *testing.B) {
+	e = tc
+	var ok bool
+	for i := 0; i < b.N; i++ {
+		i2, ok = e.(I2)
+	}
+	_ = ok
+}
+
 func BenchmarkAssertI2T(b *testing.B) {
 	i1 = tm
 	for i := 0; i < b.N; i++ {
@@ -136,3 +161,93 @@ func BenchmarkAssertE2E(b *testing.B) {
 		e_ = e
 	}
 }
+
+func TestItabCache(t *testing.T) {
+	hits0, misses0 := runtime.ItabCacheStats()
+	const n = 100
+	var x interface{} = TC(0)
+	for i := 0; i < n; i++ {
+		if _, ok := x.(I1); !ok {
+			t.Fatal("TC does not implement I1")
+		}
+		if _, ok := x.(I2); ok {
+			t.Fatal("TC implements I2")
+		}
+	}
+	hits, misses := runtime.ItabCacheStats()
+	// Each conversion misses at most once, and the rest hit.
+	if hits-hits0 < 2*(n-1) {
+		t.Errorf("got %d cache hits, want at least %d", hits-hits0, 2*(n-1))
+	}
+	if misses-misses0 >= n {
+		t.Errorf("got %d cache misses for two conversions", misses-misses0)
+	}
+}
+
+func typeSwitch(x interface{}) string {
+	switch x.(type) {
+	case nil:
+		return "nil"
+	case int:
+		return "int"
+	case int8, int16:
+		return "small int"
+	case uint:
+		return "uint"
+	case string:
+		return "string"
+	case TS:
+		return "TS"
+	case *TS:
+		return "*TS"
+	case []byte:
+		return "[]byte"
+	case I2:
+		return "I2"
+	case TC:
+		return "TC"
+	case float64:
+		return "float64"
+	case TL:
+		return "TL"
+	case struct{ a int }:
+		return "struct"
+	case map[int]int:
+		return "map"
+	default:
+		return "default"
+	}
+}
+
+func TestTypeSwitch(t *testing.T) {
+	ts := TS(0)
+	tests := []struct {
+		x    interface{}
+		want string
+	}{
+		{nil, "nil"},
+		{1, "int"},
+		{int8(1), "small int"},
+		{int16(1), "small int"},
+		{uint(1), "uint"},
+		{"a", "string"},
+		{ts, "TS"},
+		{&ts, "*TS"},
+		{[]byte("a"), "[]byte"},
+		{TM(0), "I2"},
+		{TC(0), "TC"},
+		{1.0, "float64"},
+		{TL{}, "I2"},
+		{struct{ a int }{1}, "struct"},
+		{map[int]int{}, "map"},
+		{int32(1), "default"},
+		{uint8(1), "default"},
+		{[]int{}, "default"},
+		{struct{ b int }{1}, "default"},
+	}
+	for _, test := range tests {
+		if got := typeSwitch(test.x); got != test.want {
+			t.Errorf("typeSwitch(%T) = %q, want %q", test.x, got, test.want)
+		}
+	}
+}
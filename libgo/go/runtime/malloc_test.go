@@ -5,8 +5,15 @@
 package runtime_test
 
 import (
+	"bufio"
+	"bytes"
 	"flag"
+	"io/ioutil"
+	"os"
 	. "runtime"
+	"runtime/debug"
+	"strconv"
+	"strings"
 	"testing"
 	"time"
 	"unsafe"
@@ -24,6 +31,79 @@ func TestMemStats(t *testing.T) {
 		st.BuckHashSys+st.GCSys+st.OtherSys {
 		t.Fatalf("Bad sys value: %+v", *st)
 	}
+	if st.HeapHuge > st.HeapSys {
+		t.Fatalf("Bad huge page value: %+v", *st)
+	}
+}
+
+var hugeSink []byte
+
+func TestHeapHuge(t *testing.T) {
+	if GOOS != "linux" {
+		t.Skip("huge pages are only requested on linux")
+	}
+	enabled, err := ioutil.ReadFile("/sys/kernel/mm/transparent_hugepage/enabled")
+	if err != nil || bytes.Contains(enabled, []byte("[never]")) {
+		t.Skip("transparent huge pages are not available")
+	}
+
+	// Touch a large block, so that the kernel can back it with huge
+	// pages, and have FreeOSMemory sample the count.
+	hugeSink = make([]byte, 64<<20)
+	for i := 0; i < len(hugeSink); i += 4096 {
+		hugeSink[i] = 1
+	}
+	debug.FreeOSMemory()
+	st := new(MemStats)
+	ReadMemStats(st)
+
+	// Find the mapping that holds the block in /proc/self/smaps.
+	f, err := os.Open("/proc/self/smaps")
+	if err != nil {
+		t.Skip("no /proc/self/smaps")
+	}
+	defer f.Close()
+	addr := uint64(uintptr(unsafe.Pointer(&hugeSink[0])))
+	in, advised := false, false
+	var anonHuge uint64
+	s := bufio.NewScanner(f)
+	for s.Scan() {
+		line := s.Text()
+		fields := strings.Fields(line)
+		if len(fields) == 0 {
+			continue
+		}
+		if r := strings.SplitN(fields[0], "-", 2); len(r) == 2 && !strings.HasSuffix(fields[0], ":") {
+			start, err1 := strconv.ParseUint(r[0], 16, 64)
+			end, err2 := strconv.ParseUint(r[1], 16, 64)
+			in = err1 == nil && err2 == nil && start <= addr && addr < end
+			continue
+		}
+		if !in {
+			continue
+		}
+		switch fields[0] {
+		case "AnonHugePages:":
+			anonHuge, _ = strconv.ParseUint(fields[1], 10, 64)
+			anonHuge <<= 10
+		case "VmFlags:":
+			for _, fl := range fields[1:] {
+				if fl == "hg" {
+					advised = true
+				}
+			}
+		}
+	}
+	if !advised {
+		t.Errorf("heap mapping at %#x is not advised for huge pages", addr)
+	}
+	if anonHuge > 0 && st.HeapHuge == 0 {
+		t.Errorf("kernel backs %d bytes of the heap with huge pages, but HeapHuge is 0", anonHuge)
+	}
+	if st.HeapHuge > st.HeapSys {
+		t.Errorf("HeapHuge = %d, more than HeapSys = %d", st.HeapHuge, st.HeapSys)
+	}
+	hugeSink = nil
 }
 
 var mallocSink uintptr
@@ -13,6 +13,7 @@ import (
 	"strings"
 	"sync"
 	"testing"
+	"unsafe"
 )
 
 // negative zero is a good test because:
@@ -241,6 +242,185 @@ func TestIterGrowWithGC(t *testing.T) {
 	}
 }
 
+// Tests that an iterator started while the map is still growing
+// returns every remaining key exactly once, while the growth is
+// finished by insertions and deletions during the iteration.
+func TestIterStartedDuringGrowth(t *testing.T) {
+	for n := 1; n < 5000; n += 1 + n/32 {
+		m := make(map[int]int)
+		for i := 0; i < n; i++ {
+			m[i] = i
+		}
+		seen := make(map[int]bool)
+		next := n
+		for k, v := range m {
+			if k != v {
+				t.Fatalf("n=%d: m[%d] = %d", n, k, v)
+			}
+			if k >= n {
+				continue
+			}
+			if seen[k] {
+				t.Fatalf("n=%d: repeat of key %d", n, k)
+			}
+			seen[k] = true
+			for j := 0; j < 4; j++ {
+				m[next] = next
+				next++
+			}
+			if k+1 < n && !seen[k+1] {
+				delete(m, k+1)
+			}
+		}
+		for i := 0; i < n; i++ {
+			if _, ok := m[i]; ok && !seen[i] {
+				t.Errorf("n=%d: key %d missed", n, i)
+			}
+		}
+	}
+}
+
+// Tests that a map which is emptied gives up its large table.
+func TestMapShrink(t *testing.T) {
+	const n = 100000
+	m := make(map[int]int)
+	for i := 0; i < n; i++ {
+		m[i] = i
+	}
+	var before, after runtime.MemStats
+	runtime.ReadMemStats(&before)
+	for i := 0; i < n-10; i++ {
+		delete(m, i)
+	}
+	runtime.ReadMemStats(&after)
+	if after.MapTableDropped <= before.MapTableDropped {
+		t.Errorf("MapTableDropped did not increase: before %d, after %d", before.MapTableDropped, after.MapTableDropped)
+	}
+	if len(m) != 10 {
+		t.Fatalf("len(m) = %d, want 10", len(m))
+	}
+	for i := n - 10; i < n; i++ {
+		if v, ok := m[i]; !ok || v != i {
+			t.Errorf("m[%d] = %d, %v; want %d, true", i, v, ok, i)
+		}
+	}
+}
+
+// Tests that the live map table statistics follow a map as it is
+// filled and then drained.
+func TestMapTableInuse(t *testing.T) {
+	const n = 100000
+	entries := uint64(n * 2 * unsafe.Sizeof(int(0)))
+	var empty, full, drained runtime.MemStats
+	m := make(map[int]int, n)
+	runtime.GC()
+	runtime.ReadMemStats(&empty)
+	for i := 0; i < n; i++ {
+		m[i] = i
+	}
+	runtime.GC()
+	runtime.ReadMemStats(&full)
+	for i := 0; i < n-10; i++ {
+		delete(m, i)
+	}
+	runtime.GC()
+	runtime.ReadMemStats(&drained)
+	if len(m) != 10 {
+		t.Fatalf("len(m) = %d, want 10", len(m))
+	}
+
+	if empty.MapTableInuse < entries || empty.MapTableUnused < entries {
+		t.Errorf("empty map sized for %d entries: MapTableInuse %d, MapTableUnused %d, want both at least %d", n, empty.MapTableInuse, empty.MapTableUnused, entries)
+	}
+	if full.MapTableUnused+entries/2 > empty.MapTableUnused {
+		t.Errorf("filling the map did not use its slots: MapTableUnused %d before, %d after", empty.MapTableUnused, full.MapTableUnused)
+	}
+	if drained.MapTableInuse+entries/2 > full.MapTableInuse {
+		t.Errorf("draining the map did not shrink its table: MapTableInuse %d before, %d after", full.MapTableInuse, drained.MapTableInuse)
+	}
+}
+
+// Tests struct keys whose hash function combines runs of adjacent
+// fields, with padding and fields that are not hashed by identity
+// between the runs.
+func TestMapStructKeys(t *testing.T) {
+	type key struct {
+		a, b int32
+		s    string
+		c    int64
+		d    byte
+		e    int16
+		f    float64
+		g, h uint8
+	}
+	mk := func(i int) key {
+		return key{int32(i), int32(-i), fmt.Sprint("k", i), int64(i) << 33, byte(i), int16(i * 7), float64(i) / 2, uint8(i), uint8(i >> 8)}
+	}
+	m := make(map[key]int)
+	for i := 0; i < 1000; i++ {
+		m[mk(i)] = i
+	}
+	if len(m) != 1000 {
+		t.Fatalf("len(m) = %d, want 1000", len(m))
+	}
+	for i := 0; i < 1000; i++ {
+		if v, ok := m[mk(i)]; !ok || v != i {
+			t.Errorf("m[mk(%d)] = %d, %v; want %d, true", i, v, ok, i)
+		}
+	}
+}
+
+// Maps with integer, pointer and string keys use specialized map
+// functions, while reflect uses the generic ones.  Check that they
+// agree.
+func TestMapFastKeys(t *testing.T) {
+	const n = 1000
+	m32 := make(map[int32]int)
+	m64 := make(map[uint64]int)
+	ms := make(map[string]int)
+	mp := make(map[*int]int)
+	ptrs := make([]*int, n)
+	for i := 0; i < n; i++ {
+		ptrs[i] = new(int)
+		m32[int32(i)-n/2] = i
+		m64[uint64(i)<<32] = i
+		ms[fmt.Sprint(i)] = i
+		mp[ptrs[i]] = i
+	}
+	maps := []interface{}{m32, m64, ms, mp}
+	keys := func(i int) []interface{} {
+		return []interface{}{int32(i) - n/2, uint64(i) << 32, fmt.Sprint(i), ptrs[i]}
+	}
+	for i := 0; i < n; i++ {
+		for j, k := range keys(i) {
+			v := reflect.ValueOf(maps[j]).MapIndex(reflect.ValueOf(k))
+			if !v.IsValid() || v.Int() != int64(i) {
+				t.Fatalf("map %d: reflect lookup of %v = %v, want %d", j, k, v, i)
+			}
+		}
+	}
+	for i := 0; i < n; i += 2 {
+		for j, k := range keys(i) {
+			reflect.ValueOf(maps[j]).SetMapIndex(reflect.ValueOf(k), reflect.Value{})
+		}
+		delete(m32, int32(i+1)-n/2)
+		delete(m64, uint64(i+1)<<32)
+		delete(ms, fmt.Sprint(i+1))
+		delete(mp, ptrs[i+1])
+	}
+	if len(m32) != 0 || len(m64) != 0 || len(ms) != 0 || len(mp) != 0 {
+		t.Fatalf("maps not empty: %d %d %d %d", len(m32), len(m64), len(ms), len(mp))
+	}
+	for i := 0; i < n; i++ {
+		for j, k := range keys(i) {
+			reflect.ValueOf(maps[j]).SetMapIndex(reflect.ValueOf(k), reflect.ValueOf(i))
+		}
+		if v, ok := ms[fmt.Sprint(i)]; !ok || v != i || m32[int32(i)-n/2] != i || m64[uint64(i)<<32] != i || mp[ptrs[i]] != i {
+			t.Fatalf("lookup of %d after reflect insertion failed", i)
+		}
+	}
+}
+
 func testConcurrentReadsAfterGrowth(t *testing.T, useReflect bool) {
 	if runtime.GOMAXPROCS(-1) == 1 {
 		defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(16))
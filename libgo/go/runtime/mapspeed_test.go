@@ -298,3 +298,51 @@ func BenchmarkSmallKeyMap(b *testing.B) {
 		_ = m[5]
 	}
 }
+
+// Insertion, lookup and iteration throughput for maps which do and
+// do not fit in the cache.
+
+func benchmarkMapInsert(b *testing.B, n int) {
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		m := make(map[int]int)
+		for j := 0; j < n; j++ {
+			m[j] = j
+		}
+	}
+}
+
+func BenchmarkMapInsert100(b *testing.B)    { benchmarkMapInsert(b, 100) }
+func BenchmarkMapInsert100000(b *testing.B) { benchmarkMapInsert(b, 100000) }
+
+func benchmarkMapLookup(b *testing.B, n int, hit bool) {
+	m := make(map[int]int)
+	for j := 0; j < n; j++ {
+		m[j*2] = j
+	}
+	off := 0
+	if !hit {
+		off = 1
+	}
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		_ = m[(i*7919%n)*2+off]
+	}
+}
+
+func BenchmarkMapLookupHit100(b *testing.B)  { benchmarkMapLookup(b, 100, true) }
+func BenchmarkMapLookupHit1M(b *testing.B)   { benchmarkMapLookup(b, 1<<20, true) }
+func BenchmarkMapLookupMiss100(b *testing.B) { benchmarkMapLookup(b, 100, false) }
+func BenchmarkMapLookupMiss1M(b *testing.B)  { benchmarkMapLookup(b, 1<<20, false) }
+
+func BenchmarkMapIterLarge(b *testing.B) {
+	m := make(map[int]int)
+	for j := 0; j < 1<<16; j++ {
+		m[j] = j
+	}
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		for range m {
+		}
+	}
+}
@@ -26,6 +26,7 @@ type MemStats struct {
 	HeapInuse    uint64 // bytes in non-idle span
 	HeapReleased uint64 // bytes released to the OS
 	HeapObjects  uint64 // total number of allocated objects
+	HeapHuge     uint64 // bytes of HeapSys backed by transparent huge pages, sampled by the scavenger and FreeOSMemory
 
 	// Low-level fixed-size structure allocator statistics.
 	//	Inuse is bytes used now.
@@ -40,6 +41,17 @@ type MemStats struct {
 	GCSys       uint64 // GC metadata
 	OtherSys    uint64 // other system allocations
 
+	// Map table statistics.  MapTableAlloc and MapTableDropped are
+	// cumulative.  A table is counted as dropped only when its map
+	// grows or shrinks, not when the map itself becomes garbage, so
+	// their difference is not the memory in use by map tables.
+	// MapTableInuse and MapTableUnused are measured over the maps
+	// found live by the last collection.
+	MapTableAlloc   uint64 // bytes of map tables allocated (even if freed)
+	MapTableDropped uint64 // bytes of map tables dropped by maps growing or shrinking
+	MapTableInuse   uint64 // bytes of the tables of live maps
+	MapTableUnused  uint64 // bytes of their slots which hold no entry
+
 	// Garbage collector statistics.
 	NextGC       uint64 // next run in HeapAlloc time (bytes)
 	LastGC       uint64 // last run in absolute time (ns)
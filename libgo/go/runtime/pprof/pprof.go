@@ -467,11 +467,16 @@ func writeHeap(w io.Writer, debug int) error {
 		fmt.Fprintf(w, "# HeapInuse = %d\n", s.HeapInuse)
 		fmt.Fprintf(w, "# HeapReleased = %d\n", s.HeapReleased)
 		fmt.Fprintf(w, "# HeapObjects = %d\n", s.HeapObjects)
+		fmt.Fprintf(w, "# HeapHuge = %d\n", s.HeapHuge)
 
 		fmt.Fprintf(w, "# Stack = %d / %d\n", s.StackInuse, s.StackSys)
 		fmt.Fprintf(w, "# MSpan = %d / %d\n", s.MSpanInuse, s.MSpanSys)
 		fmt.Fprintf(w, "# MCache = %d / %d\n", s.MCacheInuse, s.MCacheSys)
 		fmt.Fprintf(w, "# BuckHashSys = %d\n", s.BuckHashSys)
+		fmt.Fprintf(w, "# MapTableAlloc = %d\n", s.MapTableAlloc)
+		fmt.Fprintf(w, "# MapTableDropped = %d\n", s.MapTableDropped)
+		fmt.Fprintf(w, "# MapTableInuse = %d\n", s.MapTableInuse)
+		fmt.Fprintf(w, "# MapTableUnused = %d\n", s.MapTableUnused)
 
 		fmt.Fprintf(w, "# NextGC = %d\n", s.NextGC)
 		fmt.Fprintf(w, "# PauseNs = %d\n", s.PauseNs)
@@ -137,6 +137,33 @@ func TestBlockLocked(t *testing.T) {
 	}
 }
 
+// Two goroutines which keep readying each other run one after the
+// other on the same P; they must not starve a third one.
+func TestPingPongFairness(t *testing.T) {
+	defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(1))
+	var quit int32
+	ping := make(chan bool)
+	pong := make(chan bool)
+	done := make(chan bool)
+	go func() {
+		for atomic.LoadInt32(&quit) == 0 {
+			ping <- true
+			<-pong
+		}
+		close(ping)
+	}()
+	go func() {
+		for range ping {
+			pong <- true
+		}
+		done <- true
+	}()
+	go func() {
+		atomic.StoreInt32(&quit, 1)
+	}()
+	<-done
+}
+
 func TestTimerFairness(t *testing.T) {
 	done := make(chan bool)
 	c := make(chan bool)
@@ -197,9 +224,12 @@ var preempt = func() int {
 	return sum
 }
 
+// The runtime tests are built with -fgo-optimize-preempt (see
+// runtime_check_GOCFLAGS in Makefile.am), so goroutines are preempted
+// on loop back-edges.
+
 func TestPreemption(t *testing.T) {
-	t.Skip("gccgo does not implement preemption")
-	// Test that goroutines are preempted at function calls.
+	// Test that goroutines spinning in loops are preempted.
 	N := 5
 	if testing.Short() {
 		N = 2
@@ -221,9 +251,15 @@ func TestPreemption(t *testing.T) {
 	<-c
 }
 
+var preemptSink int
+
 func TestPreemptionGC(t *testing.T) {
-	t.Skip("gccgo does not implement preemption")
-	// Test that pending GC preempts running goroutines.
+	// Test that pending GC preempts goroutines running tight loops,
+	// and that stopping them does not hold up the collection.  The
+	// inner loop runs fewer times than the preemption check interval,
+	// so the goroutines are only stopped if the back-edges of both
+	// loops count towards the check.
+	const maxGC = 1 * time.Second
 	P := 5
 	N := 10
 	if testing.Short() {
@@ -231,17 +267,29 @@ func TestPreemptionGC(t *testing.T) {
 		N = 2
 	}
 	defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(P + 1))
-	var stop uint32
+	var stop, started uint32
 	for i := 0; i < P; i++ {
 		go func() {
+			atomic.AddUint32(&started, 1)
+			n := 0
 			for atomic.LoadUint32(&stop) == 0 {
-				preempt()
+				for j := 0; j < 100; j++ {
+					n += j
+				}
 			}
+			preemptSink = n
 		}()
 	}
+	for atomic.LoadUint32(&started) < uint32(P) {
+		runtime.Gosched()
+	}
 	for i := 0; i < N; i++ {
 		runtime.Gosched()
+		t0 := time.Now()
 		runtime.GC()
+		if d := time.Since(t0); d > maxGC {
+			t.Errorf("GC %d took %v with %d goroutines in tight loops, want at most %v", i, d, P, maxGC)
+		}
 	}
 	atomic.StoreUint32(&stop, 1)
 }
@@ -414,6 +462,77 @@ func benchmarkCreateGoroutines(b *testing.B, procs int) {
 	}
 }
 
+// spawnBurst starts n goroutines at once, which overflow the local
+// run queue onto the global one, and waits for them to finish.
+func spawnBurst(n int) {
+	var left int32 = int32(n)
+	done := make(chan bool)
+	for i := 0; i < n; i++ {
+		go func() {
+			if atomic.AddInt32(&left, -1) == 0 {
+				done <- true
+			}
+		}()
+	}
+	<-done
+}
+
+func TestGlobalRunqueueBurst(t *testing.T) {
+	defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(4))
+	// More goroutines than the ring of the global queue holds.
+	N := 20000
+	if testing.Short() {
+		N = 5000
+	}
+	done := make(chan bool)
+	for i := 0; i < 4; i++ {
+		go func() {
+			spawnBurst(N)
+			done <- true
+		}()
+	}
+	for i := 0; i < 4; i++ {
+		<-done
+	}
+}
+
+func BenchmarkSpawnBurst(b *testing.B) {
+	procs := runtime.GOMAXPROCS(-1)
+	done := make(chan bool)
+	for p := 0; p < procs; p++ {
+		go func() {
+			for i := 0; i < b.N; i++ {
+				spawnBurst(1000)
+			}
+			done <- true
+		}()
+	}
+	for p := 0; p < procs; p++ {
+		<-done
+	}
+}
+
+// BenchmarkPingPong measures the cost of switching goroutines.  On a
+// single P each iteration is two switches: to the other goroutine
+// and back.
+func BenchmarkPingPong(b *testing.B) {
+	defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(1))
+	ping := make(chan bool)
+	pong := make(chan bool)
+	go func() {
+		for range ping {
+			pong <- true
+		}
+	}()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		ping <- true
+		<-pong
+	}
+	b.StopTimer()
+	close(ping)
+}
+
 type Matrix [][]float64
 
 func BenchmarkMatmult(b *testing.B) {
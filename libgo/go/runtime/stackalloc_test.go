@@ -0,0 +1,146 @@
+// Copyright 2014 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package runtime_test
+
+import (
+	"testing"
+)
+
+// The runtime tests are built with -fgo-optimize-allocs (see
+// runtime_check_GOCFLAGS in Makefile.am), so the allocations below
+// which do not escape are put on the stack.
+
+type stackAllocT struct {
+	a, b int
+	p    *int
+}
+
+var (
+	stackAllocSink  *stackAllocT
+	stackAllocSlice []int
+	stackAllocInt   int
+)
+
+func stackAllocFill(t *stackAllocT, v int) {
+	t.a = v
+	t.b = v * 2
+}
+
+func stackAllocSum(s []int) int {
+	n := 0
+	for i := 0; i < len(s); i++ {
+		n += s[i]
+	}
+	return n
+}
+
+// stackAllocForward passes its parameter on, so it escapes only if
+// the parameter of stackAllocFill does.
+func stackAllocForward(t *stackAllocT, v int) {
+	if t != nil {
+		stackAllocFill(t, v)
+	}
+}
+
+func stackAllocKeep(t *stackAllocT) {
+	stackAllocSink = t
+}
+
+func TestStackAllocNoEscape(t *testing.T) {
+	tests := []struct {
+		name string
+		f    func()
+	}{
+		{"new", func() {
+			p := new(stackAllocT)
+			p.a = 1
+			stackAllocInt += p.a
+		}},
+		{"composite", func() {
+			p := &stackAllocT{a: 1, b: 2}
+			stackAllocInt += p.a + p.b
+		}},
+		{"make", func() {
+			s := make([]int, 16)
+			s[3] = 3
+			stackAllocInt += s[3] + len(s) + cap(s)
+		}},
+		{"param", func() {
+			p := new(stackAllocT)
+			stackAllocFill(p, 3)
+			stackAllocInt += p.b
+		}},
+		{"slice param", func() {
+			s := make([]int, 8)
+			s[1] = 1
+			stackAllocInt += stackAllocSum(s)
+		}},
+		{"forwarded param", func() {
+			p := new(stackAllocT)
+			stackAllocForward(p, 4)
+			stackAllocInt += p.b
+		}},
+	}
+	for _, test := range tests {
+		if n := testing.AllocsPerRun(100, test.f); n != 0 {
+			t.Errorf("%s: got %v allocs per run, want 0", test.name, n)
+		}
+	}
+}
+
+func TestStackAllocEscape(t *testing.T) {
+	tests := []struct {
+		name string
+		f    func()
+	}{
+		{"stored", func() {
+			p := new(stackAllocT)
+			stackAllocSink = p
+		}},
+		{"address of field", func() {
+			p := new(stackAllocT)
+			p.p = &p.a
+		}},
+		{"stored by callee", func() {
+			p := &stackAllocT{a: 5}
+			stackAllocKeep(p)
+		}},
+		{"sliced", func() {
+			s := make([]int, 4)
+			stackAllocSlice = s[1:]
+		}},
+	}
+	for _, test := range tests {
+		if n := testing.AllocsPerRun(100, test.f); n == 0 {
+			t.Errorf("%s: allocation escapes but was put on the stack", test.name)
+		}
+	}
+	stackAllocSink = nil
+	stackAllocSlice = nil
+}
+
+// Values which escape must stay valid after the function which
+// allocated them returns and its frame is reused.
+func TestStackAllocEscapedValues(t *testing.T) {
+	func() {
+		p := &stackAllocT{a: 7, b: 8}
+		stackAllocKeep(p)
+	}()
+	func() {
+		s := make([]int, 4)
+		s[0] = 9
+		stackAllocSlice = s[:]
+	}()
+	stackAllocFill(new(stackAllocT), 0)
+	stackAllocInt += stackAllocSum(make([]int, 32))
+	if p := stackAllocSink; p == nil || p.a != 7 || p.b != 8 {
+		t.Errorf("escaped struct is %+v, want {a:7 b:8}", p)
+	}
+	if s := stackAllocSlice; len(s) != 4 || s[0] != 9 {
+		t.Errorf("escaped slice is %v, want [9 0 0 0]", s)
+	}
+	stackAllocSink = nil
+	stackAllocSlice = nil
+}
@@ -0,0 +1,72 @@
+// Copyright 2014 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package runtime_test
+
+import (
+	"runtime"
+	"testing"
+	"time"
+)
+
+// The runtime tests are built with -fgo-optimize-stackmaps (see
+// runtime_check_GOCFLAGS in Makefile.am), so the collector scans
+// the stackMapFrame variables below precisely, through the stack
+// maps of their functions.
+
+type stackMapFrame struct {
+	p   *int
+	pad [14]uintptr
+	q   *[]byte
+}
+
+func TestStackMapKeepsPointersAlive(t *testing.T) {
+	var f stackMapFrame
+	collected := make(chan string, 2)
+	f.p = new(int)
+	runtime.SetFinalizer(f.p, func(*int) { collected <- "p" })
+	b := make([]byte, 16)
+	f.q = &b
+	runtime.SetFinalizer(f.q, func(*[]byte) { collected <- "q" })
+	for i := 0; i < 5; i++ {
+		runtime.GC()
+	}
+	select {
+	case field := <-collected:
+		t.Errorf("field %s of a stack-mapped variable was collected while live", field)
+	case <-time.After(100 * time.Millisecond):
+	}
+	*f.p = len(*f.q)
+}
+
+func stackMapPanic(n int) int {
+	var f stackMapFrame
+	f.p = new(int)
+	if n == 0 {
+		panic("unwind")
+	}
+	*f.p = stackMapPanic(n - 1)
+	return *f.p + n
+}
+
+func TestStackMapPanic(t *testing.T) {
+	// A panic unwinds the frames below, and each must take its
+	// stack map off the goroutine's list as it goes.  A map left
+	// behind would point into dead stack at the next collection, and
+	// the next pop would find the list corrupt and throw.
+	var f stackMapFrame
+	f.p = new(int)
+	for i := 0; i < 3; i++ {
+		func() {
+			defer func() {
+				if recover() == nil {
+					t.Error("stackMapPanic did not panic")
+				}
+			}()
+			stackMapPanic(10)
+		}()
+		runtime.GC()
+	}
+	*f.p = 1
+}
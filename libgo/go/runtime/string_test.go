@@ -75,3 +75,94 @@ func BenchmarkCompareStringBig(b *testing.B) {
 	}
 	b.SetBytes(int64(len(s1)))
 }
+
+type stringKind string
+
+const keyword stringKind = "func"
+
+func stringSwitch(s string) string {
+	r := ""
+	switch s {
+	case "":
+		return "empty"
+	case "break", "case", "chan", "const":
+		return "b-c"
+	case "continue":
+		r = "continue "
+		fallthrough
+	case "default", "defer":
+		return r + "d"
+	default:
+		return "other"
+	case "else", string(keyword), "go", "goto", "if", "import":
+		return "e-i"
+	case "interface", "map", "package", "range", "return", "select":
+		return "i-s"
+	case "\xff\xff\xff\xff", "\x00\x00\x00\x00", "\x80abc":
+		return "bytes"
+	case "struct", "switch", "type", "var":
+		return "s-v"
+	}
+}
+
+func TestStringSwitch(t *testing.T) {
+	tests := []struct {
+		s    string
+		want string
+	}{
+		{"", "empty"},
+		{"break", "b-c"},
+		{"case", "b-c"},
+		{"chan", "b-c"},
+		{"const", "b-c"},
+		{"continue", "continue d"},
+		{"default", "d"},
+		{"defer", "d"},
+		{"else", "e-i"},
+		{"func", "e-i"},
+		{"go", "e-i"},
+		{"goto", "e-i"},
+		{"if", "e-i"},
+		{"import", "e-i"},
+		{"interface", "i-s"},
+		{"map", "i-s"},
+		{"package", "i-s"},
+		{"range", "i-s"},
+		{"return", "i-s"},
+		{"select", "i-s"},
+		{"\xff\xff\xff\xff", "bytes"},
+		{"\x00\x00\x00\x00", "bytes"},
+		{"\x80abc", "bytes"},
+		{"struct", "s-v"},
+		{"switch", "s-v"},
+		{"type", "s-v"},
+		{"var", "s-v"},
+		{"a", "other"},
+		{"gox", "other"},
+		{"cas", "other"},
+		{"casf", "other"},
+		{"\x7fabc", "other"},
+		{"returns", "other"},
+		{"interfac", "other"},
+	}
+	for _, test := range tests {
+		if got := stringSwitch(test.s); got != test.want {
+			t.Errorf("stringSwitch(%q) = %q, want %q", test.s, got, test.want)
+		}
+	}
+	var k stringKind = "func"
+	switch k {
+	case "break", "case", "chan", "const":
+		t.Errorf("switch on %q matched the wrong case", k)
+	case keyword:
+	default:
+		t.Errorf("switch on %q matched no case", k)
+	}
+}
+
+func BenchmarkStringSwitch(b *testing.B) {
+	words := []string{"break", "continue", "func", "import", "return", "var", "x"}
+	for i := 0; i < b.N; i++ {
+		stringSwitch(words[i%len(words)])
+	}
+}
@@ -21,7 +21,11 @@ func runtime_Semrelease(s *uint32)
 
 // Approximation of syncSema in runtime/sema.go.
 type syncSema struct {
-	lock uintptr
+	lock struct {
+		key   uintptr
+		owner unsafe.Pointer
+		spins uint32
+	}
 	head unsafe.Pointer
 	tail unsafe.Pointer
 }
@@ -70,3 +70,54 @@ func BenchmarkSemaWorkNonblock(b *testing.B) {
 func BenchmarkSemaWorkBlock(b *testing.B) {
 	benchmarkSema(b, true, true)
 }
+
+// semaBlockMany blocks n goroutines on each of the semaphores in sems
+// and releases them again, newest semaphore first.
+func semaBlockMany(sems []uint32, n int) {
+	var wg WaitGroup
+	wg.Add(len(sems) * n)
+	for i := range sems {
+		for j := 0; j < n; j++ {
+			go func(s *uint32) {
+				Runtime_Semacquire(s)
+				wg.Done()
+			}(&sems[i])
+		}
+	}
+	runtime.Gosched()
+	for j := 0; j < n; j++ {
+		for i := len(sems) - 1; i >= 0; i-- {
+			Runtime_Semrelease(&sems[i])
+		}
+	}
+	wg.Wait()
+}
+
+func TestSemaManyAddrs(t *testing.T) {
+	sems := make([]uint32, 1000)
+	semaBlockMany(sems, 3)
+	for i, s := range sems {
+		if s != 0 {
+			t.Fatalf("sems[%d] = %d, want 0", i, s)
+		}
+	}
+}
+
+func benchmarkSemaMany(b *testing.B, nsem int) {
+	sems := make([]uint32, nsem)
+	for i := 0; i < b.N; i++ {
+		semaBlockMany(sems, 4)
+	}
+}
+
+func BenchmarkSemaMany100(b *testing.B) {
+	benchmarkSemaMany(b, 100)
+}
+
+func BenchmarkSemaMany1000(b *testing.B) {
+	benchmarkSemaMany(b, 1000)
+}
+
+func BenchmarkSemaMany10000(b *testing.B) {
+	benchmarkSemaMany(b, 10000)
+}
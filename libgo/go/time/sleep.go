@@ -14,6 +14,7 @@ func runtimeNano() int64
 // Interface to timers implemented in package runtime.
 // Must be in sync with ../runtime/runtime.h:/^struct.Timer$
 type runtimeTimer struct {
+	tb     uintptr
 	i      int
 	when   int64
 	period int64
@@ -22,3 +22,15 @@ getproccount(void)
 	else
 		return 0;
 }
+
+void
+getproctopology(CPUTopology *t)
+{
+	t->ndomain = 0;
+}
+
+int32
+getproccpu(void)
+{
+	return -1;
+}
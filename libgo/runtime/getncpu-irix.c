@@ -14,3 +14,15 @@ getproccount(void)
 	n = (int32)sysconf(_SC_NPROC_ONLN);
 	return n > 1 ? n : 1;
 }
+
+void
+getproctopology(CPUTopology *t)
+{
+	t->ndomain = 0;
+}
+
+int32
+getproccpu(void)
+{
+	return -1;
+}
@@ -3,6 +3,7 @@
 // license that can be found in the LICENSE file.
 
 #include <features.h>
+#include <errno.h>
 #include <sched.h>
 
 // CPU_COUNT is only provided by glibc 2.6 or higher
@@ -20,17 +21,383 @@ static int _CPU_COUNT(unsigned int *set, size_t len) {
 
 #include "runtime.h"
 #include "defs.h"
+#include "arch.h"
+#include "malloc.h"
 
+static int32 cgroupcpus(void);
+
+// The number of CPUs we can use: those in the affinity mask, but no
+// more than the cgroup CPU quota allows.
 int32
 getproccount(void)
 {
 	cpu_set_t set;
-	int32 r, cnt;
+	int32 r, cnt, q;
 
 	cnt = 0;
 	r = sched_getaffinity(0, sizeof(set), &set);
 	if(r == 0)
 		cnt += CPU_COUNT(&set);
 
+	q = cgroupcpus();
+	if(q > 0 && (cnt == 0 || q < cnt))
+		cnt = q;
+
 	return cnt ? cnt : 1;
 }
+
+// The contents of the last file read by readfile.  The buffer grows
+// to hold the largest file, such as a long /proc/self/mountinfo.
+static char *filebuf;
+static uintptr filebufsize;
+
+// Read all of the file name into filebuf and NUL terminate it.
+// Returns the length, or -1 if the file can not be read.
+static int32
+readfile(const char *name)
+{
+	int fd;
+	char *p;
+	uintptr n, size;
+	int32 r;
+
+	fd = open(name, O_RDONLY);
+	if(fd < 0)
+		return -1;
+	n = 0;
+	for(;;) {
+		if(n+1 >= filebufsize) {
+			size = filebufsize != 0 ? 2*filebufsize : 4096;
+			p = runtime_SysAlloc(size, &mstats.other_sys);
+			if(p == nil) {
+				close(fd);
+				return -1;
+			}
+			if(filebuf != nil) {
+				runtime_memmove(p, filebuf, n);
+				runtime_SysFree(filebuf, filebufsize, &mstats.other_sys);
+			}
+			filebuf = p;
+			filebufsize = size;
+		}
+		r = read(fd, filebuf+n, filebufsize-1-n);
+		if(r < 0 && errno == EINTR)
+			continue;
+		if(r < 0) {
+			close(fd);
+			return -1;
+		}
+		if(r == 0)
+			break;
+		n += r;
+	}
+	close(fd);
+	filebuf[n] = '\0';
+	return n;
+}
+
+// Reports whether the list s, separated by sep, contains tok.
+static bool
+hastoken(const char *s, const char *tok, char sep)
+{
+	int32 n;
+
+	n = strlen(tok);
+	for(;;) {
+		if(strncmp(s, tok, n) == 0 && (s[n] == sep || s[n] == '\0'))
+			return true;
+		s = strchr(s, sep);
+		if(s == nil)
+			return false;
+		s++;
+	}
+}
+
+// Find the directory of our cgroup in the cgroup2 hierarchy, or if
+// v2 is false in the cgroup hierarchy with the cpu controller.
+// Sets *mntlen to the length of the mount point at its start.
+// Returns false if there is none.
+static bool
+cgroupdir(bool v2, char *dir, int32 size, int32 *mntlen)
+{
+	char path[512];
+	char *line, *next, *c1, *c2, *f[32];
+	const char *root, *rel;
+	int32 nf, dash, i, n;
+
+	// Our path in the hierarchy, from /proc/self/cgroup, which has
+	// lines of "0::path" for cgroup2 and "id:controllers:path" for
+	// cgroup.
+	if(readfile("/proc/self/cgroup") < 0)
+		return false;
+	path[0] = '\0';
+	for(line = filebuf; *line != '\0'; line = next) {
+		next = strchr(line, '\n');
+		if(next != nil)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		c1 = strchr(line, ':');
+		if(c1 == nil)
+			continue;
+		c2 = strchr(c1+1, ':');
+		if(c2 == nil)
+			continue;
+		*c2 = '\0';
+		if(v2) {
+			if(strcmp(line, "0:") != 0)
+				continue;
+		} else if(!hastoken(c1+1, "cpu", ','))
+			continue;
+		snprintf(path, sizeof path, "%s", c2+1);
+		break;
+	}
+	if(path[0] != '/')
+		return false;
+
+	// Where the hierarchy is mounted, from /proc/self/mountinfo,
+	// which has lines of "id parent dev root mountpoint options...
+	// - fstype source superoptions".
+	if(readfile("/proc/self/mountinfo") < 0)
+		return false;
+	for(line = filebuf; *line != '\0'; line = next) {
+		next = strchr(line, '\n');
+		if(next != nil)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		nf = 0;
+		dash = -1;
+		for(c1 = line; c1 != nil && nf < (int32)nelem(f); ) {
+			f[nf] = c1;
+			c1 = strchr(c1, ' ');
+			if(c1 != nil)
+				*c1++ = '\0';
+			if(strcmp(f[nf], "-") == 0 && dash < 0)
+				dash = nf;
+			nf++;
+		}
+		if(dash < 5 || nf < dash+4)
+			continue;
+		if(strcmp(f[dash+1], v2 ? "cgroup2" : "cgroup") != 0)
+			continue;
+		if(!v2 && !hastoken(f[dash+3], "cpu", ','))
+			continue;
+
+		// The path is relative to the root of the mount.
+		root = f[3];
+		rel = path;
+		if(strcmp(root, "/") != 0) {
+			n = strlen(root);
+			if(strncmp(path, root, n) != 0 || (path[n] != '/' && path[n] != '\0'))
+				continue;
+			rel = path + n;
+		}
+		if(strcmp(rel, "/") == 0)
+			rel = "";
+		*mntlen = strlen(f[4]);
+		i = snprintf(dir, size, "%s%s", f[4], rel);
+		return i > 0 && i < size;
+	}
+	return false;
+}
+
+// Parse a decimal number at *s, or return -1 if there is none.
+static int64
+readnum(const char **s)
+{
+	const char *p;
+	int64 v;
+
+	p = *s;
+	if(*p < '0' || *p > '9')
+		return -1;
+	v = 0;
+	while(*p >= '0' && *p <= '9')
+		v = v*10 + *p++ - '0';
+	while(*p == ' ' || *p == '\n')
+		p++;
+	*s = p;
+	return v;
+}
+
+// The CPU controller lets a cgroup use quota microseconds of CPU
+// time in each period, which is quota/period CPUs.  Limits set on
+// the parents of our cgroup apply as well.  Return the smallest
+// limit on the directory dir and its parents, rounded up, or 0 if
+// there is none.
+static int32
+cgroupquota(bool v2, char *dir, int32 mntlen)
+{
+	char name[1024];
+	const char *p;
+	char *slash;
+	int64 quota, period, n, best;
+
+	best = 0;
+	for(;;) {
+		quota = -1;
+		period = -1;
+		if(v2) {
+			// cpu.max is "max period" or "quota period".
+			snprintf(name, sizeof name, "%s/cpu.max", dir);
+			if(readfile(name) > 0) {
+				p = filebuf;
+				quota = readnum(&p);
+				period = readnum(&p);
+			}
+		} else {
+			// cpu.cfs_quota_us is -1 if there is no limit.
+			snprintf(name, sizeof name, "%s/cpu.cfs_quota_us", dir);
+			if(readfile(name) > 0) {
+				p = filebuf;
+				quota = readnum(&p);
+			}
+			snprintf(name, sizeof name, "%s/cpu.cfs_period_us", dir);
+			if(quota > 0 && readfile(name) > 0) {
+				p = filebuf;
+				period = readnum(&p);
+			}
+		}
+		if(quota > 0 && period > 0) {
+			n = (quota + period - 1) / period;
+			if(best == 0 || n < best)
+				best = n;
+		}
+
+		slash = strrchr(dir, '/');
+		if(slash == nil || slash - dir < mntlen)
+			break;
+		*slash = '\0';
+	}
+	return best > 0x7fffffff ? 0x7fffffff : best;
+}
+
+// Return the number of CPUs the cgroup CPU quota lets us use, or 0 if
+// there is no quota.  Both the cgroup2 and the older cgroup
+// hierarchies may be mounted; take the lower limit.
+static int32
+cgroupcpus(void)
+{
+	char dir[512];
+	int32 mntlen, n, best, i;
+	bool v2;
+
+	best = 0;
+	for(i = 0; i < 2; i++) {
+		v2 = i == 0;
+		if(!cgroupdir(v2, dir, sizeof dir, &mntlen))
+			continue;
+		n = cgroupquota(v2, dir, mntlen);
+		if(n > 0 && (best == 0 || n < best))
+			best = n;
+	}
+	return best;
+}
+
+static int16 cpudomain[CPU_SETSIZE];
+static int16 cpunode[CPU_SETSIZE];
+static int16 domainnode[CPU_SETSIZE];
+
+// Read a list of CPUs such as "0-3,8-11" from the file name.
+// Returns false if the file can not be read.
+static bool
+readcpulist(const char *name, cpu_set_t *set)
+{
+	const char *buf;
+	int32 i, lo, hi, c;
+
+	if(readfile(name) <= 0)
+		return false;
+	buf = filebuf;
+
+	CPU_ZERO(set);
+	i = 0;
+	while(buf[i] >= '0' && buf[i] <= '9') {
+		lo = 0;
+		while(buf[i] >= '0' && buf[i] <= '9')
+			lo = lo*10 + buf[i++] - '0';
+		hi = lo;
+		if(buf[i] == '-') {
+			i++;
+			hi = 0;
+			while(buf[i] >= '0' && buf[i] <= '9')
+				hi = hi*10 + buf[i++] - '0';
+		}
+		for(c = lo; c <= hi && c < CPU_SETSIZE; c++)
+			CPU_SET(c, set);
+		if(buf[i] == ',')
+			i++;
+	}
+	return true;
+}
+
+// Find the topology of the CPUs we may run on from /sys.
+// A domain is the CPUs sharing a level 3 cache, or a NUMA node
+// if the kernel does not say which CPUs share the cache.
+void
+getproctopology(CPUTopology *t)
+{
+	cpu_set_t allowed, set;
+	char name[128];
+	int32 cpu, c, n, d, left;
+
+	t->ndomain = 0;
+	if(sched_getaffinity(0, sizeof allowed, &allowed) != 0)
+		return;
+
+	left = 0;
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		cpudomain[cpu] = -1;
+		cpunode[cpu] = 0;
+		if(CPU_ISSET(cpu, &allowed)) {
+			t->ncpuid = cpu+1;
+			left++;
+		}
+	}
+
+	// Node numbers may have gaps, so look until every CPU has a
+	// node.  Without node0 there is no NUMA information at all.
+	for(n = 0; n < CPU_SETSIZE && left > 0; n++) {
+		snprintf(name, sizeof name, "/sys/devices/system/node/node%d/cpulist", n);
+		if(!readcpulist(name, &set)) {
+			if(n == 0)
+				break;
+			continue;
+		}
+		for(c = 0; c < t->ncpuid; c++) {
+			if(CPU_ISSET(c, &set) && CPU_ISSET(c, &allowed)) {
+				cpunode[c] = n;
+				left--;
+			}
+		}
+	}
+
+	for(cpu = 0; cpu < t->ncpuid; cpu++) {
+		if(!CPU_ISSET(cpu, &allowed) || cpudomain[cpu] >= 0)
+			continue;
+		snprintf(name, sizeof name, "/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", cpu);
+		if(!readcpulist(name, &set)) {
+			CPU_ZERO(&set);
+			for(c = cpu; c < t->ncpuid; c++)
+				if(cpunode[c] == cpunode[cpu])
+					CPU_SET(c, &set);
+		}
+		d = t->ndomain++;
+		domainnode[d] = cpunode[cpu];
+		cpudomain[cpu] = d;
+		for(c = cpu; c < t->ncpuid; c++)
+			if(CPU_ISSET(c, &set) && CPU_ISSET(c, &allowed) && cpudomain[c] < 0)
+				cpudomain[c] = d;
+	}
+
+	t->domain = cpudomain;
+	t->node = domainnode;
+}
+
+// Return the CPU the current thread is running on, or -1.
+int32
+getproccpu(void)
+{
+	return sched_getcpu();
+}
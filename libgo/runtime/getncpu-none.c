@@ -10,3 +10,15 @@ getproccount(void)
 {
 	return 0;
 }
+
+void
+getproctopology(CPUTopology *t)
+{
+	t->ndomain = 0;
+}
+
+int32
+getproccpu(void)
+{
+	return -1;
+}
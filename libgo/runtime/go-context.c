@@ -0,0 +1,103 @@
+/* go-context.c -- switch between goroutines.
+
+   Copyright 2014 The Go Authors. All rights reserved.
+   Use of this source code is governed by a BSD-style
+   license that can be found in the LICENSE file.  */
+
+#include "runtime.h"
+
+#ifdef USING_GO_CONTEXT
+
+#if defined (__x86_64__)
+
+/* __go_getcontext stores the callee-saved registers, the floating
+   point control words, and the stack pointer and return address of
+   its caller.  __go_setcontext loads them and jumps to the return
+   address, so that the __go_getcontext call returns again.
+
+   A new context starts in __go_context_start, which calls the
+   function held in %rbx.  Its unwind information marks the return
+   address as undefined, which is where backtraces of a goroutine
+   stop.  */
+
+__asm__ (
+  "\t.text\n"
+  "\t.p2align 4\n"
+  "\t.globl __go_getcontext\n"
+  "\t.type __go_getcontext, @function\n"
+  "__go_getcontext:\n"
+  "\t.cfi_startproc\n"
+  "\tmovq (%rsp), %rax\n"
+  "\tleaq 8(%rsp), %rdx\n"
+  "\tmovq %rbx, 0(%rdi)\n"
+  "\tmovq %rbp, 8(%rdi)\n"
+  "\tmovq %r12, 16(%rdi)\n"
+  "\tmovq %r13, 24(%rdi)\n"
+  "\tmovq %r14, 32(%rdi)\n"
+  "\tmovq %r15, 40(%rdi)\n"
+  "\tmovq %rdx, 48(%rdi)\n"
+  "\tmovq %rax, 56(%rdi)\n"
+  "\tstmxcsr 64(%rdi)\n"
+  "\tfnstcw 68(%rdi)\n"
+  "\txorl %eax, %eax\n"
+  "\tret\n"
+  "\t.cfi_endproc\n"
+  "\t.size __go_getcontext, .-__go_getcontext\n"
+  "\n"
+  "\t.p2align 4\n"
+  "\t.globl __go_setcontext\n"
+  "\t.type __go_setcontext, @function\n"
+  "__go_setcontext:\n"
+  "\t.cfi_startproc\n"
+  "\tmovq 0(%rdi), %rbx\n"
+  "\tmovq 8(%rdi), %rbp\n"
+  "\tmovq 16(%rdi), %r12\n"
+  "\tmovq 24(%rdi), %r13\n"
+  "\tmovq 32(%rdi), %r14\n"
+  "\tmovq 40(%rdi), %r15\n"
+  "\tldmxcsr 64(%rdi)\n"
+  "\tfldcw 68(%rdi)\n"
+  "\tmovq 48(%rdi), %rsp\n"
+  "\txorl %eax, %eax\n"
+  "\tjmpq *56(%rdi)\n"
+  "\t.cfi_endproc\n"
+  "\t.size __go_setcontext, .-__go_setcontext\n"
+  "\n"
+  "\t.p2align 4\n"
+  "\t.type __go_context_start, @function\n"
+  "__go_context_start:\n"
+  "\t.cfi_startproc\n"
+  "\t.cfi_undefined rip\n"
+  "\tcallq *%rbx\n"
+  "\thlt\n"
+  "\t.cfi_endproc\n"
+  "\t.size __go_context_start, .-__go_context_start\n"
+  );
+
+extern void __go_context_start (void);
+
+void
+__go_makecontext (__go_context_t *c, void (*fn) (void), void *stack,
+		  size_t size)
+{
+  uintptr_t sp;
+
+  /* The stack pointer must be aligned to 16 bytes when
+     __go_context_start calls FN.  */
+  sp = ((uintptr_t) stack + size) & ~(uintptr_t) 15;
+
+  __builtin_memset (c, 0, sizeof *c);
+  c->rbx = (uint64_t) (uintptr_t) fn;
+  c->rsp = sp;
+  c->rip = (uint64_t) (uintptr_t) __go_context_start;
+  c->mxcsr = __builtin_ia32_stmxcsr ();
+  __asm__ ("fnstcw %0" : "=m" (c->fpucw));
+}
+
+#else
+
+#error unknown case for USING_GO_CONTEXT
+
+#endif
+
+#endif /* defined(USING_GO_CONTEXT) */
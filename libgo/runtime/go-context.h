@@ -0,0 +1,95 @@
+/* go-context.h -- switch between goroutines.
+
+   Copyright 2014 The Go Authors. All rights reserved.
+   Use of this source code is governed by a BSD-style
+   license that can be found in the LICENSE file.  */
+
+#ifndef LIBGO_GO_CONTEXT_H
+#define LIBGO_GO_CONTEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ucontext.h>
+
+/* The scheduler switches goroutines with these functions, which work
+   like getcontext, setcontext and makecontext.  The ucontext
+   functions save and restore the signal mask and the whole register
+   file, which costs a system call on every switch.  A goroutine
+   switch is always an ordinary function call, so where we can we
+   only save the registers which the calling convention says a
+   function must preserve, plus the stack and instruction pointers.
+
+   The signal mask is not switched.  The runtime never changes it
+   while goroutines are running, so every goroutine would restore the
+   same mask anyway.
+
+   Indirect branch tracking and shadow stacks do not allow returning
+   to a saved stack with a jump, so we use the ucontext functions when
+   either is enabled.  */
+
+#if defined (__x86_64__) && !defined (__ILP32__) && defined (__ELF__) \
+  && !defined (__CET__)
+#define USING_GO_CONTEXT 1
+#endif
+
+#ifdef USING_GO_CONTEXT
+
+/* The fields are used by the assembler code in go-context.c, so the
+   offsets must not change.  */
+
+struct __go_context
+{
+  uint64_t rbx;		/* 0 */
+  uint64_t rbp;		/* 8 */
+  uint64_t r12;		/* 16 */
+  uint64_t r13;		/* 24 */
+  uint64_t r14;		/* 32 */
+  uint64_t r15;		/* 40 */
+  uint64_t rsp;		/* 48 */
+  uint64_t rip;		/* 56 */
+  uint32_t mxcsr;	/* 64 */
+  uint16_t fpucw;	/* 68 */
+};
+
+typedef struct __go_context __go_context_t;
+
+/* Save the current context in C.  This returns 0, and returns 0 again
+   when C is resumed by __go_setcontext.  */
+
+extern int __go_getcontext (__go_context_t *c)
+  __attribute__ ((returns_twice));
+
+/* Resume the context C.  */
+
+extern void __go_setcontext (__go_context_t *c)
+  __attribute__ ((noreturn));
+
+/* Initialize C so that resuming it calls FN on the stack of SIZE
+   bytes starting at STACK.  FN must not return.  */
+
+extern void __go_makecontext (__go_context_t *c, void (*fn) (void),
+			      void *stack, size_t size);
+
+#else /* !defined(USING_GO_CONTEXT) */
+
+typedef ucontext_t __go_context_t;
+
+#define __go_getcontext(c) getcontext (c)
+#define __go_setcontext(c) setcontext (c)
+
+static inline void
+__go_makecontext (__go_context_t *c, void (*fn) (void), void *stack,
+		  size_t size)
+{
+  getcontext (c);
+  c->uc_stack.ss_sp = stack;
+#ifdef MAKECONTEXT_STACK_TOP
+  c->uc_stack.ss_sp = (char *) stack + size;
+#endif
+  c->uc_stack.ss_size = size;
+  makecontext (c, fn, 0);
+}
+
+#endif /* !defined(USING_GO_CONTEXT) */
+
+#endif /* !defined(LIBGO_GO_CONTEXT_H) */
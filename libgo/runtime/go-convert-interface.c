@@ -5,6 +5,8 @@
    license that can be found in the LICENSE file.  */
 
 #include "runtime.h"
+#include "arch.h"
+#include "malloc.h"
 #include "go-alloc.h"
 #include "go-assert.h"
 #include "go-panic.h"
@@ -12,19 +14,17 @@
 #include "go-type.h"
 #include "interface.h"
 
-/* This is called when converting one interface type into another
-   interface type.  LHS_DESCRIPTOR is the type descriptor of the
-   resulting interface.  RHS_DESCRIPTOR is the type descriptor of the
-   object being converted.  This builds and returns a new interface
-   method table.  If any method in the LHS_DESCRIPTOR interface is not
-   implemented by the object, the conversion fails.  If the conversion
-   fails, then if MAY_FAIL is true this returns NULL; otherwise, it
-   panics.  */
+/* Build the interface method table for converting an object whose
+   type descriptor is RHS_DESCRIPTOR to the interface LHS_DESCRIPTOR.
+   If any method in the LHS_DESCRIPTOR interface is not implemented
+   by the object, the conversion fails.  If the conversion fails,
+   then if MAY_FAIL is true this returns NULL; otherwise, it panics.
+   The table is allocated on the heap; see below.  */
 
-void *
-__go_convert_interface_2 (const struct __go_type_descriptor *lhs_descriptor,
-			  const struct __go_type_descriptor *rhs_descriptor,
-			  _Bool may_fail)
+static const void **
+build_methods (const struct __go_type_descriptor *lhs_descriptor,
+	       const struct __go_type_descriptor *rhs_descriptor,
+	       _Bool may_fail)
 {
   const struct __go_interface_type *lhs_interface;
   int lhs_method_count;
@@ -35,12 +35,6 @@ __go_convert_interface_2 (const struct __go_type_descriptor *lhs_descriptor,
   const struct __go_method *p_rhs_method;
   int i;
 
-  if (rhs_descriptor == NULL)
-    {
-      /* A nil value always converts to nil.  */
-      return NULL;
-    }
-
   __go_assert ((lhs_descriptor->__code & GO_CODE_MASK) == GO_INTERFACE);
   lhs_interface = (const struct __go_interface_type *) lhs_descriptor;
   lhs_method_count = lhs_interface->__methods.__count;
@@ -121,6 +115,243 @@ __go_convert_interface_2 (const struct __go_type_descriptor *lhs_descriptor,
   return methods;
 }
 
+/* Method tables are cached, so that converting the same type to the
+   same interface again neither walks the methods nor allocates.  The
+   cache is a hash table keyed by the pair of type descriptors, which
+   is shared by all threads.  Lookups do not lock: an entry is fully
+   built before it is stored in a slot, and a full table is replaced
+   by a copy twice the size rather than being rehashed in place.
+   Insertions are serialized by itab_lock.  A failed conversion is
+   cached as an entry whose method table is NULL.
+
+   The entries, the method tables and the hash tables are never
+   freed, as the number of distinct conversions a program makes is
+   bounded by its types.  They are allocated outside the garbage
+   collected heap, which is safe because they only point to type
+   descriptors and functions.  */
+
+struct itab_entry
+{
+  const struct __go_type_descriptor *lhs;
+  const struct __go_type_descriptor *rhs;
+  const void **methods;
+};
+
+struct itab_table
+{
+  /* The number of slots, which is a power of 2.  */
+  uintptr size;
+  /* The number of slots in use.  */
+  uintptr count;
+  /* The slots, each NULL or pointing to an entry.  */
+  struct itab_entry *entries[];
+};
+
+#define ITAB_INITIAL_SIZE 64
+
+static struct itab_table *itab_table;
+static Lock itab_lock;
+
+/* The number of conversions which were not found in the cache.
+   Hits are counted per M to avoid contention.  */
+static uint64 itab_misses;
+
+/* Return the first slot to probe for a conversion from RHS to LHS in
+   a table of SIZE slots.  */
+
+static inline uintptr
+itab_hash (const struct __go_type_descriptor *lhs,
+	   const struct __go_type_descriptor *rhs, uintptr size)
+{
+  uint64 h;
+
+  h = (uint64) (uintptr) lhs ^ ((uint64) (uintptr) rhs << 17);
+  h *= 0x9e3779b97f4a7c15ULL;
+  return (uintptr) (h >> 32) & (size - 1);
+}
+
+/* Find the cache entry for converting RHS to LHS in TABLE, or return
+   NULL if there is none.  */
+
+static inline struct itab_entry *
+itab_find (struct itab_table *table, const struct __go_type_descriptor *lhs,
+	   const struct __go_type_descriptor *rhs)
+{
+  uintptr mask;
+  uintptr i;
+
+  mask = table->size - 1;
+  for (i = itab_hash (lhs, rhs, table->size); ; i = (i + 1) & mask)
+    {
+      struct itab_entry *e;
+
+      e = runtime_atomicloadp (&table->entries[i]);
+      if (e == NULL)
+	return NULL;
+      if (e->lhs == lhs && e->rhs == rhs)
+	return e;
+    }
+}
+
+/* Store E in TABLE, which must have room for it.  */
+
+static void
+itab_store (struct itab_table *table, struct itab_entry *e)
+{
+  uintptr mask;
+  uintptr i;
+
+  mask = table->size - 1;
+  i = itab_hash (e->lhs, e->rhs, table->size);
+  while (table->entries[i] != NULL)
+    i = (i + 1) & mask;
+  runtime_atomicstorep (&table->entries[i], e);
+  table->count++;
+}
+
+static struct itab_table *
+itab_alloc_table (uintptr size)
+{
+  struct itab_table *table;
+
+  table = runtime_persistentalloc (sizeof (struct itab_table)
+				   + size * sizeof (struct itab_entry *),
+				   0, &mstats.other_sys);
+  table->size = size;
+  return table;
+}
+
+/* Add the method table METHODS, which may be NULL, for converting RHS
+   to LHS to the cache, and return the cached copy.  */
+
+static const void **
+itab_add (const struct __go_type_descriptor *lhs,
+	  const struct __go_type_descriptor *rhs, const void **methods)
+{
+  struct itab_table *table;
+  struct itab_entry *e;
+
+  runtime_lock (&itab_lock);
+
+  table = itab_table;
+  if (table != NULL)
+    {
+      /* Another thread may have added it first.  */
+      e = itab_find (table, lhs, rhs);
+      if (e != NULL)
+	{
+	  runtime_unlock (&itab_lock);
+	  return e->methods;
+	}
+    }
+
+  e = runtime_persistentalloc (sizeof *e, 0, &mstats.other_sys);
+  e->lhs = lhs;
+  e->rhs = rhs;
+  if (methods != NULL)
+    {
+      uintptr size;
+
+      size = ((uintptr) ((const struct __go_interface_type *) lhs)
+	      ->__methods.__count + 1) * sizeof (void *);
+      e->methods = runtime_persistentalloc (size, 0, &mstats.other_sys);
+      __builtin_memcpy (e->methods, methods, size);
+    }
+
+  /* Keep the table at most 3/4 full.  */
+  if (table == NULL || (table->count + 1) * 4 > table->size * 3)
+    {
+      struct itab_table *new_table;
+      uintptr i;
+
+      new_table = itab_alloc_table (table == NULL
+				    ? ITAB_INITIAL_SIZE
+				    : table->size * 2);
+      if (table != NULL)
+	{
+	  for (i = 0; i < table->size; i++)
+	    if (table->entries[i] != NULL)
+	      itab_store (new_table, table->entries[i]);
+	}
+      itab_store (new_table, e);
+      runtime_atomicstorep (&itab_table, new_table);
+    }
+  else
+    itab_store (table, e);
+
+  runtime_unlock (&itab_lock);
+
+  return e->methods;
+}
+
+/* This is called when converting one interface type into another
+   interface type.  LHS_DESCRIPTOR is the type descriptor of the
+   resulting interface.  RHS_DESCRIPTOR is the type descriptor of the
+   object being converted.  This returns the interface method table,
+   which must not be modified.  If any method in the LHS_DESCRIPTOR
+   interface is not implemented by the object, the conversion fails.
+   If the conversion fails, then if MAY_FAIL is true this returns
+   NULL; otherwise, it panics.  */
+
+void *
+__go_convert_interface_2 (const struct __go_type_descriptor *lhs_descriptor,
+			  const struct __go_type_descriptor *rhs_descriptor,
+			  _Bool may_fail)
+{
+  struct itab_table *table;
+  const void **methods;
+  const void **ret;
+
+  if (rhs_descriptor == NULL)
+    {
+      /* A nil value always converts to nil.  */
+      return NULL;
+    }
+
+  table = runtime_atomicloadp (&itab_table);
+  if (__builtin_expect (table != NULL, 1))
+    {
+      struct itab_entry *e;
+
+      e = itab_find (table, lhs_descriptor, rhs_descriptor);
+      if (e != NULL && (e->methods != NULL || may_fail))
+	{
+	  M *mp;
+
+	  mp = runtime_m ();
+	  if (mp != NULL)
+	    mp->itabhits++;
+	  return e->methods;
+	}
+    }
+
+  /* This panics if the conversion fails and MAY_FAIL is false, so
+     only successful conversions and those which may fail are
+     cached.  */
+  methods = build_methods (lhs_descriptor, rhs_descriptor, may_fail);
+  runtime_xadd64 (&itab_misses, 1);
+  ret = itab_add (lhs_descriptor, rhs_descriptor, methods);
+  if (methods != NULL)
+    __go_free (methods);
+  return ret;
+}
+
+/* Return the number of conversions which found their method table in
+   the cache and the number which did not, for testing.  */
+
+void
+__go_itab_cache_stats (uint64 *hits, uint64 *misses)
+{
+  M *mp;
+  uint64 h;
+
+  h = 0;
+  for (mp = runtime_atomicloadp (&runtime_allm); mp != NULL; mp = mp->alllink)
+    h += mp->itabhits;
+  *hits = h;
+  *misses = runtime_atomicload64 (&itab_misses);
+}
+
 /* This is called by the compiler to convert a value from one
    interface type to another.  */
 
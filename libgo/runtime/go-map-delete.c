@@ -8,54 +8,170 @@
 #include <stdlib.h>
 
 #include "runtime.h"
-#include "malloc.h"
-#include "go-alloc.h"
 #include "go-assert.h"
 #include "map.h"
 
-/* Delete the entry matching KEY from MAP.  */
+/* Delete the entry matching KEY, of kind KIND, whose hash code is
+   HASH, from TABLE of MAP, ignoring the groups before FIRST_GROUP.
+   Return whether an entry was found.  */
 
-void
-__go_map_delete (struct __go_map *map, const void *key)
+static inline __attribute__ ((always_inline)) _Bool
+__go_map_delete_table (struct __go_map *map, struct __go_map_table *table,
+		       uintptr_t first_group, const void *key, uintptr_t hash,
+		       enum __go_map_key_kind kind)
 {
   const struct __go_map_descriptor *descriptor;
   const struct __go_type_descriptor *key_descriptor;
   uintptr_t key_offset;
-  _Bool (*equalfn) (const void*, const void*, uintptr_t);
-  size_t key_hash;
-  size_t key_size;
-  size_t bucket_index;
-  void **pentry;
-
-  if (map == NULL)
-    return;
+  uintptr_t entry_size;
+  unsigned char tag;
+  uintptr_t mask;
+  uintptr_t index;
+  uintptr_t stride;
 
   descriptor = map->__descriptor;
-
   key_descriptor = descriptor->__map_descriptor->__key_type;
   key_offset = descriptor->__key_offset;
-  key_size = key_descriptor->__size;
-  if (key_size == 0)
+  entry_size = descriptor->__entry_size;
+
+  tag = __go_map_tag (hash);
+  mask = table->__group_count - 1;
+  index = __go_map_probe_start (hash, table->__group_count);
+  stride = 0;
+  while (1)
+    {
+      unsigned char *group;
+      uint64_t ctrl;
+      uint64_t match;
+
+      group = __go_map_ctrl_bytes (table, index);
+      ctrl = __go_map_ctrl (group);
+      match = __go_map_match_tag (ctrl, tag);
+      if (index < first_group)
+	match = 0;
+      while (match != 0)
+	{
+	  uintptr_t i;
+	  char *entry;
+
+	  i = __go_map_match_first (match);
+	  entry = __go_map_slot (table, entry_size,
+				 index * GO_MAP_GROUP_SIZE + i);
+	  if (*(uintptr_t *) entry == hash
+	      && __go_map_key_equal (kind, key_descriptor, key,
+				     entry + key_offset))
+	    {
+	      /* If this group has an empty slot, no lookup has ever
+		 probed past it, so the slot can become empty again.
+		 Otherwise it must be marked deleted so that lookups
+		 keep probing.  A slot emptied in the old table of a
+		 growing map does not give the new table any room.  */
+	      if (__go_map_match_empty (ctrl) != 0)
+		{
+		  group[i] = GO_MAP_EMPTY;
+		  if (table == map->__table)
+		    map->__growth_left += 1;
+		}
+	      else
+		group[i] = GO_MAP_DELETED;
+
+	      /* Clear the entry so that the garbage collector does
+		 not retain the key and value.  */
+	      __builtin_memset (entry, 0, entry_size);
+
+	      map->__element_count -= 1;
+	      return 1;
+	    }
+	  match &= match - 1;
+	}
+      if (__go_map_match_empty (ctrl) != 0)
+	return 0;
+      ++stride;
+      index = (index + stride) & mask;
+    }
+}
+
+/* If most of the table of MAP is now unused, start shrinking it.  */
+
+static void
+__go_map_maybe_shrink (struct __go_map *map)
+{
+  uintptr_t group_count;
+  uintptr_t new_group_count;
+
+  group_count = map->__table->__group_count;
+  if (map->__old_table != NULL
+      || group_count < GO_MAP_SHRINK_FACTOR
+      || (map->__element_count
+	  >= __go_map_max_fill (group_count) / GO_MAP_SHRINK_LOAD))
     return;
 
-  __go_assert (key_size != -1UL);
-  equalfn = key_descriptor->__equalfn;
+  new_group_count = __go_map_group_count (map->__element_count * 2);
+  if (new_group_count < group_count / GO_MAP_SHRINK_FACTOR)
+    new_group_count = group_count / GO_MAP_SHRINK_FACTOR;
+  __go_map_resize (map, new_group_count);
+}
 
-  key_hash = key_descriptor->__hashfn (key, key_size);
-  bucket_index = key_hash % map->__bucket_count;
+/* Delete the entry matching KEY, of kind KIND, from MAP.  */
 
-  pentry = map->__buckets + bucket_index;
-  while (*pentry != NULL)
+static inline __attribute__ ((always_inline)) void
+__go_map_delete_kind (struct __go_map *map, const void *key,
+		      enum __go_map_key_kind kind)
+{
+  const struct __go_type_descriptor *key_descriptor;
+  uintptr_t hash;
+
+  if (map == NULL || map->__table == NULL)
+    return;
+
+  key_descriptor = map->__descriptor->__map_descriptor->__key_type;
+  if (kind == GO_MAP_KEY_GENERIC)
     {
-      char *entry = (char *) *pentry;
-      if (equalfn (key, entry + key_offset, key_size))
-	{
-	  *pentry = *(void **) entry;
-	  if (descriptor->__entry_size >= TinySize)
-	    __go_free (entry);
-	  map->__element_count -= 1;
-	  break;
-	}
-      pentry = (void **) entry;
+      if (key_descriptor->__size == 0)
+	return;
+      __go_assert (key_descriptor->__size != -1UL);
     }
+
+  hash = __go_map_key_hash (kind, key_descriptor, key);
+
+  if (map->__old_table != NULL)
+    {
+      __go_map_evacuate (map, __go_map_evacuate_count (map));
+      if (map->__old_table != NULL
+	  && __go_map_delete_table (map, map->__old_table, map->__evacuated,
+				    key, hash, kind))
+	return;
+    }
+
+  if (__go_map_delete_table (map, map->__table, 0, key, hash, kind))
+    __go_map_maybe_shrink (map);
+}
+
+/* Delete the entry matching KEY from MAP.  */
+
+void
+__go_map_delete (struct __go_map *map, const void *key)
+{
+  __go_map_delete_kind (map, key, GO_MAP_KEY_GENERIC);
+}
+
+/* Versions of __go_map_delete for the kinds of keys described in
+   map.h.  */
+
+void
+__go_map_delete_fast32 (struct __go_map *map, const void *key)
+{
+  __go_map_delete_kind (map, key, GO_MAP_KEY_32);
+}
+
+void
+__go_map_delete_fast64 (struct __go_map *map, const void *key)
+{
+  __go_map_delete_kind (map, key, GO_MAP_KEY_64);
+}
+
+void
+__go_map_delete_faststr (struct __go_map *map, const void *key)
+{
+  __go_map_delete_kind (map, key, GO_MAP_KEY_STRING);
 }
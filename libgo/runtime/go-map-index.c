@@ -12,78 +12,297 @@
 #include "go-assert.h"
 #include "map.h"
 
-/* Rehash MAP to a larger size.  */
+/* Find a free slot for an entry with hash code HASH in TABLE.  Set
+   *PCTRL to point to the control byte of the slot, and return a
+   pointer to the slot.  */
 
-static void
-__go_map_rehash (struct __go_map *map)
+static char *
+__go_map_find_slot (const struct __go_map_descriptor *descriptor,
+		    struct __go_map_table *table, uintptr_t hash,
+		    unsigned char **pctrl)
+{
+  uintptr_t mask;
+  uintptr_t index;
+  uintptr_t stride;
+
+  mask = table->__group_count - 1;
+  index = __go_map_probe_start (hash, table->__group_count);
+  stride = 0;
+  while (1)
+    {
+      unsigned char *ctrl;
+      uint64_t match;
+
+      ctrl = __go_map_ctrl_bytes (table, index);
+      match = __go_map_match_free (__go_map_ctrl (ctrl));
+      if (match != 0)
+	{
+	  uintptr_t i;
+
+	  i = __go_map_match_first (match);
+	  *pctrl = ctrl + i;
+	  return __go_map_slot (table, descriptor->__entry_size,
+				index * GO_MAP_GROUP_SIZE + i);
+	}
+      ++stride;
+      index = (index + stride) & mask;
+    }
+}
+
+/* Evacuate up to COUNT groups of the old table of MAP, which must be
+   growing, by copying their entries to the new table.  The hash
+   codes are cached in the entries, so this does not call the hash
+   function.  The evacuated slots are left as they are for the sake
+   of any iterators.  When the last group has been evacuated the map
+   stops growing.  */
+
+void
+__go_map_evacuate (struct __go_map *map, uintptr_t count)
 {
   const struct __go_map_descriptor *descriptor;
-  const struct __go_type_descriptor *key_descriptor;
-  uintptr_t key_offset;
-  size_t key_size;
-  uintptr_t (*hashfn) (const void *, uintptr_t);
-  uintptr_t old_bucket_count;
-  void **old_buckets;
-  uintptr_t new_bucket_count;
-  void **new_buckets;
+  uintptr_t entry_size;
+  struct __go_map_table *old_table;
+  struct __go_map_table *new_table;
   uintptr_t i;
+  uintptr_t end;
 
   descriptor = map->__descriptor;
+  entry_size = descriptor->__entry_size;
+  old_table = map->__old_table;
+  new_table = map->__table;
 
-  key_descriptor = descriptor->__map_descriptor->__key_type;
-  key_offset = descriptor->__key_offset;
-  key_size = key_descriptor->__size;
-  hashfn = key_descriptor->__hashfn;
-
-  old_bucket_count = map->__bucket_count;
-  old_buckets = map->__buckets;
+  i = map->__evacuated;
+  end = old_table->__group_count;
+  if (count < end - i)
+    end = i + count;
 
-  new_bucket_count = __go_map_next_prime (old_bucket_count * 2);
-  new_buckets = (void **) __go_alloc (new_bucket_count * sizeof (void *));
-  __builtin_memset (new_buckets, 0, new_bucket_count * sizeof (void *));
+  /* If the map is empty there is nothing left to copy.  */
+  if (map->__element_count == 0)
+    i = end = old_table->__group_count;
 
-  for (i = 0; i < old_bucket_count; ++i)
+  for (; i < end; ++i)
     {
-      char* entry;
-      char* next;
+      unsigned char *old_ctrl;
+      uint64_t match;
 
-      for (entry = old_buckets[i]; entry != NULL; entry = next)
+      old_ctrl = __go_map_ctrl_bytes (old_table, i);
+      match = __go_map_match_full (__go_map_ctrl (old_ctrl));
+      while (match != 0)
 	{
-	  size_t key_hash;
-	  size_t new_bucket_index;
+	  uintptr_t j;
+	  char *entry;
+	  uintptr_t hash;
+	  unsigned char *ctrl;
+	  char *new_entry;
 
-	  /* We could speed up rehashing at the cost of memory space
-	     by caching the hash code.  */
-	  key_hash = hashfn (entry + key_offset, key_size);
-	  new_bucket_index = key_hash % new_bucket_count;
+	  j = __go_map_match_first (match);
+	  match &= match - 1;
 
-	  next = *(char **) entry;
-	  *(char **) entry = new_buckets[new_bucket_index];
-	  new_buckets[new_bucket_index] = entry;
+	  entry = __go_map_slot (old_table, entry_size,
+				 i * GO_MAP_GROUP_SIZE + j);
+	  hash = *(uintptr_t *) entry;
+	  new_entry = __go_map_find_slot (descriptor, new_table, hash, &ctrl);
+	  *ctrl = old_ctrl[j];
+	  __builtin_memcpy (new_entry, entry, entry_size);
 	}
     }
 
-  __go_free (old_buckets);
+  if (end < old_table->__group_count)
+    map->__evacuated = end;
+  else
+    {
+      map->__old_table = NULL;
+      map->__evacuated = 0;
+      __go_map_free_table (map, old_table);
+    }
+}
+
+/* Start moving the entries of MAP to a new table with GROUP_COUNT
+   groups.  If MAP is still growing from an earlier table, that has
+   to be finished first.  */
+
+void
+__go_map_resize (struct __go_map *map, uintptr_t group_count)
+{
+  struct __go_map_table *old_table;
+
+  if (map->__old_table != NULL)
+    __go_map_evacuate (map, map->__old_table->__group_count);
 
-  map->__bucket_count = new_bucket_count;
-  map->__buckets = new_buckets;
+  old_table = map->__table;
+  map->__table = __go_map_alloc_table (map->__descriptor, group_count);
+  map->__growth_left = (__go_map_max_fill (group_count)
+			- map->__element_count);
+
+  if (old_table == NULL)
+    ;
+  else if (map->__element_count > 0)
+    {
+      map->__old_table = old_table;
+      map->__evacuated = 0;
+    }
+  else
+    __go_map_free_table (map, old_table);
 }
 
-/* Find KEY in MAP, return a pointer to the value.  If KEY is not
-   present, then if INSERT is false, return NULL, and if INSERT is
-   true, insert a new value and zero-initialize it before returning a
-   pointer to it.  */
+/* Start growing MAP into a new table large enough to hold twice its
+   current number of elements.  */
 
-void *
-__go_map_index (struct __go_map *map, const void *key, _Bool insert)
+static void
+__go_map_grow (struct __go_map *map)
+{
+  uintptr_t old_group_count;
+  uintptr_t new_group_count;
+
+  old_group_count = map->__table != NULL ? map->__table->__group_count : 0;
+
+  /* If the table is full mostly because of deleted entries, this
+     grows it into a new table of the same size.  */
+  new_group_count = __go_map_group_count (map->__element_count * 2);
+  if (new_group_count < old_group_count)
+    new_group_count = old_group_count;
+
+  __go_map_resize (map, new_group_count);
+}
+
+/* Find KEY, whose hash code is HASH, in TABLE of a map with
+   DESCRIPTOR, ignoring the groups before FIRST_GROUP.  KIND is the
+   kind of key, which is a constant wherever this is inlined.  Return
+   a pointer to the entry, or NULL if it is not present.  */
+
+static inline __attribute__ ((always_inline)) char *
+__go_map_lookup_table (const struct __go_map_descriptor *descriptor,
+		       struct __go_map_table *table,
+		       uintptr_t first_group, const void *key, uintptr_t hash,
+		       enum __go_map_key_kind kind)
 {
-  const struct __go_map_descriptor *descriptor;
   const struct __go_type_descriptor *key_descriptor;
   uintptr_t key_offset;
-  _Bool (*equalfn) (const void*, const void*, uintptr_t);
-  size_t key_hash;
-  size_t key_size;
-  size_t bucket_index;
+  uintptr_t entry_size;
+  unsigned char tag;
+  uintptr_t mask;
+  uintptr_t index;
+  uintptr_t stride;
+
+  key_descriptor = descriptor->__map_descriptor->__key_type;
+  key_offset = descriptor->__key_offset;
+  entry_size = descriptor->__entry_size;
+
+  tag = __go_map_tag (hash);
+  mask = table->__group_count - 1;
+  index = __go_map_probe_start (hash, table->__group_count);
+  stride = 0;
+  while (1)
+    {
+      uint64_t ctrl;
+      uint64_t match;
+
+      ctrl = __go_map_ctrl (__go_map_ctrl_bytes (table, index));
+      match = __go_map_match_tag (ctrl, tag);
+      if (index < first_group)
+	match = 0;
+      while (match != 0)
+	{
+	  char *entry;
+
+	  entry = __go_map_slot (table, entry_size,
+				 (index * GO_MAP_GROUP_SIZE
+				  + __go_map_match_first (match)));
+	  if (*(uintptr_t *) entry == hash
+	      && __go_map_key_equal (kind, key_descriptor, key,
+				     entry + key_offset))
+	    return entry;
+	  match &= match - 1;
+	}
+      if (__go_map_match_empty (ctrl) != 0)
+	return NULL;
+      ++stride;
+      index = (index + stride) & mask;
+    }
+}
+
+/* Find KEY, of kind KIND, whose hash code is HASH, in MAP.  Return a
+   pointer to the entry, or NULL if it is not present.  This is
+   inlined into the __go_map_index functions, which are the hot
+   path.  */
+
+static inline __attribute__ ((always_inline)) char *
+__go_map_lookup (const struct __go_map *map, const void *key, uintptr_t hash,
+		 enum __go_map_key_kind kind)
+{
+  struct __go_map_table *old_table;
+  char *entry;
+
+  if (map->__table == NULL)
+    return NULL;
+
+  old_table = map->__old_table;
+  if (__builtin_expect (old_table != NULL, 0))
+    {
+      entry = __go_map_lookup_table (map->__descriptor, old_table,
+				     map->__evacuated, key, hash, kind);
+      if (entry != NULL)
+	return entry;
+    }
+
+  return __go_map_lookup_table (map->__descriptor, map->__table, 0, key,
+				hash, kind);
+}
+
+/* Find KEY, whose hash code is HASH, in MAP, for the other map
+   functions.  */
+
+char *
+__go_map_find (const struct __go_map *map, const void *key, uintptr_t hash)
+{
+  return __go_map_lookup (map, key, hash, GO_MAP_KEY_GENERIC);
+}
+
+/* Insert KEY, whose hash code is HASH, into MAP, which does not hold
+   it.  Return a pointer to the zeroed value.  This is kept out of
+   line so that the lookups stay small.  */
+
+static void *
+__go_map_insert (struct __go_map *map, const void *key, uintptr_t hash)
+{
+  const struct __go_map_descriptor *descriptor;
+  char *entry;
+  unsigned char *ctrl;
+
+  descriptor = map->__descriptor;
+
+  /* Only an entry which takes an empty slot uses up growth.
+     Checking before looking for a slot is simpler, and only grows
+     early when the slot found would have been a deleted one.  */
+  if (map->__growth_left == 0)
+    __go_map_grow (map);
+
+  entry = __go_map_find_slot (descriptor, map->__table, hash, &ctrl);
+  if (*ctrl == GO_MAP_EMPTY)
+    --map->__growth_left;
+  *ctrl = __go_map_tag (hash);
+
+  /* The slot is zeroed, so the value is already zero.  */
+  *(uintptr_t *) entry = hash;
+  __builtin_memcpy (entry + descriptor->__key_offset, key,
+		    descriptor->__map_descriptor->__key_type->__size);
+
+  map->__element_count += 1;
+
+  return entry + descriptor->__val_offset;
+}
+
+/* Find KEY, of kind KIND, in MAP, and return a pointer to the value.
+   If KEY is not present, then if INSERT is false, return NULL, and if
+   INSERT is true, insert a new value and zero-initialize it before
+   returning a pointer to it.  */
+
+static inline __attribute__ ((always_inline)) void *
+__go_map_index_kind (struct __go_map *map, const void *key, _Bool insert,
+		     enum __go_map_key_kind kind)
+{
+  const struct __go_type_descriptor *key_descriptor;
+  uintptr_t hash;
   char *entry;
 
   if (map == NULL)
@@ -93,43 +312,53 @@ __go_map_index (struct __go_map *map, const void *key, _Bool insert)
       return NULL;
     }
 
-  descriptor = map->__descriptor;
+  key_descriptor = map->__descriptor->__map_descriptor->__key_type;
+  if (kind == GO_MAP_KEY_GENERIC)
+    __go_assert (key_descriptor->__size != -1UL);
 
-  key_descriptor = descriptor->__map_descriptor->__key_type;
-  key_offset = descriptor->__key_offset;
-  key_size = key_descriptor->__size;
-  __go_assert (key_size != -1UL);
-  equalfn = key_descriptor->__equalfn;
+  hash = __go_map_key_hash (kind, key_descriptor, key);
 
-  key_hash = key_descriptor->__hashfn (key, key_size);
-  bucket_index = key_hash % map->__bucket_count;
+  if (insert && map->__old_table != NULL)
+    __go_map_evacuate (map, __go_map_evacuate_count (map));
 
-  entry = (char *) map->__buckets[bucket_index];
-  while (entry != NULL)
-    {
-      if (equalfn (key, entry + key_offset, key_size))
-	return entry + descriptor->__val_offset;
-      entry = *(char **) entry;
-    }
+  entry = __go_map_lookup (map, key, hash, kind);
+  if (entry != NULL)
+    return entry + map->__descriptor->__val_offset;
 
   if (!insert)
     return NULL;
 
-  if (map->__element_count >= map->__bucket_count)
-    {
-      __go_map_rehash (map);
-      bucket_index = key_hash % map->__bucket_count;
-    }
+  return __go_map_insert (map, key, hash);
+}
+
+/* Find KEY in MAP, return a pointer to the value.  If KEY is not
+   present, then if INSERT is false, return NULL, and if INSERT is
+   true, insert a new value and zero-initialize it before returning a
+   pointer to it.  */
 
-  entry = (char *) __go_alloc (descriptor->__entry_size);
-  __builtin_memset (entry, 0, descriptor->__entry_size);
+void *
+__go_map_index (struct __go_map *map, const void *key, _Bool insert)
+{
+  return __go_map_index_kind (map, key, insert, GO_MAP_KEY_GENERIC);
+}
 
-  __builtin_memcpy (entry + key_offset, key, key_size);
+/* Versions of __go_map_index for the kinds of keys described in
+   map.h.  The compiler calls these when the key type permits.  */
 
-  *(char **) entry = map->__buckets[bucket_index];
-  map->__buckets[bucket_index] = entry;
+void *
+__go_map_index_fast32 (struct __go_map *map, const void *key, _Bool insert)
+{
+  return __go_map_index_kind (map, key, insert, GO_MAP_KEY_32);
+}
 
-  map->__element_count += 1;
+void *
+__go_map_index_fast64 (struct __go_map *map, const void *key, _Bool insert)
+{
+  return __go_map_index_kind (map, key, insert, GO_MAP_KEY_64);
+}
 
-  return entry + descriptor->__val_offset;
+void *
+__go_map_index_faststr (struct __go_map *map, const void *key, _Bool insert)
+{
+  return __go_map_index_kind (map, key, insert, GO_MAP_KEY_STRING);
 }
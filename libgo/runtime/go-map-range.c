@@ -11,51 +11,194 @@
 /* Initialize a range over a map.  */
 
 void
-__go_mapiterinit (const struct __go_map *h, struct __go_hash_iter *it)
+__go_mapiterinit (struct __go_map *h, struct __go_hash_iter *it)
 {
   it->entry = NULL;
-  if (h != NULL)
+  if (h != NULL && h->__table != NULL)
     {
+      /* Tell the map not to free these tables when it grows.  This
+	 may be called by several readers at once, so avoid the atomic
+	 operation when possible.  */
+      if ((h->__flags & GO_MAP_ITERATOR) == 0)
+	__sync_fetch_and_or (&h->__flags, GO_MAP_ITERATOR);
+
       it->map = h;
-      it->next_entry = NULL;
-      it->bucket = 0;
-      --it->bucket;
+      it->old_table = h->__old_table;
+      it->table = h->__table;
+      it->index = 0;
+      --it->index;
       __go_mapiternext(it);
     }
 }
 
+/* Report whether TABLE, the old table of a map with DESCRIPTOR when
+   an iteration started, holds an entry for the key of ENTRY in any
+   group, evacuated or not.  Such a key was seen while iterating over
+   TABLE.  An evacuated entry is an exact copy, so compare the bytes
+   as well, to catch keys which are not equal to themselves.  */
+
+static _Bool
+__go_map_iter_seen (const struct __go_map_descriptor *descriptor,
+		    struct __go_map_table *table, const char *entry)
+{
+  const struct __go_type_descriptor *key_descriptor;
+  uintptr_t key_offset;
+  uintptr_t key_size;
+  uintptr_t entry_size;
+  uintptr_t hash;
+  unsigned char tag;
+  uintptr_t mask;
+  uintptr_t index;
+  uintptr_t stride;
+
+  key_descriptor = descriptor->__map_descriptor->__key_type;
+  key_offset = descriptor->__key_offset;
+  key_size = key_descriptor->__size;
+  entry_size = descriptor->__entry_size;
+
+  hash = *(const uintptr_t *) entry;
+  tag = __go_map_tag (hash);
+  mask = table->__group_count - 1;
+  index = __go_map_probe_start (hash, table->__group_count);
+  stride = 0;
+  while (1)
+    {
+      uint64_t ctrl;
+      uint64_t match;
+
+      ctrl = __go_map_ctrl (__go_map_ctrl_bytes (table, index));
+      match = __go_map_match_tag (ctrl, tag);
+      while (match != 0)
+	{
+	  const char *p;
+
+	  p = __go_map_slot (table, entry_size,
+			     (index * GO_MAP_GROUP_SIZE
+			      + __go_map_match_first (match)));
+	  if (*(const uintptr_t *) p == hash
+	      && (__builtin_memcmp (p + key_offset, entry + key_offset,
+				    key_size) == 0
+		  || key_descriptor->__equalfn (p + key_offset,
+						entry + key_offset,
+						key_size)))
+	    return 1;
+	  match &= match - 1;
+	}
+      if (__go_map_match_empty (ctrl) != 0)
+	return 0;
+      ++stride;
+      index = (index + stride) & mask;
+    }
+}
+
 /* Move to the next iteration, updating *HITER.  */
 
 void
 __go_mapiternext (struct __go_hash_iter *it)
 {
-  const void *entry;
+  const struct __go_map *map;
+  const struct __go_map_descriptor *descriptor;
+  const struct __go_type_descriptor *key_descriptor;
+  uintptr_t entry_size;
+  uintptr_t old_slot_count;
+  uintptr_t slot_count;
+  uintptr_t index;
+
+  map = it->map;
+  descriptor = map->__descriptor;
+  key_descriptor = descriptor->__map_descriptor->__key_type;
+  entry_size = descriptor->__entry_size;
+  old_slot_count = (it->old_table != NULL
+		    ? it->old_table->__group_count * GO_MAP_GROUP_SIZE
+		    : 0);
+  slot_count = old_slot_count + it->table->__group_count * GO_MAP_GROUP_SIZE;
 
-  entry = it->next_entry;
-  if (entry == NULL)
+  index = it->index + 1;
+  while (index < slot_count)
     {
-      const struct __go_map *map;
-      uintptr_t bucket;
+      struct __go_map_table *table;
+      uintptr_t base;
+      uintptr_t slot;
+      uintptr_t group;
+      uint64_t match;
+      char *entry;
+      const char *key;
+      char *current;
+
+      if (index < old_slot_count)
+	{
+	  table = it->old_table;
+	  base = 0;
+	}
+      else
+	{
+	  table = it->table;
+	  base = old_slot_count;
+	}
 
-      map = it->map;
-      bucket = it->bucket;
-      while (1)
+      /* Skip to the next full slot, ignoring the slots of this group
+	 before INDEX.  */
+      slot = index - base;
+      group = slot / GO_MAP_GROUP_SIZE;
+      match = __go_map_match_full (__go_map_ctrl (__go_map_ctrl_bytes (table,
+								      group)));
+      match &= GO_MAP_MSB << (8 * (slot % GO_MAP_GROUP_SIZE));
+      if (match == 0)
 	{
-	  ++bucket;
-	  if (bucket >= map->__bucket_count)
-	    {
-	      /* Map iteration is complete.  */
-	      it->entry = NULL;
-	      return;
-	    }
-	  entry = map->__buckets[bucket];
-	  if (entry != NULL)
-	    break;
+	  index = base + (group + 1) * GO_MAP_GROUP_SIZE;
+	  continue;
 	}
-      it->bucket = bucket;
+      slot = group * GO_MAP_GROUP_SIZE + __go_map_match_first (match);
+      index = base + slot;
+      entry = __go_map_slot (table, entry_size, slot);
+
+      /* If the map was growing when the iteration started, an entry
+	 of the new table whose key is in the old table has already
+	 been returned, or was deleted.  */
+      if (table == it->table
+	  && it->old_table != NULL
+	  && __go_map_iter_seen (descriptor, it->old_table, entry))
+	{
+	  ++index;
+	  continue;
+	}
+
+      /* If the entry is where the map would find it, return it.  */
+      if (table == map->__table
+	  || (table == map->__old_table && group >= map->__evacuated))
+	{
+	  it->entry = entry;
+	  it->index = index;
+	  return;
+	}
+
+      /* The entry has been evacuated since the iteration started.
+	 It may since have been deleted or changed, so look for it in
+	 the map.  */
+      key = entry + descriptor->__key_offset;
+      current = __go_map_find (map, key, *(uintptr_t *) entry);
+      if (current != NULL)
+	{
+	  it->entry = current;
+	  it->index = index;
+	  return;
+	}
+
+      /* A key which is not equal to itself, such as a NaN, can not be
+	 found, but nor can it be deleted, so return the old entry.  */
+      if (!key_descriptor->__equalfn (key, key, key_descriptor->__size))
+	{
+	  it->entry = entry;
+	  it->index = index;
+	  return;
+	}
+
+      ++index;
     }
-  it->entry = entry;
-  it->next_entry = *(const void * const *) entry;
+
+  /* Map iteration is complete.  */
+  it->entry = NULL;
+  it->index = index;
 }
 
 /* Get the key of the current iteration.  */
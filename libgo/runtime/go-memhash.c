@@ -0,0 +1,261 @@
+/* go-memhash.c -- hash functions for memory.
+
+   Copyright 2014 The Go Authors. All rights reserved.
+   Use of this source code is governed by a BSD-style
+   license that can be found in the LICENSE file.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "runtime.h"
+#include "go-type.h"
+
+#if defined (__i386__) || defined (__x86_64__)
+#include <cpuid.h>
+#define GO_HAVE_AESHASH 1
+#endif
+
+/* The random key used by all the hash functions.  This is set once
+   at startup by runtime_hashinit, so that the hash codes of a
+   process can not be predicted by anyone who can choose the keys it
+   puts in its maps.  */
+
+uint64_t __go_hash_keys[HashRandomBytes / sizeof (uint64_t)]
+  __attribute__ ((aligned (16)));
+
+/* Whether to use the AES instructions to hash memory.  */
+
+static _Bool use_aeshash;
+
+/* Multiply A and B into a 128-bit product and fold the two halves
+   together.  */
+
+static inline uint64
+mix (uint64 a, uint64 b)
+{
+#ifdef __SIZEOF_INT128__
+  unsigned __int128 r;
+
+  r = (unsigned __int128) a * b;
+  return (uint64) r ^ (uint64) (r >> 64);
+#else
+  uint64 ah, al, bh, bl;
+  uint64 hh, hl, lh, ll;
+  uint64 lo, hi, t;
+
+  ah = a >> 32;
+  al = (uint32) a;
+  bh = b >> 32;
+  bl = (uint32) b;
+  hh = ah * bh;
+  hl = ah * bl;
+  lh = al * bh;
+  ll = al * bl;
+  t = ll + (hl << 32);
+  hi = hh + (hl >> 32) + (lh >> 32) + (t < ll);
+  lo = t + (lh << 32);
+  hi += lo < t;
+  return lo ^ hi;
+#endif
+}
+
+static inline uint64
+read64 (const byte *p)
+{
+  uint64 v;
+
+  __builtin_memcpy (&v, p, sizeof v);
+  return v;
+}
+
+static inline uint64
+read32 (const byte *p)
+{
+  uint32 v;
+
+  __builtin_memcpy (&v, p, sizeof v);
+  return v;
+}
+
+/* Hash a word.  This is used for integer and pointer keys.  */
+
+uintptr_t
+__go_hash_word (uint64_t v)
+{
+  return (uintptr_t) mix (v ^ __go_hash_keys[0], __go_hash_keys[1]);
+}
+
+/* Hash SIZE bytes at P using multiplications, sixteen bytes at a
+   time.  Short keys are read as a few possibly overlapping words, so
+   that every byte is used without a loop.  Both factors of every
+   multiplication depend on the key, so that no input can force a
+   product of zero.  */
+
+static uintptr_t
+mulhash (const byte *p, uintptr_t size)
+{
+  uint64 seed;
+  uint64 a;
+  uint64 b;
+
+  seed = __go_hash_keys[0];
+  if (size <= 16)
+    {
+      if (size >= 4)
+	{
+	  uintptr_t off;
+
+	  off = (size >> 3) << 2;
+	  a = (read32 (p) << 32) | read32 (p + off);
+	  b = (read32 (p + size - 4) << 32) | read32 (p + size - 4 - off);
+	}
+      else if (size > 0)
+	{
+	  a = (((uint64) p[0] << 16) | ((uint64) p[size >> 1] << 8)
+	       | p[size - 1]);
+	  b = 0;
+	}
+      else
+	a = b = 0;
+    }
+  else
+    {
+      uintptr_t i;
+
+      for (i = size; i > 16; i -= 16, p += 16)
+	seed = mix (read64 (p) ^ __go_hash_keys[1], read64 (p + 8) ^ seed);
+      a = read64 (p + i - 16);
+      b = read64 (p + i - 8);
+    }
+  return (uintptr_t) mix (mix (a ^ __go_hash_keys[1], b ^ seed) ^ size,
+			  __go_hash_keys[2] | 1);
+}
+
+#ifdef GO_HAVE_AESHASH
+
+typedef long long v2di __attribute__ ((vector_size (16)));
+
+static inline v2di __attribute__ ((target ("sse2,aes")))
+load128 (const byte *p)
+{
+  return (v2di) __builtin_ia32_loaddqu ((const char *) p);
+}
+
+static inline v2di __attribute__ ((target ("sse2,aes")))
+aesenc (v2di state, v2di key)
+{
+  return __builtin_ia32_aesenc128 (state, key);
+}
+
+/* Hash SIZE bytes at P, where SIZE is at least 16, using the AES
+   instructions, sixteen bytes at a time.  Each block is mixed into
+   the state with one AES round, and two more rounds finish the hash.
+   The last block overlaps the one before it, so that nothing is read
+   past the end of the key.  */
+
+static uintptr_t __attribute__ ((target ("sse2,aes")))
+aeshash (const byte *p, uintptr_t size)
+{
+  v2di k0;
+  v2di k1;
+  v2di acc;
+  uintptr_t i;
+
+  k0 = load128 ((const byte *) &__go_hash_keys[0]);
+  k1 = load128 ((const byte *) &__go_hash_keys[2]);
+  acc = k0 ^ (v2di) { (long long) size, (long long) size };
+
+  for (i = size; i > 16; i -= 16, p += 16)
+    acc = aesenc (acc ^ load128 (p), k1);
+  acc = aesenc (acc ^ load128 (p + i - 16), k1);
+
+  acc = aesenc (acc, k0);
+  acc = aesenc (acc, k1);
+  return (uintptr_t) (acc[0] ^ acc[1]);
+}
+
+#endif /* defined(GO_HAVE_AESHASH) */
+
+/* Hash SIZE bytes at P.  Keys shorter than a block are hashed faster
+   by the multiplications than by padding them out for AES.  */
+
+uintptr_t
+__go_memhash (const void *p, uintptr_t size)
+{
+#ifdef GO_HAVE_AESHASH
+  if (use_aeshash && size >= 16)
+    return aeshash ((const byte *) p, size);
+#endif
+  return mulhash ((const byte *) p, size);
+}
+
+/* Get random data for the hash keys.  */
+
+void
+runtime_get_random_data (byte **rnd, int32 *rnd_len)
+{
+  static byte data[HashRandomBytes];
+  int fd;
+  int32 n;
+
+  n = 0;
+  fd = open ("/dev/urandom", O_RDONLY);
+  if (fd >= 0)
+    {
+      while (n < (int32) sizeof data)
+	{
+	  ssize_t r;
+
+	  r = read (fd, data + n, sizeof data - n);
+	  if (r < 0 && errno == EINTR)
+	    continue;
+	  if (r <= 0)
+	    break;
+	  n += r;
+	}
+      close (fd);
+    }
+  *rnd = data;
+  *rnd_len = n;
+}
+
+/* Set up the hash functions.  This must be called before any map is
+   created.  */
+
+void
+runtime_hashinit (void)
+{
+  byte *rnd;
+  int32 rnd_len;
+  uintptr_t i;
+
+  runtime_get_random_data (&rnd, &rnd_len);
+  if (rnd_len == HashRandomBytes)
+    __builtin_memcpy (__go_hash_keys, rnd, HashRandomBytes);
+  else
+    {
+      uint64 x;
+
+      /* No random data; do what we can with the time and the
+	 address space layout.  */
+      x = (uint64) runtime_nanotime () ^ (uint64) runtime_cputicks ();
+      x ^= (uint64) (uintptr_t) &rnd;
+      for (i = 0; i < nelem (__go_hash_keys); i++)
+	{
+	  x = mix (x ^ 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL);
+	  __go_hash_keys[i] = x;
+	}
+    }
+
+#ifdef GO_HAVE_AESHASH
+  {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid (1, &eax, &ebx, &ecx, &edx)
+	&& (ecx & bit_AES) != 0
+	&& (edx & bit_SSE2) != 0)
+      use_aeshash = 1;
+  }
+#endif
+}
@@ -128,7 +128,7 @@ makemap (const struct __go_map_type *t)
 
   md = (struct __go_map_descriptor *) __go_alloc (sizeof (*md));
   md->__map_descriptor = t;
-  o = sizeof (void *);
+  o = sizeof (uintptr_t);
   kt = t->__key_type;
   o = (o + kt->__field_align - 1) & ~ (kt->__field_align - 1);
   md->__key_offset = o;
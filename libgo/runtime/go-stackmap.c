@@ -0,0 +1,42 @@
+/* go-stackmap.c -- link stack maps into the goroutine.
+
+   Copyright 2014 The Go Authors. All rights reserved.
+   Use of this source code is governed by a BSD-style
+   license that can be found in the LICENSE file.  */
+
+#include "runtime.h"
+
+/* A function compiled with -fgo-optimize-stackmaps calls this on
+   entry with the stack map in its frame.  The garbage collector finds
+   the map through the current goroutine.  */
+
+void
+__go_push_stackmap (void *p)
+{
+  FrameMap *sm;
+  G *g;
+
+  sm = (FrameMap *) p;
+  g = runtime_g ();
+  sm->next = g->framemap;
+  g->framemap = sm;
+}
+
+/* The function calls this when it returns, or when a panic unwinds
+   through it.  The push runs before the region that this pop
+   protects, and frames unwind in order, so the map is always at the
+   head of the list; if it is not, the list is corrupt and the
+   collector would read dead frames.  */
+
+void
+__go_pop_stackmap (void *p)
+{
+  FrameMap *sm;
+  G *g;
+
+  sm = (FrameMap *) p;
+  g = runtime_g ();
+  if (g->framemap != sm)
+    runtime_throw ("__go_pop_stackmap: stack map is not at the top of the list");
+  g->framemap = sm->next;
+}
@@ -47,7 +47,7 @@ __go_type_hash_complex (const void *vkey, uintptr_t key_size)
 	cf = cfr;
 
       memcpy (&fi, &cf, 8);
-      return (uintptr_t) cfi;
+      return __go_hash_word (fi);
     }
   else if (key_size == 16)
     {
@@ -78,7 +78,7 @@ __go_type_hash_complex (const void *vkey, uintptr_t key_size)
 	cd = cdr;
 
       memcpy (&di, &cd, 16);
-      return di[0] ^ di[1];
+      return __go_memhash (di, 16);
     }
   else
     runtime_throw ("__go_type_hash_complex: invalid complex size");
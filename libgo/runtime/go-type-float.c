@@ -32,7 +32,7 @@ __go_type_hash_float (const void *vkey, uintptr_t key_size)
 	return runtime_fastrand1 ();
 
       memcpy (&si, vkey, 4);
-      return (uintptr_t) si;
+      return __go_hash_word (si);
     }
   else if (key_size == 8)
     {
@@ -50,7 +50,7 @@ __go_type_hash_float (const void *vkey, uintptr_t key_size)
 	return runtime_fastrand1 ();
 
       memcpy (&di, vkey, 8);
-      return (uintptr_t) di;
+      return __go_hash_word (di);
     }
   else
     runtime_throw ("__go_type_hash_float: invalid float size");
@@ -10,16 +10,12 @@
 #include "go-type.h"
 
 /* An identity hash function for a type.  This is used for types where
-   we can simply use the type value itself as a hash code.  This is
-   true of, e.g., integers and pointers.  */
+   we can simply hash the bytes of the value.  This is true of, e.g.,
+   integers and pointers.  */
 
 uintptr_t
 __go_type_hash_identity (const void *key, uintptr_t key_size)
 {
-  uintptr_t ret;
-  uintptr_t i;
-  const unsigned char *p;
-
   if (key_size <= 8)
     {
       union
@@ -33,16 +29,10 @@ __go_type_hash_identity (const void *key, uintptr_t key_size)
 #else
       __builtin_memcpy (&u.a[0], key, key_size);
 #endif
-      if (sizeof (uintptr_t) >= 8)
-	return (uintptr_t) u.v;
-      else
-	return (uintptr_t) ((u.v >> 32) ^ (u.v & 0xffffffff));
+      return __go_hash_word (u.v);
     }
 
-  ret = 5381;
-  for (i = 0, p = (const unsigned char *) key; i < key_size; i++, p++)
-    ret = ret * 33 + *p;
-  return ret;
+  return __go_memhash (key, key_size);
 }
 
 /* An identity equality function for a type.  This is used for types
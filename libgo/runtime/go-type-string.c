@@ -14,18 +14,10 @@ uintptr_t
 __go_type_hash_string (const void *vkey,
 		       uintptr_t key_size __attribute__ ((unused)))
 {
-  uintptr_t ret;
   const String *key;
-  intgo len;
-  intgo i;
-  const byte *p;
 
-  ret = 5381;
   key = (const String *) vkey;
-  len = key->len;
-  for (i = 0, p = key->str; i < len; i++, p++)
-    ret = ret * 33 + *p;
-  return ret;
+  return __go_memhash (key->str, key->len);
 }
 
 /* A string equality function for a map.  */
@@ -320,6 +320,13 @@ extern _Bool
 __go_type_descriptors_equal(const struct __go_type_descriptor*,
 			    const struct __go_type_descriptor*);
 
+extern const struct __go_type_descriptor *
+__go_type_canonical (const struct __go_type_descriptor *);
+
+extern uint64_t __go_hash_keys[];
+extern uintptr_t __go_hash_word (uint64_t);
+extern uintptr_t __go_memhash (const void *, uintptr_t);
+
 extern uintptr_t __go_type_hash_identity (const void *, uintptr_t);
 extern _Bool __go_type_equal_identity (const void *, const void *, uintptr_t);
 extern uintptr_t __go_type_hash_string (const void *, uintptr_t);
@@ -5,25 +5,20 @@
    license that can be found in the LICENSE file.  */
 
 #include "runtime.h"
+#include "arch.h"
+#include "malloc.h"
 #include "go-string.h"
 #include "go-type.h"
 
-/* Compare type descriptors for equality.  This is necessary because
-   types may have different descriptors in different shared libraries.
-   Also, unnamed types may have multiple type descriptors even in a
-   single shared library.  */
+/* Compare the names of two type descriptors which have the same code
+   and hash.  This is necessary because types may have different
+   descriptors in different shared libraries.  Also, unnamed types may
+   have multiple type descriptors even in a single shared library.  */
 
-_Bool
-__go_type_descriptors_equal (const struct __go_type_descriptor *td1,
-			     const struct __go_type_descriptor *td2)
+static _Bool
+descriptor_names_equal (const struct __go_type_descriptor *td1,
+			const struct __go_type_descriptor *td2)
 {
-  if (td1 == td2)
-    return 1;
-  /* In a type switch we can get a NULL descriptor.  */
-  if (td1 == NULL || td2 == NULL)
-    return 0;
-  if (td1->__code != td2->__code || td1->__hash != td2->__hash)
-    return 0;
   if (td1->__uncommon != NULL && td1->__uncommon->__name != NULL)
     {
       if (td2->__uncommon == NULL || td2->__uncommon->__name == NULL)
@@ -37,3 +32,237 @@ __go_type_descriptors_equal (const struct __go_type_descriptor *td1,
     return 0;
   return __go_ptr_strings_equal (td1->__reflection, td2->__reflection);
 }
+
+/* Rather than comparing names every time two different descriptors
+   are compared, each descriptor is mapped to a canonical descriptor
+   for its type, the first one seen.  The names are compared only
+   when a descriptor is first canonicalized; after that two
+   descriptors are equal if their canonical descriptors are the same
+   pointer.
+
+   The registry is a hash table of entries keyed by descriptor, which
+   is shared by all threads.  Lookups do not lock: an entry is fully
+   built before it is stored in a slot, and a full table is replaced
+   by a copy twice the size.  Insertions are serialized by
+   canon_lock.  The canonical descriptors are also kept in a table
+   keyed by the type hash, which is only used under the lock.  None of
+   this memory is ever freed, since a program has a bounded number of
+   type descriptors, and it is allocated outside the garbage collected
+   heap; the type descriptors created by the reflect package are kept
+   alive by its own caches.  */
+
+struct canon_entry
+{
+  const struct __go_type_descriptor *td;
+  const struct __go_type_descriptor *canon;
+};
+
+struct canon_table
+{
+  /* The number of slots, which is a power of 2.  */
+  uintptr size;
+  /* The number of slots in use.  */
+  uintptr count;
+  /* The slots, each NULL or pointing to an entry.  */
+  struct canon_entry *entries[];
+};
+
+#define CANON_INITIAL_SIZE 256
+
+/* The table of all descriptors seen.  */
+static struct canon_table *canon_table;
+
+/* The table of canonical descriptors, mapped to themselves.  */
+static struct canon_table *canon_types;
+
+static Lock canon_lock;
+
+/* Return the first slot to probe for KEY in a table of SIZE slots.
+   The key of an entry is its descriptor pointer in CANON_TABLE and
+   its type hash in CANON_TYPES.  */
+
+static inline uintptr
+canon_hash (uint64 key, uintptr size)
+{
+  return (uintptr) ((key * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
+
+static struct canon_table *
+canon_alloc_table (uintptr size)
+{
+  struct canon_table *table;
+
+  table = runtime_persistentalloc (sizeof (struct canon_table)
+				   + size * sizeof (struct canon_entry *),
+				   0, &mstats.other_sys);
+  table->size = size;
+  return table;
+}
+
+/* Store E in *PTABLE under KEY, growing the table if needed.  */
+
+static void
+canon_store (struct canon_table **ptable, struct canon_entry *e, uint64 key,
+	     _Bool by_hash)
+{
+  struct canon_table *table;
+  uintptr mask;
+  uintptr i;
+
+  table = *ptable;
+  if (table == NULL || (table->count + 1) * 4 > table->size * 3)
+    {
+      struct canon_table *new_table;
+
+      new_table = canon_alloc_table (table == NULL
+				     ? CANON_INITIAL_SIZE
+				     : table->size * 2);
+      if (table != NULL)
+	{
+	  for (i = 0; i < table->size; i++)
+	    {
+	      struct canon_entry *old;
+
+	      old = table->entries[i];
+	      if (old != NULL)
+		canon_store (&new_table, old,
+			     (by_hash
+			      ? (uint64) old->td->__hash
+			      : (uint64) (uintptr) old->td),
+			     by_hash);
+	    }
+	}
+      table = new_table;
+    }
+
+  mask = table->size - 1;
+  i = canon_hash (key, table->size);
+  while (table->entries[i] != NULL)
+    i = (i + 1) & mask;
+  runtime_atomicstorep (&table->entries[i], e);
+  table->count++;
+
+  if (table != *ptable)
+    runtime_atomicstorep (ptable, table);
+}
+
+/* Find the canonical descriptor for TD in CANON_TABLE, or return
+   NULL if TD has not been seen.  */
+
+static inline const struct __go_type_descriptor *
+canon_find (const struct __go_type_descriptor *td)
+{
+  struct canon_table *table;
+  uintptr mask;
+  uintptr i;
+
+  table = runtime_atomicloadp (&canon_table);
+  if (table == NULL)
+    return NULL;
+  mask = table->size - 1;
+  for (i = canon_hash ((uint64) (uintptr) td, table->size);
+       ;
+       i = (i + 1) & mask)
+    {
+      struct canon_entry *e;
+
+      e = runtime_atomicloadp (&table->entries[i]);
+      if (e == NULL)
+	return NULL;
+      if (e->td == td)
+	return e->canon;
+    }
+}
+
+/* Add TD to the registry and return its canonical descriptor.  */
+
+static const struct __go_type_descriptor *
+canon_add (const struct __go_type_descriptor *td)
+{
+  const struct __go_type_descriptor *canon;
+  struct canon_table *types;
+  struct canon_entry *e;
+
+  runtime_lock (&canon_lock);
+
+  /* Another thread may have added it first.  */
+  canon = canon_find (td);
+  if (canon != NULL)
+    {
+      runtime_unlock (&canon_lock);
+      return canon;
+    }
+
+  types = canon_types;
+  if (types != NULL)
+    {
+      uintptr mask;
+      uintptr i;
+
+      mask = types->size - 1;
+      for (i = canon_hash (td->__hash, types->size);
+	   types->entries[i] != NULL;
+	   i = (i + 1) & mask)
+	{
+	  const struct __go_type_descriptor *c;
+
+	  c = types->entries[i]->td;
+	  if (c->__code == td->__code
+	      && c->__hash == td->__hash
+	      && descriptor_names_equal (c, td))
+	    {
+	      canon = c;
+	      break;
+	    }
+	}
+    }
+
+  e = runtime_persistentalloc (sizeof *e, 0, &mstats.other_sys);
+  e->td = td;
+  if (canon != NULL)
+    e->canon = canon;
+  else
+    {
+      e->canon = td;
+      canon_store (&canon_types, e, td->__hash, 1);
+    }
+  canon_store (&canon_table, e, (uint64) (uintptr) td, 0);
+
+  runtime_unlock (&canon_lock);
+
+  return e->canon;
+}
+
+/* Return the canonical descriptor for TD: the same pointer for every
+   descriptor of the same type.  */
+
+const struct __go_type_descriptor *
+__go_type_canonical (const struct __go_type_descriptor *td)
+{
+  const struct __go_type_descriptor *canon;
+
+  if (td == NULL)
+    return NULL;
+  canon = canon_find (td);
+  if (__builtin_expect (canon != NULL, 1))
+    return canon;
+  return canon_add (td);
+}
+
+/* Compare type descriptors for equality.  Descriptors of different
+   codes or type hashes are never equal; otherwise they are equal if
+   they have the same canonical descriptor.  */
+
+_Bool
+__go_type_descriptors_equal (const struct __go_type_descriptor *td1,
+			     const struct __go_type_descriptor *td2)
+{
+  if (td1 == td2)
+    return 1;
+  /* In a type switch we can get a NULL descriptor.  */
+  if (td1 == NULL || td2 == NULL)
+    return 0;
+  if (td1->__code != td2->__code || td1->__hash != td2->__hash)
+    return 0;
+  return __go_type_canonical (td1) == __go_type_canonical (td2);
+}
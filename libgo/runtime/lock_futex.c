@@ -24,26 +24,95 @@ enum
 	MUTEX_SLEEPING = 2,
 
 	ACTIVE_SPIN = 4,
+	ACTIVE_SPIN_MAX = 64,
 	ACTIVE_SPIN_CNT = 30,
 	PASSIVE_SPIN = 1,
+
+	// Prime to not correlate with any lock addresses.
+	LOCKSTATSZ = 1021,
+};
+
+// Contention on one lock, recorded when GODEBUG=lockprof=1.
+typedef struct LockStat LockStat;
+struct LockStat
+{
+	Lock*	l;
+	uint64	ncontended;	// acquisitions which found l held
+	uint64	waitns;		// total time they waited
 };
+static LockStat lockstats[LOCKSTATSZ];
+
+static void
+lockstat(Lock *l, int64 ns)
+{
+	LockStat *s;
+	uint32 i, h;
+
+	h = ((uintptr)l >> 3) % LOCKSTATSZ;
+	for(i = 0; i < LOCKSTATSZ; i++) {
+		s = &lockstats[(h + i) % LOCKSTATSZ];
+		if(runtime_atomicloadp((void**)&s->l) == nil)
+			runtime_casp((void**)&s->l, nil, l);
+		if(runtime_atomicloadp((void**)&s->l) == l) {
+			runtime_xadd64(&s->ncontended, 1);
+			runtime_xadd64(&s->waitns, ns);
+			return;
+		}
+	}
+	// The table is full; drop the sample.
+}
+
+// Store the recorded lock contention in buf as triples of lock
+// address, contended acquisitions and nanoseconds waited.  Return the
+// number of values stored.
+intgo
+runtime_readlockstats(uint64 *buf, intgo n)
+{
+	LockStat *s;
+	intgo i;
+
+	i = 0;
+	for(s = lockstats; s < lockstats + LOCKSTATSZ && i + 3 <= n; s++) {
+		if(runtime_atomicloadp((void**)&s->l) == nil)
+			continue;
+		buf[i++] = (uintptr)s->l;
+		buf[i++] = runtime_atomicload64(&s->ncontended);
+		buf[i++] = runtime_atomicload64(&s->waitns);
+	}
+	return i;
+}
 
 // Possible lock states are MUTEX_UNLOCKED, MUTEX_LOCKED and MUTEX_SLEEPING.
 // MUTEX_SLEEPING means that there is presumably at least one sleeping thread.
 // Note that there can be spinning threads during all states - they do not
 // affect mutex's state.
+//
+// How long to spin adapts to each lock.  l->spins tracks how many spins
+// the recent contended acquisitions of l needed, counting those that
+// only got the lock by sleeping as zero.  A thread spins for up to twice
+// that average, and stops early if the owner of l is asleep, since the
+// lock will not be released until the owner is woken.
 void
 runtime_lock(Lock *l)
 {
-	uint32 i, v, wait, spin;
+	M *mp, *owner;
+	uint32 i, v, wait, spin, spun;
+	int64 t0;
 
-	if(runtime_m()->locks++ < 0)
+	mp = runtime_m();
+	if(mp->locks++ < 0)
 		runtime_throw("runtime_lock: lock count");
 
 	// Speculative grab for lock.
 	v = runtime_xchg((uint32*)&l->key, MUTEX_LOCKED);
-	if(v == MUTEX_UNLOCKED)
+	if(v == MUTEX_UNLOCKED) {
+		l->owner = mp;
 		return;
+	}
+
+	t0 = 0;
+	if(runtime_debug.lockprof)
+		t0 = runtime_nanotime();
 
 	// wait is either MUTEX_LOCKED or MUTEX_SLEEPING
 	// depending on whether there is a thread sleeping
@@ -55,17 +124,26 @@ runtime_lock(Lock *l)
 	wait = v;
 
 	// On uniprocessor's, no point spinning.
-	// On multiprocessors, spin for ACTIVE_SPIN attempts.
+	// On multiprocessors, spin for at least ACTIVE_SPIN attempts.
 	spin = 0;
-	if(runtime_ncpu > 1)
-		spin = ACTIVE_SPIN;
+	if(runtime_ncpu > 1) {
+		spin = ACTIVE_SPIN + (l->spins >> 2);
+		if(spin > ACTIVE_SPIN_MAX)
+			spin = ACTIVE_SPIN_MAX;
+	}
+	spun = 0;
 
 	for(;;) {
-		// Try for lock, spinning.
+		// Try for lock, spinning while the owner runs.
 		for(i = 0; i < spin; i++) {
 			while(l->key == MUTEX_UNLOCKED)
-				if(runtime_cas((uint32*)&l->key, MUTEX_UNLOCKED, wait))
-					return;
+				if(runtime_cas((uint32*)&l->key, MUTEX_UNLOCKED, wait)) {
+					spun = i + 1;
+					goto locked;
+				}
+			owner = (M*)runtime_atomicloadp((void**)&l->owner);
+			if(owner != nil && owner->blocked)
+				break;
 			runtime_procyield(ACTIVE_SPIN_CNT);
 		}
 
@@ -73,17 +151,26 @@ runtime_lock(Lock *l)
 		for(i=0; i < PASSIVE_SPIN; i++) {
 			while(l->key == MUTEX_UNLOCKED)
 				if(runtime_cas((uint32*)&l->key, MUTEX_UNLOCKED, wait))
-					return;
+					goto locked;
 			runtime_osyield();
 		}
 
 		// Sleep.
 		v = runtime_xchg((uint32*)&l->key, MUTEX_SLEEPING);
 		if(v == MUTEX_UNLOCKED)
-			return;
+			goto locked;
 		wait = MUTEX_SLEEPING;
+		mp->blocked = true;
 		runtime_futexsleep((uint32*)&l->key, MUTEX_SLEEPING, -1);
+		mp->blocked = false;
 	}
+
+locked:
+	// Only the owner updates l->spins, so this does not race.
+	l->owner = mp;
+	l->spins += spun - (l->spins >> 3);
+	if(t0 != 0)
+		lockstat(l, runtime_nanotime() - t0);
 }
 
 void
@@ -91,6 +178,7 @@ runtime_unlock(Lock *l)
 {
 	uint32 v;
 
+	l->owner = nil;
 	v = runtime_xchg((uint32*)&l->key, MUTEX_UNLOCKED);
 	if(v == MUTEX_UNLOCKED)
 		runtime_throw("unlock of unlocked lock");
@@ -116,6 +116,15 @@ runtime_unlock(Lock *l)
 		runtime_throw("runtime_unlock: lock count");
 }
 
+// Lock contention is only recorded by the futex-based implementation.
+intgo
+runtime_readlockstats(uint64 *buf, intgo n)
+{
+	USED(buf);
+	USED(n);
+	return 0;
+}
+
 // One-time notifications.
 void
 runtime_noteclear(Note *n)
@@ -115,6 +115,7 @@ enum
 	FixAllocChunk = 16<<10,		// Chunk size for FixAlloc
 	MaxMHeapList = 1<<(20 - PageShift),	// Maximum page length for fixed-size list in MHeap.
 	HeapAllocChunk = 1<<20,		// Chunk size for heap growth
+	HugePageSize = 2<<20,		// Transparent huge page size; the arena and its growth are aligned to it
 
 	// Number of bits in page to span calculations (4k pages).
 	// On Windows 64-bit we limit the arena to 32GB or 35 bits (see below for reason).
@@ -134,10 +135,10 @@ enum
 #endif
 
 	// Max number of threads to run garbage collection.
-	// 2, 3, and 4 are all plausible maximums depending
-	// on the hardware details of the machine.  The garbage
-	// collector scales well to 8 cpus.
-	MaxGcproc = 8,
+	// Each thread marks from a work queue of its own and
+	// steals from the others when it runs out, so the
+	// garbage collector scales well to 32 cpus.
+	MaxGcproc = 32,
 };
 
 // Maximum memory allocation size, a hint for callers.
@@ -190,6 +191,17 @@ struct MLink
 //
 // SysFault marks a (already SysAlloc'd) region to fault
 // if accessed.  Used only for debugging the runtime.
+//
+// SysTrackWrites starts recording which pages of the process are
+// written, forgetting earlier writes.  It returns false if the system
+// cannot do that.  SysWritten reports whether any page of a region was
+// written since the last SysTrackWrites; it is fastest when called for
+// increasing addresses, and may report true when it cannot tell.
+//
+// SysHugePage asks the operating system to back a mapped region
+// with huge pages where it can, and returns false if it cannot do
+// that.  SysHugePageBytes reports how many bytes of a region the
+// operating system currently backs with huge pages.
 
 void*	runtime_SysAlloc(uintptr nbytes, uint64 *stat);
 void	runtime_SysFree(void *v, uintptr nbytes, uint64 *stat);
@@ -198,6 +210,10 @@ void	runtime_SysUsed(void *v, uintptr nbytes);
 void	runtime_SysMap(void *v, uintptr nbytes, bool reserved, uint64 *stat);
 void*	runtime_SysReserve(void *v, uintptr nbytes, bool *reserved);
 void	runtime_SysFault(void *v, uintptr nbytes);
+bool	runtime_SysTrackWrites(void);
+bool	runtime_SysWritten(void *v, uintptr nbytes);
+bool	runtime_SysHugePage(void *v, uintptr nbytes);
+uint64	runtime_SysHugePageBytes(void *v, uintptr nbytes);
 
 // FixAlloc is a simple free-list allocator for fixed size objects.
 // Malloc uses a FixAlloc wrapped around SysAlloc to manages its
@@ -244,6 +260,7 @@ struct MStats
 	uint64	heap_inuse;	// bytes in non-idle spans
 	uint64	heap_released;	// bytes released to the OS
 	uint64	heap_objects;	// total number of allocated objects
+	uint64	heap_huge;	// bytes of heap_sys backed by transparent huge pages, sampled by the scavenger
 
 	// Statistics about allocation of low-level fixed-size structures.
 	// Protected by FixAlloc locks.
@@ -257,6 +274,17 @@ struct MStats
 	uint64	gc_sys;
 	uint64	other_sys;
 
+	// Statistics about map tables.
+	// The first two are updated atomically.  Both only grow; a
+	// table which becomes garbage along with its map is not counted
+	// as dropped, so the difference is not the memory in use by map
+	// tables.  The last two are set by each collection, from the
+	// maps it finds live.
+	uint64	map_table_alloc;	// bytes of map tables allocated (even if freed)
+	uint64	map_table_dropped;	// bytes of map tables dropped by maps growing or shrinking
+	uint64	map_table_inuse;	// bytes of the tables of live maps
+	uint64	map_table_unused;	// bytes of their slots which hold no entry
+
 	// Statistics about garbage collector.
 	// Protected by mheap or stopping the world during GC.
 	uint64	next_gc;	// next GC (in heap_alloc time)
@@ -499,6 +527,7 @@ struct MHeap
 	byte *arena_used;
 	byte *arena_end;
 	bool arena_reserved;
+	bool hugepages;		// arena is backed by huge pages where possible
 
 	// central free lists for small size classes.
 	// the padding makes sure that the MCentrals are
@@ -532,6 +561,8 @@ void*	runtime_MHeap_SysAlloc(MHeap *h, uintptr n);
 void	runtime_MHeap_MapBits(MHeap *h);
 void	runtime_MHeap_MapSpans(MHeap *h);
 void	runtime_MHeap_Scavenger(void*);
+void	runtime_MHeap_ReleaseOverLimit(MHeap *h);
+uint64	runtime_mappedmem(void);
 void	runtime_MHeap_SplitSpan(MHeap *h, MSpan *s);
 
 void*	runtime_mallocgc(uintptr size, uintptr typ, uint32 flag);
@@ -541,10 +572,19 @@ void	runtime_gc(int32 force);
 uintptr	runtime_sweepone(void);
 void	runtime_markscan(void *v);
 void	runtime_marknogc(void *v);
+void	runtime_markallocated(void *v, uint32 flag);
 void	runtime_checkallocated(void *v, uintptr n);
 void	runtime_markfreed(void *v);
 void	runtime_checkfreed(void *v, uintptr n);
 extern	int32	runtime_checking;
+extern	uint32	runtime_gcmarking;
+
+// The soft memory limit set by GOMEMLIMIT or debug.SetMemoryLimit,
+// and the heap size at which it makes the next collection start.
+// Both are NoMemLimit when there is no limit.
+#define	NoMemLimit	(~(uint64)0)
+extern	uint64	runtime_softmemlimit;
+extern	uint64	runtime_limitgoal;
 void	runtime_markspan(void *v, uintptr size, uintptr n, bool leftover);
 void	runtime_unmarkspan(void *v, uintptr size);
 void	runtime_purgecachedstats(MCache*);
@@ -646,6 +686,7 @@ void	runtime_gc_itab_ptr(Eface*);
 
 void	runtime_memorydump(void);
 int32	runtime_setgcpercent(int32);
+int64	runtime_setmemlimit(int64);
 
 // Value we use to mark dead pointers when GODEBUG=gcdead=1.
 #define PoisonGC ((uintptr)0xf969696969696969ULL)
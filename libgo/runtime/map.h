@@ -18,7 +18,7 @@ struct __go_map_descriptor
   const struct __go_map_type *__map_descriptor;
 
   /* A map entry is a struct with three fields:
-       map_entry_type *next_entry;
+       uintptr_t hash;
        key_type key;
        value_type value;
      This is the size of that struct.  */
@@ -33,6 +33,92 @@ struct __go_map_descriptor
   uintptr_t __val_offset;
 };
 
+/* A map is an open addressing hash table.  The slots of the table
+   are arranged in groups of GO_MAP_GROUP_SIZE slots.  Each slot has
+   a control byte; the control bytes of the whole table are stored
+   together, followed by the slots themselves, so that a lookup
+   usually touches one cache line of control bytes and one slot.
+   Each slot holds one map entry as described by the map descriptor.
+   The first word of an entry caches the hash code of the key, so
+   that hash codes never have to be recomputed when the table is
+   resized.
+
+   A control byte is GO_MAP_EMPTY for a slot which has not been used
+   since the table was allocated, GO_MAP_DELETED for a slot whose
+   entry was deleted, and GO_MAP_FULL plus the low seven bits of the
+   hash code for a slot holding an entry.  A lookup compares the
+   control bytes of a whole group at once, and only calls the key
+   equality function for slots whose seven bit tag matches.  Unused
+   slots are always zeroed.
+
+   The number of groups is always a power of 2.  The groups probed
+   for a key start with the one selected by the hash code and advance
+   by triangular numbers, which visits every group.  Since a group
+   with an empty slot is never full, a lookup may stop at the first
+   such group.  At most 7/8 of the slots may be used, counting
+   deleted slots; when that limit is reached the map starts growing
+   into a new table.
+
+   A map grows incrementally, so that no single insertion has to move
+   every entry of a large map.  While a map is growing it has both an
+   old table and a new table.  Each insertion or deletion evacuates
+   the next GO_MAP_EVACUATE_GROUPS groups of the old table by copying
+   their entries to the new table; when every group has been
+   evacuated the old table is dropped.  The slots of evacuated groups
+   are left untouched, so that an iterator which started before the
+   evacuation sees them, but lookups ignore them.  New entries always
+   go into the new table, which is sized so that the old entries are
+   guaranteed to fit.  Lookups do not evacuate, since any number of
+   goroutines may read a map at once.
+
+   A map also shrinks, in the same incremental way, when a deletion
+   leaves fewer than 1/GO_MAP_SHRINK_LOAD of its usable slots in use.
+   The new table is at most GO_MAP_SHRINK_FACTOR times smaller than
+   the old one, so that a map which is emptied shrinks in several
+   steps and each evacuation stays short.  A shrinking map may have
+   fewer entries left to delete than the old table has groups, so
+   when a map holds few entries compared with the size of its old
+   table each insertion or deletion evacuates more groups; see
+   __go_map_evacuate_count.  */
+
+#define GO_MAP_GROUP_SIZE 8
+
+#define GO_MAP_EMPTY 0
+#define GO_MAP_DELETED 1
+#define GO_MAP_FULL 0x80
+
+/* The hash table of a map.  The control bytes immediately follow
+   this header, and the slots follow the control bytes.  The header
+   is padded to 8 bytes so that the slots are suitably aligned for
+   any key or value type.  */
+
+struct __go_map_table
+{
+  /* The number of groups in the table.  */
+  uintptr_t __group_count __attribute__ ((aligned (8)));
+};
+
+/* Flags for the __flags field of a map.  */
+
+/* Set if the map has ever been iterated over.  An iterator may still
+   refer to an old table, so old tables are left to the garbage
+   collector rather than being freed when the map is rehashed.  */
+#define GO_MAP_ITERATOR 1
+
+/* The number of groups of the old table evacuated by each insertion
+   or deletion while a map is growing.  A new table always leaves
+   room for at least half as many insertions as the old table has
+   groups, so the evacuation normally finishes before the new table
+   fills up.  */
+#define GO_MAP_EVACUATE_GROUPS 2
+
+/* The thresholds for shrinking a map, as described above.  With
+   these values a table created by shrinking leaves room for 21/32 as
+   many insertions as the old table has groups, which is enough for
+   GO_MAP_EVACUATE_GROUPS.  */
+#define GO_MAP_SHRINK_LOAD 32
+#define GO_MAP_SHRINK_FACTOR 8
+
 struct __go_map
 {
   /* The constant descriptor for this map.  */
@@ -41,13 +127,40 @@ struct __go_map
   /* The number of elements in the hash table.  */
   uintptr_t __element_count;
 
-  /* The number of entries in the __buckets array.  */
-  uintptr_t __bucket_count;
+  /* The number of empty slots of the table which may be filled
+     before the map must grow again.  While the map is growing, this
+     does not include the slots reserved for the entries which remain
+     to be evacuated.  */
+  uintptr_t __growth_left;
+
+  /* GO_MAP_xxx flags.  */
+  uintptr_t __flags;
+
+  /* The hash table.  This is NULL for a map created without a size
+     hint until the first entry is inserted.  */
+  struct __go_map_table *__table;
+
+  /* The table the map is growing from, or NULL if the map is not
+     growing.  */
+  struct __go_map_table *__old_table;
 
-  /* Each bucket is a pointer to a linked list of map entries.  */
-  void **__buckets;
+  /* The number of groups of __old_table which have been evacuated.
+     Groups are evacuated in order, so these are the groups whose
+     index is less than this.  */
+  uintptr_t __evacuated;
+
+  /* The next map in __go_map_list, complemented so that the garbage
+     collector does not take it for a pointer.  */
+  uintptr_t __gc_next;
 };
 
+/* The list of maps, linked through __gc_next, which the garbage
+   collector walks to count the memory of the tables of the live
+   maps.  The head is complemented like the links, and 0 if the list
+   is empty.  */
+
+extern uintptr_t __go_map_list;
+
 /* For a map iteration the compiled code will use a pointer to an
    iteration structure.  The iteration structure will be allocated on
    the stack.  The Go code must allocate at least enough space.  */
@@ -60,24 +173,273 @@ struct __go_hash_iter
   const void *entry;
   /* The map we are iterating over.  */
   const struct __go_map *map;
-  /* A pointer to the next entry in the current bucket.  This permits
-     deleting the current entry.  This will be NULL when we have seen
-     all the entries in the current bucket.  */
-  const void *next_entry;
-  /* The bucket index of the current and next entry.  */
-  uintptr_t bucket;
+  /* The tables we are iterating over.  These are the tables the map
+     had when the iteration started; OLD_TABLE is NULL unless the map
+     was growing.  The slots of OLD_TABLE are visited first, then
+     those of TABLE.  If the map has moved on since the iteration
+     started, each entry is looked up in the map before it is
+     returned.  */
+  struct __go_map_table *old_table;
+  struct __go_map_table *table;
+  /* The slot index of the current entry, counting the slots of
+     OLD_TABLE followed by the slots of TABLE.  */
+  uintptr_t index;
+};
+
+/* Return the number of bytes needed for a table with GROUP_COUNT
+   groups of entries of size ENTRY_SIZE.  */
+
+static inline uintptr_t
+__go_map_table_size (uintptr_t group_count, uintptr_t entry_size)
+{
+  return (sizeof (struct __go_map_table)
+	  + group_count * GO_MAP_GROUP_SIZE * (1 + entry_size));
+}
+
+/* Return a pointer to the control bytes of group INDEX of TABLE.  */
+
+static inline unsigned char *
+__go_map_ctrl_bytes (struct __go_map_table *table, uintptr_t index)
+{
+  return (unsigned char *) (table + 1) + index * GO_MAP_GROUP_SIZE;
+}
+
+/* Return a pointer to the entry in slot INDEX of TABLE.  */
+
+static inline char *
+__go_map_slot (struct __go_map_table *table, uintptr_t entry_size,
+	       uintptr_t index)
+{
+  return ((char *) (table + 1)
+	  + table->__group_count * GO_MAP_GROUP_SIZE
+	  + index * entry_size);
+}
+
+/* Return the number of slots which may be used in a table with
+   GROUP_COUNT groups.  */
+
+static inline uintptr_t
+__go_map_max_fill (uintptr_t group_count)
+{
+  return group_count * (GO_MAP_GROUP_SIZE - 1);
+}
+
+/* Return the hash code of KEY, which has type KEY_DESCRIPTOR.  The
+   low bits select the tag and the next bits select the group, so
+   this relies on the type hash functions mixing all the bits of the
+   key into all the bits of the hash code; see go-memhash.c.  */
+
+static inline uintptr_t
+__go_map_hash (const struct __go_type_descriptor *key_descriptor,
+	       const void *key)
+{
+  return key_descriptor->__hashfn (key, key_descriptor->__size);
+}
+
+/* The kinds of keys for which the compiler calls specialized
+   versions of the map functions.  The specialized functions hash and
+   compare the key directly rather than calling the functions of the
+   key type descriptor, which the compiler only permits when that
+   gives the same result.  GO_MAP_KEY_32 and GO_MAP_KEY_64 are for
+   integers, pointers and channels of that many bits, which use the
+   identity hash function.  */
+
+enum __go_map_key_kind
+{
+  GO_MAP_KEY_GENERIC,
+  GO_MAP_KEY_32,
+  GO_MAP_KEY_64,
+  GO_MAP_KEY_STRING
 };
 
+/* Return the hash code of KEY, of kind KIND, which has type
+   KEY_DESCRIPTOR.  This matches __go_type_hash_identity and
+   __go_type_hash_string.  */
+
+static inline uintptr_t
+__go_map_key_hash (enum __go_map_key_kind kind,
+		   const struct __go_type_descriptor *key_descriptor,
+		   const void *key)
+{
+  switch (kind)
+    {
+    case GO_MAP_KEY_32:
+      return __go_hash_word (*(const uint32_t *) key);
+    case GO_MAP_KEY_64:
+      return __go_hash_word (*(const uint64_t *) key);
+    case GO_MAP_KEY_STRING:
+      return __go_memhash (((const String *) key)->str,
+			   ((const String *) key)->len);
+    default:
+      return __go_map_hash (key_descriptor, key);
+    }
+}
+
+/* Return whether the keys K1 and K2, of kind KIND, are equal.  */
+
+static inline _Bool
+__go_map_key_equal (enum __go_map_key_kind kind,
+		    const struct __go_type_descriptor *key_descriptor,
+		    const void *k1, const void *k2)
+{
+  switch (kind)
+    {
+    case GO_MAP_KEY_32:
+      return *(const uint32_t *) k1 == *(const uint32_t *) k2;
+    case GO_MAP_KEY_64:
+      return *(const uint64_t *) k1 == *(const uint64_t *) k2;
+    case GO_MAP_KEY_STRING:
+      {
+	const String *s1;
+	const String *s2;
+
+	s1 = (const String *) k1;
+	s2 = (const String *) k2;
+	return (s1->len == s2->len
+		&& (s1->str == s2->str
+		    || __builtin_memcmp (s1->str, s2->str, s1->len) == 0));
+      }
+    default:
+      return key_descriptor->__equalfn (k1, k2, key_descriptor->__size);
+    }
+}
+
+/* Return the control byte to use for an entry with hash code HASH.  */
+
+static inline unsigned char
+__go_map_tag (uintptr_t hash)
+{
+  return GO_MAP_FULL | (hash & 0x7f);
+}
+
+/* Return the first group to probe for hash code HASH.  */
+
+static inline uintptr_t
+__go_map_probe_start (uintptr_t hash, uintptr_t group_count)
+{
+  return (hash >> 7) & (group_count - 1);
+}
+
+/* The control bytes of a group are loaded into a 64-bit word with
+   the control byte for slot I in bits 8*I to 8*I+7.  The match
+   functions return a word with the high bit of each matching byte
+   set.  */
+
+#define GO_MAP_LSB 0x0101010101010101ULL
+#define GO_MAP_MSB 0x8080808080808080ULL
+
+static inline uint64_t
+__go_map_ctrl (const unsigned char *group)
+{
+  uint64_t w;
+
+  __builtin_memcpy (&w, group, sizeof w);
+#ifdef WORDS_BIGENDIAN
+  w = __builtin_bswap64 (w);
+#endif
+  return w;
+}
+
+/* Return the bytes of W which are zero.  */
+
+static inline uint64_t
+__go_map_match_zero (uint64_t w)
+{
+  return ~(((w & ~GO_MAP_MSB) + ~GO_MAP_MSB) | w | ~GO_MAP_MSB);
+}
+
+/* Return the slots whose control byte is TAG.  */
+
+static inline uint64_t
+__go_map_match_tag (uint64_t w, unsigned char tag)
+{
+  return __go_map_match_zero (w ^ (GO_MAP_LSB * tag));
+}
+
+/* Return the slots which are empty.  */
+
+static inline uint64_t
+__go_map_match_empty (uint64_t w)
+{
+  return __go_map_match_zero (w);
+}
+
+/* Return the slots which do not hold an entry.  */
+
+static inline uint64_t
+__go_map_match_free (uint64_t w)
+{
+  return ~w & GO_MAP_MSB;
+}
+
+/* Return the slots which hold an entry.  */
+
+static inline uint64_t
+__go_map_match_full (uint64_t w)
+{
+  return w & GO_MAP_MSB;
+}
+
+/* Return the index of the first slot in the non-zero match M.  */
+
+static inline uintptr_t
+__go_map_match_first (uint64_t m)
+{
+  return (uintptr_t) __builtin_ctzll (m) >> 3;
+}
+
 extern struct __go_map *__go_new_map (const struct __go_map_descriptor *,
 				      uintptr_t);
 
-extern uintptr_t __go_map_next_prime (uintptr_t);
+extern uintptr_t __go_map_group_count (uintptr_t);
+
+extern struct __go_map_table *
+__go_map_alloc_table (const struct __go_map_descriptor *, uintptr_t);
+
+extern void __go_map_free_table (struct __go_map *, struct __go_map_table *);
+
+extern char *__go_map_find (const struct __go_map *, const void *, uintptr_t);
+
+extern void __go_map_evacuate (struct __go_map *, uintptr_t);
+
+/* Return the number of groups to evacuate for an insertion into or
+   deletion from MAP, which must be growing.  This is enough that
+   deleting every entry finishes the evacuation: the ratio of groups
+   left to entries left never increases, and the last deletion
+   evacuates everything.  */
+
+static inline uintptr_t
+__go_map_evacuate_count (const struct __go_map *map)
+{
+  uintptr_t remaining;
+  uintptr_t count;
+
+  remaining = map->__old_table->__group_count - map->__evacuated;
+  if (map->__element_count == 0)
+    return remaining;
+  count = remaining / map->__element_count + 1;
+  return count > GO_MAP_EVACUATE_GROUPS ? count : GO_MAP_EVACUATE_GROUPS;
+}
+
+extern void __go_map_resize (struct __go_map *, uintptr_t);
 
 extern void *__go_map_index (struct __go_map *, const void *, _Bool);
 
+extern void *__go_map_index_fast32 (struct __go_map *, const void *, _Bool);
+
+extern void *__go_map_index_fast64 (struct __go_map *, const void *, _Bool);
+
+extern void *__go_map_index_faststr (struct __go_map *, const void *, _Bool);
+
 extern void __go_map_delete (struct __go_map *, const void *);
 
-extern void __go_mapiterinit (const struct __go_map *, struct __go_hash_iter *);
+extern void __go_map_delete_fast32 (struct __go_map *, const void *);
+
+extern void __go_map_delete_fast64 (struct __go_map *, const void *);
+
+extern void __go_map_delete_faststr (struct __go_map *, const void *);
+
+extern void __go_mapiterinit (struct __go_map *, struct __go_hash_iter *);
 
 extern void __go_mapiternext (struct __go_hash_iter *);
 
@@ -3,6 +3,7 @@
 #undef _XOPEN_SOURCE
 
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "runtime.h"
@@ -115,6 +116,46 @@ runtime_SysUnused(void *v __attribute__ ((unused)), uintptr n __attribute__ ((un
 #endif
 }
 
+#ifdef MADV_HUGEPAGE
+
+// Reports whether the kernel gives huge pages to regions that ask for
+// them.  It accepts MADV_HUGEPAGE even when they are turned off.
+static bool
+thpenabled(void)
+{
+	static int32 enabled;	// 1 if so, -1 if not, 0 if not known yet
+	char buf[64];
+	int32 fd;
+	intptr n;
+
+	if(enabled == 0) {
+		enabled = -1;
+		fd = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY|O_CLOEXEC);
+		if(fd >= 0) {
+			n = read(fd, buf, sizeof buf - 1);
+			close(fd);
+			if(n > 0) {
+				buf[n] = '\0';
+				if(runtime_strstr(buf, "[never]") == nil)
+					enabled = 1;
+			}
+		}
+	}
+	return enabled > 0;
+}
+
+#endif
+
+bool
+runtime_SysHugePage(void *v __attribute__ ((unused)), uintptr n __attribute__ ((unused)))
+{
+#ifdef MADV_HUGEPAGE
+	return thpenabled() && runtime_madvise(v, n, MADV_HUGEPAGE) == 0;
+#else
+	return false;
+#endif
+}
+
 void
 runtime_SysUsed(void *v, uintptr n)
 {
@@ -228,3 +269,208 @@ runtime_SysMap(void *v, uintptr n, bool reserved, uint64 *stat)
 	if(p != v)
 		runtime_throw("runtime: cannot map pages in arena address space");
 }
+
+#ifdef __linux__
+
+// Writes are tracked with the soft-dirty bits of the page table.
+// Writing 4 to /proc/self/clear_refs clears them and write-protects
+// every page, so that the first write to a page afterward faults and
+// sets its bit again, which /proc/self/pagemap reports as bit 55.
+
+#define PagemapSoftDirty (1ULL<<55)
+
+enum
+{
+	PagemapWindow = 512,	// entries read at a time
+};
+
+static int32 clearrefs_fd = -1;
+static int32 pagemap_fd = -1;
+static int32 softdirty;		// 1 if supported, -1 if not, 0 if not known yet
+static uintptr syspagesize;
+static byte *probe;		// a page of our own, to check the kernel
+static uintptr window;		// first page number in windowbits
+static uintptr windowlen;	// number of entries in windowbits
+static uint64 windowbits[PagemapWindow];
+
+static bool
+readpagemap(uintptr page, uint64 *entries, uintptr n)
+{
+	int64 off;
+	uintptr len;
+	intptr r;
+
+	off = (int64)page * sizeof entries[0];
+	len = n * sizeof entries[0];
+	while(len > 0) {
+		r = pread(pagemap_fd, entries, len, off);
+		if(r <= 0)
+			return false;
+		entries = (uint64*)((byte*)entries + r);
+		off += r;
+		len -= r;
+	}
+	return true;
+}
+
+static bool
+clearrefs(void)
+{
+	windowlen = 0;
+	return write(clearrefs_fd, "4", 1) == 1;
+}
+
+bool
+runtime_SysTrackWrites(void)
+{
+	uint64 e;
+
+	if(softdirty < 0)
+		return false;
+	if(softdirty == 0) {
+		softdirty = -1;
+		syspagesize = getpagesize();
+		clearrefs_fd = open("/proc/self/clear_refs", O_WRONLY|O_CLOEXEC);
+		pagemap_fd = open("/proc/self/pagemap", O_RDONLY|O_CLOEXEC);
+		if(clearrefs_fd < 0 || pagemap_fd < 0)
+			return false;
+		probe = runtime_SysAlloc(syspagesize, &mstats.other_sys);
+		if(probe == nil)
+			return false;
+		// Kernels without soft-dirty bits accept the write to
+		// clear_refs but never set bit 55.
+		*(volatile byte*)probe = 1;
+		if(!clearrefs() || !readpagemap((uintptr)probe/syspagesize, &e, 1) || (e & PagemapSoftDirty) != 0)
+			return false;
+		*(volatile byte*)probe = 2;
+		if(!readpagemap((uintptr)probe/syspagesize, &e, 1) || (e & PagemapSoftDirty) == 0)
+			return false;
+		softdirty = 1;
+	}
+	return clearrefs();
+}
+
+bool
+runtime_SysWritten(void *v, uintptr n)
+{
+	uintptr p, end;
+
+	if(n == 0)
+		return false;
+	p = (uintptr)v / syspagesize;
+	end = ((uintptr)v + n - 1) / syspagesize;
+	for(; p <= end; p++) {
+		if(p < window || p >= window + windowlen) {
+			window = p;
+			windowlen = PagemapWindow;
+			if(!readpagemap(window, windowbits, windowlen)) {
+				// Without the bits, assume the page was written.
+				windowlen = 0;
+				return true;
+			}
+		}
+		if(windowbits[p - window] & PagemapSoftDirty)
+			return true;
+	}
+	return false;
+}
+
+static uintptr
+readhex(const byte **pp)
+{
+	const byte *p;
+	uintptr n;
+
+	n = 0;
+	for(p = *pp;; p++) {
+		if(*p >= '0' && *p <= '9')
+			n = n*16 + (*p - '0');
+		else if(*p >= 'a' && *p <= 'f')
+			n = n*16 + (*p - 'a' + 10);
+		else
+			break;
+	}
+	*pp = p;
+	return n;
+}
+
+// The kernel reports huge pages per mapping in the AnonHugePages
+// lines of /proc/self/smaps.  A mapping starts with a line
+// "start-end perms ...", in lower case hex; the lines that
+// describe it start with an upper case field name.
+
+#define AnonHugePages "AnonHugePages:"
+
+uint64
+runtime_SysHugePageBytes(void *v, uintptr n)
+{
+	byte buf[512], line[128];
+	const byte *p;
+	uintptr start, end;
+	intptr r, i;
+	int32 fd, len;
+	uint64 total, kb;
+	bool in;
+
+	fd = open("/proc/self/smaps", O_RDONLY|O_CLOEXEC);
+	if(fd < 0)
+		return 0;
+	total = 0;
+	in = false;
+	len = 0;
+	while((r = read(fd, buf, sizeof buf)) > 0) {
+		for(i = 0; i < r; i++) {
+			if(buf[i] != '\n') {
+				if(len < (int32)sizeof line - 1)
+					line[len++] = buf[i];
+				continue;
+			}
+			line[len] = '\0';
+			len = 0;
+			p = line;
+			if((line[0] >= '0' && line[0] <= '9') || (line[0] >= 'a' && line[0] <= 'f')) {
+				start = readhex(&p);
+				if(*p++ != '-')
+					continue;
+				end = readhex(&p);
+				in = start < (uintptr)v + n && end > (uintptr)v;
+				continue;
+			}
+			if(!in || runtime_strncmp((const char*)line, AnonHugePages, sizeof AnonHugePages - 1) != 0)
+				continue;
+			for(p = line + sizeof AnonHugePages - 1; *p == ' '; p++)
+				;
+			for(kb = 0; *p >= '0' && *p <= '9'; p++)
+				kb = kb*10 + (*p - '0');
+			total += kb<<10;
+		}
+	}
+	close(fd);
+	return total;
+}
+
+#else
+
+bool
+runtime_SysTrackWrites(void)
+{
+	return false;
+}
+
+bool
+runtime_SysWritten(void *v, uintptr n)
+{
+	USED(v);
+	USED(n);
+	return true;
+}
+
+uint64
+runtime_SysHugePageBytes(void *v, uintptr n)
+{
+	USED(v);
+	USED(n);
+	return 0;
+}
+
+#endif
@@ -46,3 +46,33 @@ runtime_SysMap(void *v, uintptr n)
 	USED(v);
 	USED(n);
 }
+
+bool
+runtime_SysTrackWrites(void)
+{
+	return false;
+}
+
+bool
+runtime_SysWritten(void *v, uintptr n)
+{
+	USED(v);
+	USED(n);
+	return true;
+}
+
+bool
+runtime_SysHugePage(void *v, uintptr n)
+{
+	USED(v);
+	USED(n);
+	return false;
+}
+
+uint64
+runtime_SysHugePageBytes(void *v, uintptr n)
+{
+	USED(v);
+	USED(n);
+	return 0;
+}
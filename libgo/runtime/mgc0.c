@@ -58,6 +58,7 @@
 #include "mgc0.h"
 #include "chan.h"
 #include "go-type.h"
+#include "map.h"
 
 // Map gccgo field names to gc field names.
 // Slice aka __go_open_array.
@@ -95,6 +96,7 @@ enum {
 
 	handoffThreshold = 4,
 	IntermediateBufferCapacity = 64,
+	MarkQueueLen	= 32,	// power of 2
 
 	// Bits in type information
 	PRECISE = 1,
@@ -106,7 +108,19 @@ enum {
 	RootFinalizers	= 2,
 	RootSpanTypes	= 3,
 	RootFlushCaches = 4,
-	RootCount	= 5,
+	RootWritten	= 5,
+	RootCount	= 6,
+
+	// Buckets of the pause time histogram.
+	PauseHistLen	= 32,
+
+	// Stack map variables per goroutine that addstackroots handles.
+	MaxFrameVars	= 128,
+
+	// Under a memory limit the heap may still grow by 1/MinLimitGrowth
+	// between collections, so that a program living at the limit
+	// does not collect on every allocation.
+	MinLimitGrowth	= 16,
 };
 
 #define GcpercentUnknown (-2)
@@ -114,6 +128,22 @@ enum {
 // Initialized from $GOGC.  GOGC=off means no gc.
 static int32 gcpercent = GcpercentUnknown;
 
+// Initialized from $GOMEMLIMIT.  runtime_limitgoal is the heap size at
+// which the limit forces a collection; it is recomputed after each gc.
+uint64 runtime_softmemlimit = NoMemLimit;
+uint64 runtime_limitgoal = NoMemLimit;
+
+// The percentage next_gc is computed with.  With GOGC=off next_gc is
+// not a trigger, but it keeps the default ratio, so that it is right
+// when collection is turned back on.
+static int32
+nextgcpercent(void)
+{
+	if(gcpercent < 0)
+		return 100;
+	return gcpercent;
+}
+
 static FuncVal* poolcleanup;
 
 void sync_runtime_registerPoolCleanup(FuncVal*)
@@ -210,13 +240,31 @@ static Workbuf* getempty(Workbuf*);
 static Workbuf* getfull(Workbuf*);
 static void	putempty(Workbuf*);
 static Workbuf* handoff(Workbuf*);
+static void	putfull(Workbuf*);
+static Workbuf* popfull(void);
+static Workbuf* steal(void);
+static bool	haswork(void);
 static void	gchelperstart(void);
 static void	flushallmcaches(void);
 static void	addstackroots(G *gp, Workbuf **wbufp);
+static void	rescanwritten(Workbuf **wbufp);
+static void	greyblocks(Workbuf *wbuf);
+static void	clearmarkstats(void);
+static void	mapstats(void);
+
+// While the world runs during a concurrent mark, objects are allocated
+// marked and the heap bitmap is only changed with atomic operations.
+uint32	runtime_gcmarking;
+
+// pausehist[i] counts the times the world was stopped for a
+// collection for at least 2^i and less than 2^(i+1) microseconds.
+// pausehist[0] also counts shorter pauses.
+static uint64	pausehist[PauseHistLen];
 
 static struct {
 	uint64	full;  // lock-free list of full blocks
 	uint64	empty; // lock-free list of empty blocks
+	volatile uint32	nqueued; // full blocks in the helpers' deques
 	byte	pad0[CacheLineSize]; // prevents false-sharing between full/empty and nproc/nwait
 	uint32	nproc;
 	int64	tstart;
@@ -228,6 +276,11 @@ static struct {
 	Lock;
 	byte	*chunk;
 	uintptr	nchunk;
+
+	// State of a concurrent mark, see gcmarkstart.
+	bool	greyroots;	// markroot greys what the roots point to and stops
+	bool	rescan;		// markroot rescans objects written during the mark
+	uint64	nrescan;	// number of blocks rescanned
 } work __attribute__((aligned(8)));
 
 enum {
@@ -347,7 +400,7 @@ found:
 	// Only care about allocated and not marked.
 	if((bits & (bitAllocated|bitMarked)) != bitAllocated)
 		return false;
-	if(work.nproc == 1)
+	if(work.nproc == 1 && !runtime_gcmarking)
 		*bitp |= bitMarked<<shift;
 	else {
 		for(;;) {
@@ -403,6 +456,26 @@ struct BufferList
 };
 static BufferList bufferList[MaxGcproc];
 
+// Each GC helper keeps the full work buffers it produces in a deque of
+// its own, indexed by m->helpgc.  The helper pushes and pops at the
+// head, so it keeps scanning the most recently found objects, while an
+// idle helper steals the oldest buffer from the tail of another's
+// deque.  Buffers which do not fit go on the shared work.full list.
+typedef struct MarkQueue MarkQueue;
+struct MarkQueue
+{
+	Lock;
+	uint32	head;
+	uint32	tail;
+	Workbuf*	buf[MarkQueueLen];
+
+	// Statistics for gctrace.
+	uint64	nbytes;	// bytes scanned by this helper
+	uint64	nsteal;	// buffers it stole from other helpers
+	byte	pad[CacheLineSize];
+};
+static MarkQueue markqueue[MaxGcproc];
+
 static void enqueue(Obj obj, Workbuf **_wbuf, Obj **_wp, uintptr *_nobj);
 
 // flushptrbuf moves data from the PtrTarget buffer to the work buffer.
@@ -543,7 +616,7 @@ flushptrbuf(Scanbuf *sbuf)
 		// Only care about allocated and not marked.
 		if((bits & (bitAllocated|bitMarked)) != bitAllocated)
 			continue;
-		if(work.nproc == 1)
+		if(work.nproc == 1 && !runtime_gcmarking)
 			*bitp |= bitMarked<<shift;
 		else {
 			for(;;) {
@@ -574,7 +647,7 @@ flushptrbuf(Scanbuf *sbuf)
 	}
 
 	// If another proc wants a pointer, give it some.
-	if(work.nwait > 0 && nobj > handoffThreshold && work.full == 0) {
+	if(work.nwait > 0 && nobj > handoffThreshold && !haswork()) {
 		wbuf->nobj = nobj;
 		wbuf = handoff(wbuf);
 		nobj = wbuf->nobj;
@@ -632,7 +705,7 @@ flushobjbuf(Scanbuf *sbuf)
 	}
 
 	// If another proc wants a pointer, give it some.
-	if(work.nwait > 0 && nobj > handoffThreshold && work.full == 0) {
+	if(work.nwait > 0 && nobj > handoffThreshold && !haswork()) {
 		wbuf->nobj = nobj;
 		wbuf = handoff(wbuf);
 		nobj = wbuf->nobj;
@@ -739,6 +812,7 @@ scanblock(Workbuf *wbuf, bool keepworking)
 	Hchan *chan;
 	const ChanType *chantype;
 	Obj *wp;
+	MarkQueue *q;
 
 	if(sizeof(Workbuf) % WorkbufSize != 0)
 		runtime_throw("scanblock: size of Workbuf is suboptimal");
@@ -762,6 +836,7 @@ scanblock(Workbuf *wbuf, bool keepworking)
 
 	// Initialize sbuf
 	scanbuffers = &bufferList[runtime_m()->helpgc];
+	q = &markqueue[runtime_m()->helpgc];
 
 	sbuf.ptr.begin = sbuf.ptr.pos = &scanbuffers->ptrtarget[0];
 	sbuf.ptr.end = sbuf.ptr.begin + nelem(scanbuffers->ptrtarget);
@@ -784,6 +859,7 @@ scanblock(Workbuf *wbuf, bool keepworking)
 		// Each iteration scans the block b of length n, queueing pointers in
 		// the work buffer.
 
+		q->nbytes += n;
 		if(CollectStats) {
 			runtime_xadd64(&gcstats.nbytes, n);
 			runtime_xadd64(&gcstats.obj.sum, sbuf.nobj);
@@ -816,7 +892,10 @@ scanblock(Workbuf *wbuf, bool keepworking)
 					runtime_throw("invalid gc type info");
 				}
 			}
-		} else if(UseSpanType) {
+		} else if(UseSpanType && !runtime_gcmarking) {
+			// While the world runs, the span types and the
+			// values in an object may change as we read them,
+			// so a concurrent mark scans conservatively.
 			if(CollectStats)
 				runtime_xadd64(&gcstats.obj.notype, 1);
 
@@ -1219,7 +1298,7 @@ enqueue(Obj obj, Workbuf **_wbuf, Obj **_wp, uintptr *_nobj)
 	nobj = *_nobj;
 
 	// If another proc wants a pointer, give it some.
-	if(work.nwait > 0 && nobj > handoffThreshold && work.full == 0) {
+	if(work.nwait > 0 && nobj > handoffThreshold && !haswork()) {
 		wbuf->nobj = nobj;
 		wbuf = handoff(wbuf);
 		nobj = wbuf->nobj;
@@ -1350,6 +1429,11 @@ markroot(ParFor *desc, uint32 i)
 		flushallmcaches();
 		break;
 
+	case RootWritten:
+		if(work.rescan)
+			rescanwritten(&wbuf);
+		break;
+
 	default:
 		// the rest is scanning goroutine stacks
 		if(i - RootCount >= runtime_allglen)
@@ -1364,8 +1448,109 @@ markroot(ParFor *desc, uint32 i)
 		
 	}
 
-	if(wbuf)
-		scanblock(wbuf, false);
+	if(wbuf) {
+		if(work.greyroots)
+			greyblocks(wbuf);
+		else
+			scanblock(wbuf, false);
+	}
+}
+
+// Grey the objects which the blocks in wbuf point to, and leave them
+// on work.full for the concurrent mark.  The blocks are scanned
+// conservatively.
+static void
+greyblocks(Workbuf *wbuf)
+{
+	Scanbuf sbuf;
+	BufferList *scanbuffers;
+	Obj *o;
+	uintptr p, end;
+	byte *obj, *arena_start, *arena_used;
+
+	arena_start = runtime_mheap.arena_start;
+	arena_used = runtime_mheap.arena_used;
+
+	scanbuffers = &bufferList[runtime_m()->helpgc];
+	sbuf.ptr.begin = sbuf.ptr.pos = &scanbuffers->ptrtarget[0];
+	sbuf.ptr.end = sbuf.ptr.begin + nelem(scanbuffers->ptrtarget);
+	sbuf.wbuf = nil;
+	sbuf.wp = nil;
+	sbuf.nobj = 0;
+
+	for(o = wbuf->obj; o < wbuf->obj + wbuf->nobj; o++) {
+		p = ((uintptr)o->p + PtrSize - 1) & ~((uintptr)PtrSize - 1);
+		end = ((uintptr)o->p + o->n) & ~((uintptr)PtrSize - 1);
+		for(; p < end; p += PtrSize) {
+			obj = *(byte**)p;
+			if(obj >= arena_start && obj < arena_used) {
+				*sbuf.ptr.pos++ = (PtrTarget){obj, 0};
+				if(sbuf.ptr.pos == sbuf.ptr.end)
+					flushptrbuf(&sbuf);
+			}
+		}
+	}
+	flushptrbuf(&sbuf);
+	putempty(wbuf);
+
+	sbuf.wbuf->nobj = sbuf.nobj;
+	if(sbuf.nobj == 0)
+		putempty(sbuf.wbuf);
+	else
+		runtime_lfstackpush(&work.full, &sbuf.wbuf->node);
+}
+
+// Queue the parts of marked objects that were written while the world
+// ran during a concurrent mark, so that the pointers stored in them are
+// found.  Small objects are queued whole.  Large objects are queued a
+// page at a time and scanned conservatively, since their type does not
+// describe a piece from the middle.
+static void
+rescanwritten(Workbuf **wbufp)
+{
+	MSpan *s;
+	byte *p, *end, *obj, *arena_start, *arena_used;
+	uintptr *bitp, off, shift, size, n, bits;
+
+	arena_start = runtime_mheap.arena_start;
+	arena_used = runtime_mheap.arena_used;
+	for(p = arena_start; p < arena_used; p = end) {
+		s = runtime_mheap.spans[(p - arena_start) >> PageShift];
+		if(s == nil || (byte*)(s->start << PageShift) != p) {
+			end = p + PageSize;
+			continue;
+		}
+		end = p + (s->npages << PageShift);
+		if(s->state != MSpanInUse || !runtime_SysWritten(p, end - p))
+			continue;
+		size = s->elemsize;
+		if(size == 0)
+			continue;
+		for(obj = p; obj + size <= end; obj += size) {
+			off = (uintptr*)obj - (uintptr*)arena_start;
+			bitp = (uintptr*)arena_start - off/wordsPerBitmapWord - 1;
+			shift = off % wordsPerBitmapWord;
+			bits = *bitp >> shift;
+			if((bits & (bitAllocated|bitMarked|bitScan)) != (bitAllocated|bitMarked|bitScan))
+				continue;
+			if(s->sizeclass != 0) {
+				if(runtime_SysWritten(obj, size)) {
+					enqueue1(wbufp, (Obj){obj, size, 0});
+					work.nrescan++;
+				}
+				continue;
+			}
+			for(off = 0; off < size; off += n) {
+				n = PageSize;
+				if(n > size - off)
+					n = size - off;
+				if(runtime_SysWritten(obj + off, n)) {
+					enqueue1(wbufp, (Obj){obj + off, n, (uintptr)defaultProg});
+					work.nrescan++;
+				}
+			}
+		}
+	}
 }
 
 // Get an empty work buffer off the work.empty list,
@@ -1374,7 +1559,7 @@ static Workbuf*
 getempty(Workbuf *b)
 {
 	if(b != nil)
-		runtime_lfstackpush(&work.full, &b->node);
+		putfull(b);
 	b = (Workbuf*)runtime_lfstackpop(&work.empty);
 	if(b == nil) {
 		// Need to allocate.
@@ -1403,7 +1588,97 @@ putempty(Workbuf *b)
 	runtime_lfstackpush(&work.empty, &b->node);
 }
 
-// Get a full work buffer off the work.full list, or return nil.
+// Put a full work buffer on the head of this helper's deque, or on
+// work.full if the deque is full.
+static void
+putfull(Workbuf *b)
+{
+	MarkQueue *q;
+
+	q = &markqueue[runtime_m()->helpgc];
+	runtime_lock(q);
+	if(q->head - q->tail < MarkQueueLen) {
+		q->buf[q->head++ % MarkQueueLen] = b;
+		runtime_unlock(q);
+		runtime_xadd(&work.nqueued, +1);
+		return;
+	}
+	runtime_unlock(q);
+	runtime_lfstackpush(&work.full, &b->node);
+}
+
+// Take a full work buffer off the head of this helper's deque,
+// or off work.full, or return nil.
+static Workbuf*
+popfull(void)
+{
+	MarkQueue *q;
+	Workbuf *b;
+
+	q = &markqueue[runtime_m()->helpgc];
+	if(q->head != q->tail) {
+		runtime_lock(q);
+		if(q->head != q->tail) {
+			b = q->buf[--q->head % MarkQueueLen];
+			runtime_unlock(q);
+			runtime_xadd(&work.nqueued, -1);
+			return b;
+		}
+		runtime_unlock(q);
+	}
+	return (Workbuf*)runtime_lfstackpop(&work.full);
+}
+
+// Steal the oldest full work buffer of another helper, or return nil.
+// The victims are tried in turn from a random one on.
+static Workbuf*
+steal(void)
+{
+	MarkQueue *q;
+	Workbuf *b;
+	uint32 i, self, start, v;
+
+	self = runtime_m()->helpgc;
+	start = runtime_fastrand1();
+	for(i = 0; i < work.nproc; i++) {
+		v = (start + i) % work.nproc;
+		if(v == self)
+			continue;
+		q = &markqueue[v];
+		if(q->head == q->tail)
+			continue;
+		runtime_lock(q);
+		if(q->head != q->tail) {
+			b = q->buf[q->tail++ % MarkQueueLen];
+			runtime_unlock(q);
+			runtime_xadd(&work.nqueued, -1);
+			markqueue[self].nsteal++;
+			return b;
+		}
+		runtime_unlock(q);
+	}
+	return nil;
+}
+
+// Report whether any full work buffer is waiting, on work.full or in
+// any helper's deque.  The deques are counted in work.nqueued, so that
+// enqueue does not have to look at every helper's deque while another
+// waits.  The answer may be out of date by the time the caller looks
+// at it.
+static bool
+haswork(void)
+{
+	return work.full != 0 || work.nqueued != 0;
+}
+
+// Get a full work buffer: this helper's own newest one, a shared one,
+// or one stolen from another helper.  Return nil once no helper has any
+// work left.
+//
+// A helper counts itself in work.nwait only while it holds no work and
+// its own deque is empty.  Since only the owner pushes onto a deque,
+// once every helper is waiting no more work can appear, and the mark
+// is done.
 static Workbuf*
 getfull(Workbuf *b)
 {
@@ -1415,16 +1690,21 @@ getfull(Workbuf *b)
 
 	if(b != nil)
 		runtime_lfstackpush(&work.empty, &b->node);
-	b = (Workbuf*)runtime_lfstackpop(&work.full);
+	b = popfull();
 	if(b != nil || work.nproc == 1)
 		return b;
+	b = steal();
+	if(b != nil)
+		return b;
 
 	m = runtime_m();
 	runtime_xadd(&work.nwait, +1);
 	for(i=0;; i++) {
-		if(work.full != 0) {
+		if(haswork()) {
 			runtime_xadd(&work.nwait, -1);
 			b = (Workbuf*)runtime_lfstackpop(&work.full);
+			if(b == nil)
+				b = steal();
 			if(b != nil)
 				return b;
 			runtime_xadd(&work.nwait, +1);
@@ -1462,14 +1742,82 @@ handoff(Workbuf *b)
 	m->gcstats.nhandoff++;
 	m->gcstats.nhandoffcnt += n;
 
-	// Put b on full list - let first half of b get stolen.
-	runtime_lfstackpush(&work.full, &b->node);
+	// Put b on our deque - let first half of b get stolen.
+	putfull(b);
 	return b1;
 }
 
+// A variable described by a stack map.
+typedef struct FrameVar FrameVar;
+struct FrameVar
+{
+	byte*	p;
+	const Type*	t;
+};
+
+// Collect the variables in the stack maps of gp, sorted by address.
+// Variables beyond the first max are left out, and are scanned
+// conservatively with the rest of the stack.
+static uintptr
+framevars(G *gp, FrameVar *v, uintptr max)
+{
+	FrameMap *sm;
+	FrameVar x;
+	uintptr i, j, n;
+
+	n = 0;
+	for(sm = gp->framemap; sm != nil; sm = sm->next) {
+		for(i = 0; i < sm->n && n < max; i++) {
+			if(sm->vars[i].addr == nil)
+				continue;
+			x.p = sm->vars[i].addr;
+			x.t = sm->vars[i].type;
+			for(j = n; j > 0 && v[j-1].p > x.p; j--)
+				v[j] = v[j-1];
+			v[j] = x;
+			n++;
+		}
+	}
+	return n;
+}
+
+// Enqueue the stack block [b, b+n).  The variables in v which lie
+// within it are scanned using their type, or skipped if they hold no
+// pointers; the rest of the block is scanned conservatively.
+static void
+addstackblock(Workbuf **wbufp, byte *b, uintptr n, FrameVar *v, uintptr nv)
+{
+	byte *e, *vb, *ve;
+	uintptr i;
+
+	e = b + n;
+	for(i = 0; i < nv; i++) {
+		vb = v[i].p;
+		ve = vb + v[i].t->__size;
+		if(vb < b || ve > e)
+			continue;
+		if(!(v[i].t->__code & KindNoPointers))
+			enqueue1(wbufp, (Obj){vb, v[i].t->__size, (uintptr)v[i].t->__gc | PRECISE});
+		// Only the words wholly inside the variable can be left
+		// out of the conservative scan.
+		vb = (byte*)ROUND((uintptr)vb, PtrSize);
+		ve = (byte*)((uintptr)ve & ~(uintptr)(PtrSize-1));
+		if(vb >= ve)
+			continue;
+		if(vb > b)
+			enqueue1(wbufp, (Obj){b, vb - b, 0});
+		b = ve;
+	}
+	if(e > b)
+		enqueue1(wbufp, (Obj){b, e - b, 0});
+}
+
 static void
 addstackroots(G *gp, Workbuf **wbufp)
 {
+	FrameVar vars[MaxFrameVars];
+	uintptr nvars;
+
 	switch(gp->status){
 	default:
 		runtime_printf("unexpected G.status %d (goroutine %p %D)\n", gp->status, gp, gp->goid);
@@ -1484,6 +1832,8 @@ addstackroots(G *gp, Workbuf **wbufp)
 		break;
 	}
 
+	nvars = framevars(gp, vars, nelem(vars));
+
 #ifdef USING_SPLIT_STACK
 	M *mp;
 	void* sp;
@@ -1521,11 +1871,11 @@ addstackroots(G *gp, Workbuf **wbufp)
 		}
 	}
 	if(sp != nil) {
-		enqueue1(wbufp, (Obj){sp, spsize, 0});
+		addstackblock(wbufp, sp, spsize, vars, nvars);
 		while((sp = __splitstack_find(next_segment, next_sp,
 					      &spsize, &next_segment,
 					      &next_sp, &initial_sp)) != nil)
-			enqueue1(wbufp, (Obj){sp, spsize, 0});
+			addstackblock(wbufp, sp, spsize, vars, nvars);
 	}
 #else
 	M *mp;
@@ -1547,9 +1897,9 @@ addstackroots(G *gp, Workbuf **wbufp)
 	}
 	top = (byte*)gp->gcinitial_sp + gp->gcstack_size;
 	if(top > bottom)
-		enqueue1(wbufp, (Obj){bottom, top - bottom, 0});
+		addstackblock(wbufp, bottom, top - bottom, vars, nvars);
 	else
-		enqueue1(wbufp, (Obj){top, bottom - top, 0});
+		addstackblock(wbufp, top, bottom - top, vars, nvars);
 #endif
 }
 
@@ -1759,7 +2109,7 @@ runtime_MSpan_Sweep(MSpan *s)
 				runtime_MHeap_Free(&runtime_mheap, s, 1);
 			c->local_nlargefree++;
 			c->local_largefree += size;
-			runtime_xadd64(&mstats.next_gc, -(uint64)(size * (gcpercent + 100)/100));
+			runtime_xadd64(&mstats.next_gc, -(uint64)(size * (nextgcpercent() + 100)/100));
 			res = true;
 		} else {
 			// Free small object.
@@ -1801,7 +2151,7 @@ runtime_MSpan_Sweep(MSpan *s)
 	if(nfree > 0) {
 		c->local_nsmallfree[cl] += nfree;
 		c->local_cachealloc -= nfree * size;
-		runtime_xadd64(&mstats.next_gc, -(uint64)(nfree * size * (gcpercent + 100)/100));
+		runtime_xadd64(&mstats.next_gc, -(uint64)(nfree * size * (nextgcpercent() + 100)/100));
 		res = runtime_MCentral_FreeSpan(&runtime_mheap.central[cl], s, nfree, head.next, end);
 		//MCentral_FreeSpan updates sweepgen
 	}
@@ -1830,6 +2180,10 @@ bgsweep(void* dummy __attribute__ ((unused)))
 			gcstats.nbgsweep++;
 			runtime_gosched();
 		}
+		// Sweeping freed what it could; if the program is still
+		// above its memory limit, give idle spans back now rather
+		// than at the next scavenger tick.
+		runtime_MHeap_ReleaseOverLimit(&runtime_mheap);
 		runtime_lock(&gclock);
 		if(!runtime_mheap.sweepdone) {
 			// It's possible if GC has happened between sweepone has
@@ -2093,11 +2447,17 @@ runtime_updatememstats(GCStats *stats)
 struct gc_args
 {
 	int64 start_time; // start time of GC in ns (just before stoptheworld)
+	int64 stop_time;  // time in ns when the world was stopped
 	bool  eagersweep;
+	bool  concurrent; // marked concurrently before start_time
+	int64 mark_pause; // ns the world was stopped to start the mark
+	int64 mark_time;  // ns the concurrent mark ran
 };
 
 static void gc(struct gc_args *args);
 static void mgc(G *gp);
+static void mgcmarkstart(G *gp);
+static void gcpause(int64 ns);
 
 static int32
 readgogc(void)
@@ -2112,6 +2472,83 @@ readgogc(void)
 	return runtime_atoi(p);
 }
 
+// Parses $GOMEMLIMIT: a byte count with an optional B, KiB, MiB, GiB
+// or TiB suffix, or "off".
+static uint64
+readmemlimit(void)
+{
+	const byte *p, *q;
+	uint64 n, unit;
+
+	p = runtime_getenv("GOMEMLIMIT");
+	if(p == nil || p[0] == '\0')
+		return NoMemLimit;
+	if(runtime_strcmp((const char *)p, "off") == 0)
+		return NoMemLimit;
+	n = 0;
+	for(q = p; *q >= '0' && *q <= '9'; q++) {
+		if(n > (NoMemLimit - (*q - '0'))/10)
+			goto bad;
+		n = n*10 + (*q - '0');
+	}
+	unit = 1;
+	if(q == p)
+		goto bad;
+	if(*q != '\0' && runtime_strcmp((const char *)q, "B") != 0) {
+		if(q[1] != 'i' || q[2] != 'B' || q[3] != '\0')
+			goto bad;
+		switch(q[0]) {
+		case 'K': unit = 1ULL<<10; break;
+		case 'M': unit = 1ULL<<20; break;
+		case 'G': unit = 1ULL<<30; break;
+		case 'T': unit = 1ULL<<40; break;
+		default: goto bad;
+		}
+	}
+	if(n > NoMemLimit/unit)
+		return NoMemLimit;
+	return n*unit;
+
+bad:
+	runtime_printf("runtime: ignoring malformed GOMEMLIMIT=%s\n", p);
+	return NoMemLimit;
+}
+
+// Reads $GOGC and $GOMEMLIMIT the first time through.
+// Called with the heap locked.
+static void
+readgcenv(void)
+{
+	if(gcpercent == GcpercentUnknown) {
+		gcpercent = readgogc();
+		runtime_softmemlimit = readmemlimit();
+	}
+}
+
+// Computes the heap size at which the memory limit forces the next gc:
+// the limit less what the runtime holds outside the heap.
+// Called after cachestats, with the world stopped or the heap locked.
+static void
+setlimitgoal(void)
+{
+	uint64 other, goal, floor;
+
+	if(runtime_softmemlimit == NoMemLimit) {
+		runtime_limitgoal = NoMemLimit;
+		return;
+	}
+	other = runtime_mappedmem() - (mstats.heap_sys - mstats.heap_released);
+	if(mstats.heap_inuse > mstats.heap_alloc)
+		other += mstats.heap_inuse - mstats.heap_alloc;
+	goal = 0;
+	if(runtime_softmemlimit > other)
+		goal = runtime_softmemlimit - other;
+	floor = mstats.heap_alloc + mstats.heap_alloc/MinLimitGrowth;
+	if(goal < floor)
+		goal = floor;
+	runtime_limitgoal = goal;
+}
+
 // force = 1 - do GC regardless of current heap usage
 // force = 2 - go GC and eager sweep
 void
@@ -2148,15 +2585,18 @@ runtime_gc(int32 force)
 
 	if(gcpercent == GcpercentUnknown) {	// first time through
 		runtime_lock(&runtime_mheap);
-		if(gcpercent == GcpercentUnknown)
-			gcpercent = readgogc();
+		readgcenv();
+		setlimitgoal();
 		runtime_unlock(&runtime_mheap);
 	}
-	if(gcpercent < 0)
+	if(gcpercent < 0 && runtime_softmemlimit == NoMemLimit)
+		return;
+	// With GOGC=off only the memory limit starts a collection.
+	if(force==0 && gcpercent < 0 && mstats.heap_alloc < runtime_limitgoal)
 		return;
 
 	runtime_semacquire(&runtime_worldsema, false);
-	if(force==0 && mstats.heap_alloc < mstats.next_gc) {
+	if(force==0 && (gcpercent < 0 || mstats.heap_alloc < mstats.next_gc) && mstats.heap_alloc < runtime_limitgoal) {
 		// typically threads which lost the race to grab
 		// worldsema exit here when gc is done.
 		runtime_semrelease(&runtime_worldsema);
@@ -2166,19 +2606,60 @@ runtime_gc(int32 force)
 	// Ok, we're doing it!  Stop everybody else
 	a.start_time = runtime_nanotime();
 	a.eagersweep = force >= 2;
+	a.concurrent = false;
+	a.mark_pause = 0;
+	a.mark_time = 0;
 	m->gcing = 1;
 	runtime_stoptheworld();
+	a.stop_time = runtime_nanotime();
 	
 	clearpools();
 
+	if(runtime_debug.gcconcurrent && !a.eagersweep) {
+		// Grey the objects the roots point to, then let the
+		// world run while we mark from them.
+		g = runtime_g();
+		g->param = &a;
+		g->status = Gwaiting;
+		g->waitreason = "garbage collection";
+		runtime_mcall(mgcmarkstart);
+		m = runtime_m();
+	}
+	if(a.concurrent) {
+		a.mark_pause = runtime_nanotime() - a.start_time;
+		gcpause(a.mark_pause);
+		m->gcing = 0;
+		m->locks++;
+		runtime_starttheworld();
+		m->locks--;
+
+		// The mark does not need a P, so give it to another
+		// thread to run goroutines.
+		a.mark_time = runtime_nanotime();
+		runtime_entersyscallblock();
+		scanblock(nil, true);
+		runtime_exitsyscall();
+		a.mark_time = runtime_nanotime() - a.mark_time;
+
+		// Stop the world again to finish.
+		a.start_time = runtime_nanotime();
+		m = runtime_m();
+		m->gcing = 1;
+		runtime_stoptheworld();
+		a.stop_time = runtime_nanotime();
+	}
+
 	// Run gc on the g0 stack.  We do this so that the g stack
 	// we're currently running on will no longer change.  Cuts
 	// the root set down a bit (g0 stacks are not scanned, and
 	// we don't need to scan gc's internal state).  Also an
 	// enabler for copyable stacks.
 	for(i = 0; i < (runtime_debug.gctrace > 1 ? 2 : 1); i++) {
-		if(i > 0)
-			a.start_time = runtime_nanotime();
+		if(i > 0) {
+			a.start_time = a.stop_time = runtime_nanotime();
+			a.concurrent = false;
+			a.mark_pause = 0;
+		}
 		// switch to g0, call gc(&a), then switch back
 		g = runtime_g();
 		g->param = &a;
@@ -2205,6 +2686,46 @@ runtime_gc(int32 force)
 	}
 }
 
+// Count the memory of the tables of the maps the mark found live, and
+// drop the others from the list of maps.  Called with the world
+// stopped, after the mark and before the sweep.
+static void
+mapstats(void)
+{
+	uintptr *link, off, shift, *bitp, slots, size;
+	Hmap *h;
+	uint64 inuse, unused;
+
+	inuse = 0;
+	unused = 0;
+	link = &__go_map_list;
+	while(*link != 0) {
+		h = (Hmap*)~*link;
+		off = (uintptr*)h - (uintptr*)runtime_mheap.arena_start;
+		bitp = (uintptr*)runtime_mheap.arena_start - off/wordsPerBitmapWord - 1;
+		shift = off % wordsPerBitmapWord;
+		if((*bitp & (bitMarked<<shift)) == 0) {
+			*link = h->__gc_next;
+			continue;
+		}
+		slots = 0;
+		size = h->__descriptor->__entry_size;
+		if(h->__table != nil) {
+			slots += h->__table->__group_count * GO_MAP_GROUP_SIZE;
+			inuse += __go_map_table_size(h->__table->__group_count, size);
+		}
+		if(h->__old_table != nil) {
+			slots += h->__old_table->__group_count * GO_MAP_GROUP_SIZE;
+			inuse += __go_map_table_size(h->__old_table->__group_count, size);
+		}
+		if(slots > h->__element_count)
+			unused += (slots - h->__element_count) * size;
+		link = &h->__gc_next;
+	}
+	mstats.map_table_inuse = inuse;
+	mstats.map_table_unused = unused;
+}
+
 static void
 mgc(G *gp)
 {
@@ -2214,6 +2735,77 @@ mgc(G *gp)
 	runtime_gogo(gp);
 }
 
+// Start a concurrent mark with the world stopped: finish sweeping,
+// start tracking writes to memory, and grey the objects the roots
+// point to.
+//
+// Nothing stops the goroutines from changing the heap while it is
+// marked, so the collection stops the world again to finish.  Then it
+// scans the roots again, and the marked objects on the pages which
+// were written in the meantime, before it marks anything left.  Objects
+// allocated in the meantime are allocated marked.
+//
+// If the system cannot track writes, args->concurrent is left false
+// and the collection marks with the world stopped.
+static void
+gcmarkstart(struct gc_args *args)
+{
+	uint32 i;
+
+	while(runtime_sweepone() != (uintptr)-1)
+		gcstats.npausesweep++;
+	if(!runtime_SysTrackWrites())
+		return;
+
+	work.tstart = args->start_time;
+	work.nproc = 1;
+	work.nwait = 0;
+	work.ndone = 0;
+	work.nrescan = 0;
+	clearmarkstats();
+	work.greyroots = true;
+	for(i = 0; i < RootCount + runtime_allglen; i++)
+		markroot(nil, i);
+	work.greyroots = false;
+
+	runtime_gcmarking = 1;
+	args->concurrent = true;
+}
+
+// Reset the per-helper statistics which gctrace prints.
+static void
+clearmarkstats(void)
+{
+	uint32 i;
+
+	for(i=0; i<MaxGcproc; i++) {
+		markqueue[i].nbytes = 0;
+		markqueue[i].nsteal = 0;
+	}
+}
+
+static void
+mgcmarkstart(G *gp)
+{
+	gcmarkstart(gp->param);
+	gp->param = nil;
+	gp->status = Grunning;
+	runtime_gogo(gp);
+}
+
+// Record a time the world was stopped in pausehist.
+static void
+gcpause(int64 ns)
+{
+	int64 us;
+	uint32 i;
+
+	us = ns/1000;
+	for(i = 0; i < PauseHistLen - 1 && us >= (2LL << i); i++)
+		;
+	pausehist[i]++;
+}
+
 static void
 gc(struct gc_args *args)
 {
@@ -2233,6 +2825,14 @@ gc(struct gc_args *args)
 	t0 = args->start_time;
 	work.tstart = args->start_time; 
 
+	// After a concurrent mark, also rescan what the goroutines wrote
+	// while it ran.  The world is stopped, so the bitmap can be
+	// changed without atomic operations again.
+	runtime_gcmarking = 0;
+	work.rescan = args->concurrent;
+	if(!args->concurrent)
+		clearmarkstats();
+
 	if(CollectStats)
 		runtime_memclr((byte*)&gcstats, sizeof(gcstats));
 
@@ -2273,20 +2873,24 @@ gc(struct gc_args *args)
 	bufferList[m->helpgc].busy = 0;
 	if(work.nproc > 1)
 		runtime_notesleep(&work.alldone);
+	work.rescan = false;
 
+	mapstats();
 	cachestats();
 	// next_gc calculation is tricky with concurrent sweep since we don't know size of live heap
 	// estimate what was live heap size after previous GC (for tracing only)
-	heap0 = mstats.next_gc*100/(gcpercent+100);
 	// conservatively set next_gc to high value assuming that everything is live
 	// concurrent/lazy sweep will reduce this number while discovering new garbage
-	mstats.next_gc = mstats.heap_alloc+mstats.heap_alloc*gcpercent/100;
+	heap0 = mstats.next_gc*100/(nextgcpercent()+100);
+	mstats.next_gc = mstats.heap_alloc+mstats.heap_alloc*nextgcpercent()/100;
+	setlimitgoal();
 
 	t4 = runtime_nanotime();
 	mstats.last_gc = runtime_unixnanotime();  // must be Unix time to make sense to user
-	mstats.pause_ns[mstats.numgc%nelem(mstats.pause_ns)] = t4 - t0;
-	mstats.pause_total_ns += t4 - t0;
+	mstats.pause_ns[mstats.numgc%nelem(mstats.pause_ns)] = t4 - t0 + args->mark_pause;
+	mstats.pause_total_ns += t4 - t0 + args->mark_pause;
 	mstats.numgc++;
+	gcpause(t4 - t0);
 	if(mstats.debuggc)
 		runtime_printf("pause %D\n", t4-t0);
 
@@ -2303,16 +2907,29 @@ gc(struct gc_args *args)
 		stats.nosyield += work.markfor->nosyield;
 		stats.nsleep += work.markfor->nsleep;
 
-		runtime_printf("gc%d(%d): %D+%D+%D+%D us, %D -> %D MB, %D (%D-%D) objects,"
+		runtime_printf("gc%d(%d): %D+%D+%D+%D us (stop %D us), %D -> %D MB, %D (%D-%D) objects,"
 				" %d/%d/%d sweeps,"
 				" %D(%D) handoff, %D(%D) steal, %D/%D/%D yields\n",
 			mstats.numgc, work.nproc, (t1-t0)/1000, (t2-t1)/1000, (t3-t2)/1000, (t4-t3)/1000,
+			(args->stop_time-args->start_time)/1000,
 			heap0>>20, heap1>>20, obj,
 			mstats.nmalloc, mstats.nfree,
 			sweep.nspan, gcstats.nbgsweep, gcstats.npausesweep,
 			stats.nhandoff, stats.nhandoffcnt,
 			work.markfor->nsteal, work.markfor->nstealcnt,
 			stats.nprocyield, stats.nosyield, stats.nsleep);
+		if(args->concurrent)
+			runtime_printf("gc%d: concurrent mark %D us after a %D us pause, %D blocks rescanned\n",
+				mstats.numgc, args->mark_time/1000, args->mark_pause/1000, work.nrescan);
+		if(work.nproc > 1) {
+			runtime_printf("gc%d: helpers scanned", mstats.numgc);
+			for(i=0; i<work.nproc; i++)
+				runtime_printf(" %D", markqueue[i].nbytes>>10);
+			runtime_printf(" KB, stole");
+			for(i=0; i<work.nproc; i++)
+				runtime_printf(" %D", markqueue[i].nsteal);
+			runtime_printf(" buffers\n");
+		}
 		gcstats.nbgsweep = gcstats.npausesweep = 0;
 		if(CollectStats) {
 			runtime_printf("scan: %D bytes, %D objects, %D untyped, %D types from MSpan\n",
@@ -2442,13 +3059,33 @@ runtime_debug_readGCStats(Slice *pauses)
 	pauses->__count = n+3;
 }
 
+void runtime_debug_readGCPauseHistogram(Slice*)
+  __asm__("runtime_debug.readGCPauseHistogram");
+
+void
+runtime_debug_readGCPauseHistogram(Slice *hist)
+{
+	uint64 *p;
+	uint32 i;
+
+	// Calling code in runtime/debug should make the slice large enough.
+	if((size_t)hist->cap < nelem(pausehist))
+		runtime_throw("runtime: short slice passed to readGCPauseHistogram");
+
+	p = (uint64*)hist->array;
+	runtime_lock(&runtime_mheap);
+	for(i=0; i<nelem(pausehist); i++)
+		p[i] = pausehist[i];
+	runtime_unlock(&runtime_mheap);
+	hist->__count = nelem(pausehist);
+}
+
 int32
 runtime_setgcpercent(int32 in) {
 	int32 out;
 
 	runtime_lock(&runtime_mheap);
-	if(gcpercent == GcpercentUnknown)
-		gcpercent = readgogc();
+	readgcenv();
 	out = gcpercent;
 	if(in < 0)
 		in = -1;
@@ -2457,6 +3094,28 @@ runtime_setgcpercent(int32 in) {
 	return out;
 }
 
+int64
+runtime_setmemlimit(int64 in)
+{
+	int64 out;
+
+	runtime_lock(&runtime_mheap);
+	readgcenv();
+	out = runtime_softmemlimit;
+	if(runtime_softmemlimit == NoMemLimit)
+		out = 0x7fffffffffffffffLL;
+	if(in >= 0) {
+		if(in == 0x7fffffffffffffffLL)
+			runtime_softmemlimit = NoMemLimit;
+		else
+			runtime_softmemlimit = in;
+		setlimitgoal();
+	}
+	runtime_unlock(&runtime_mheap);
+	runtime_MHeap_ReleaseOverLimit(&runtime_mheap);
+	return out;
+}
+
 static void
 gchelperstart(void)
 {
@@ -2611,11 +3270,39 @@ runtime_markscan(void *v)
 	*b |= bitScan<<shift;
 }
 
+// Set the bits of a block at v which was allocated while the world runs
+// during a concurrent mark.  The block is marked, so that this
+// collection does not free it.  The mark may be setting bits in the
+// same bitmap word, so the bits are changed atomically.
+void
+runtime_markallocated(void *v, uint32 flag)
+{
+	uintptr *b, off, shift, set, clear, x;
+
+	off = (uintptr*)v - (uintptr*)runtime_mheap.arena_start;  // word offset
+	b = (uintptr*)runtime_mheap.arena_start - off/wordsPerBitmapWord - 1;
+	shift = off % wordsPerBitmapWord;
+	if(flag & FlagNoGC) {
+		clear = bitAllocated<<shift;
+		set = bitBlockBoundary<<shift;
+	} else {
+		clear = 0;
+		set = bitMarked<<shift;
+		if(!(flag & FlagNoScan))
+			set |= bitScan<<shift;
+	}
+	for(;;) {
+		x = *b;
+		if(runtime_casp((void**)b, (void*)x, (void*)((x & ~clear) | set)))
+			break;
+	}
+}
+
 // mark the block at v as freed.
 void
 runtime_markfreed(void *v)
 {
-	uintptr *b, off, shift;
+	uintptr *b, off, shift, x;
 
 	if(0)
 		runtime_printf("markfreed %p\n", v);
@@ -2626,7 +3313,15 @@ runtime_markfreed(void *v)
 	off = (uintptr*)v - (uintptr*)runtime_mheap.arena_start;  // word offset
 	b = (uintptr*)runtime_mheap.arena_start - off/wordsPerBitmapWord - 1;
 	shift = off % wordsPerBitmapWord;
-	*b = (*b & ~(bitMask<<shift)) | (bitAllocated<<shift);
+	if(!runtime_gcmarking) {
+		*b = (*b & ~(bitMask<<shift)) | (bitAllocated<<shift);
+		return;
+	}
+	for(;;) {
+		x = *b;
+		if(runtime_casp((void**)b, (void*)x, (void*)((x & ~(bitMask<<shift)) | (bitAllocated<<shift))))
+			break;
+	}
 }
 
 // check that the block at v of size n is marked freed.
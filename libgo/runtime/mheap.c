@@ -21,6 +21,15 @@ static bool MHeap_Grow(MHeap*, uintptr);
 static void MHeap_FreeLocked(MHeap*, MSpan*);
 static MSpan *MHeap_AllocLarge(MHeap*, uintptr);
 static MSpan *BestFit(MSpan*, uintptr, MSpan*);
+static uintptr scavengeall(MHeap*, uint64, uint64, bool);
+
+enum
+{
+	// When the heap uses huge pages, a span that has been idle for
+	// this many times the scavenger limit is released at OS page
+	// granularity, even if that splits a huge page.
+	HugeIdleFactor = 4,
+};
 
 static void
 RecordSpan(void *vh, byte *p)
@@ -300,6 +309,39 @@ BestFit(MSpan *list, uintptr npage, MSpan *best)
 	return best;
 }
 
+// Return the memory which the process has mapped and not released
+// to the operating system.  This is what the soft memory limit bounds.
+uint64
+runtime_mappedmem(void)
+{
+	return mstats.heap_sys - mstats.heap_released + mstats.stacks_sys +
+		mstats.mspan_sys + mstats.mcache_sys + mstats.buckhash_sys +
+		mstats.gc_sys + mstats.other_sys;
+}
+
+// If mapping more bytes would take the process over the soft memory
+// limit, return all the idle spans to the operating system first.
+// The caller holds h's lock.
+static void
+MHeap_ReleaseOverLimit(MHeap *h, uintptr more)
+{
+	uintptr released;
+
+	if(runtime_softmemlimit == NoMemLimit || runtime_mappedmem() + more <= runtime_softmemlimit)
+		return;
+	released = scavengeall(h, ~(uint64)0, 0, false);
+	if(runtime_debug.gctrace > 0 && released > 0)
+		runtime_printf("scvg: %D MB released at the memory limit\n", (uint64)released>>20);
+}
+
+void
+runtime_MHeap_ReleaseOverLimit(MHeap *h)
+{
+	runtime_lock(h);
+	MHeap_ReleaseOverLimit(h, 0);
+	runtime_unlock(h);
+}
+
 // Try to add at least npage pages of memory to the heap,
 // returning whether it worked.
 static bool
@@ -318,6 +360,12 @@ MHeap_Grow(MHeap *h, uintptr npage)
 	ask = npage<<PageShift;
 	if(ask < HeapAllocChunk)
 		ask = HeapAllocChunk;
+	// Keep the end of the arena on a huge page boundary.
+	ask = ROUND(ask, HugePageSize);
+
+	// Memory released to the operating system does not count
+	// against the limit, so release before mapping more.
+	MHeap_ReleaseOverLimit(h, ask);
 
 	v = runtime_MHeap_SysAlloc(h, ask);
 	if(v == nil) {
@@ -459,10 +507,15 @@ forcegchelper(void *vnote)
 	runtime_notewakeup(note);
 }
 
+// If huge is set, release only the huge pages that lie wholly inside
+// an idle span: releasing part of a huge page makes the kernel split
+// it, and the rest of it goes back to small pages.  Spans that stay
+// idle much longer are released whole anyway, so that a fragmented
+// heap still returns memory.
 static uintptr
-scavengelist(MSpan *list, uint64 now, uint64 limit)
+scavengelist(MSpan *list, uint64 now, uint64 limit, bool huge)
 {
-	uintptr released, sumreleased, start, end, pagesize;
+	uintptr released, sumreleased, start, end, pagesize, npages;
 	MSpan *s;
 
 	if(runtime_MSpanList_IsEmpty(list))
@@ -470,39 +523,59 @@ scavengelist(MSpan *list, uint64 now, uint64 limit)
 
 	sumreleased = 0;
 	for(s=list->next; s != list; s=s->next) {
-		if((now - s->unusedsince) > limit && s->npreleased != s->npages) {
-			released = (s->npages - s->npreleased) << PageShift;
-			mstats.heap_released += released;
-			sumreleased += released;
-			s->npreleased = s->npages;
-
-			start = s->start << PageShift;
-			end = start + (s->npages << PageShift);
+		if((now - s->unusedsince) <= limit || s->npreleased == s->npages)
+			continue;
 
+		start = s->start << PageShift;
+		end = start + (s->npages << PageShift);
+		if(huge && (now - s->unusedsince) <= HugeIdleFactor*limit) {
+			start = ROUND(start, HugePageSize);
+			end &= ~(HugePageSize - 1);
+			if(end <= start)
+				continue;
+			npages = (end - start) >> PageShift;
+			if(s->npreleased >= npages)
+				continue;
+		} else {
 			// Round start up and end down to ensure we
 			// are acting on entire pages.
+			npages = s->npages;
 			pagesize = getpagesize();
 			start = ROUND(start, pagesize);
 			end &= ~(pagesize - 1);
-			if(end > start)
-				runtime_SysUnused((void*)start, end - start);
 		}
+
+		released = (npages - s->npreleased) << PageShift;
+		mstats.heap_released += released;
+		sumreleased += released;
+		s->npreleased = npages;
+		if(end > start)
+			runtime_SysUnused((void*)start, end - start);
 	}
 	return sumreleased;
 }
 
-static void
-scavenge(int32 k, uint64 now, uint64 limit)
+static uintptr
+scavengeall(MHeap *h, uint64 now, uint64 limit, bool huge)
 {
 	uint32 i;
 	uintptr sumreleased;
-	MHeap *h;
-	
-	h = &runtime_mheap;
+
 	sumreleased = 0;
 	for(i=0; i < nelem(h->free); i++)
-		sumreleased += scavengelist(&h->free[i], now, limit);
-	sumreleased += scavengelist(&h->freelarge, now, limit);
+		sumreleased += scavengelist(&h->free[i], now, limit, huge);
+	sumreleased += scavengelist(&h->freelarge, now, limit, huge);
+	return sumreleased;
+}
+
+static void
+scavenge(int32 k, uint64 now, uint64 limit)
+{
+	uintptr sumreleased;
+
+	// The periodic scavenger keeps huge pages intact; a forced
+	// scavenge (k == -1) gives back all it can.
+	sumreleased = scavengeall(&runtime_mheap, now, limit, k >= 0 && runtime_mheap.hugepages);
 
 	if(runtime_debug.gctrace > 0) {
 		if(sumreleased > 0)
@@ -516,6 +589,20 @@ scavenge(int32 k, uint64 now, uint64 limit)
 // Release (part of) unused memory to OS.
 // Goroutine created at startup.
 // Loop forever.
+// Sample how much of the arena the kernel backs with huge pages.  The
+// kernel walks the page tables to say, so it is done on the scavenger
+// tick rather than on each ReadMemStats, and without the heap lock.
+static void
+updatehuge(MHeap *h)
+{
+	uint64 huge;
+
+	huge = 0;
+	if(h->hugepages)
+		huge = runtime_SysHugePageBytes(h->arena_start, h->arena_used - h->arena_start);
+	runtime_atomicstore64(&mstats.heap_huge, huge);
+}
+
 void
 runtime_MHeap_Scavenger(void* dummy)
 {
@@ -565,7 +652,11 @@ runtime_MHeap_Scavenger(void* dummy)
 		}
 		now = runtime_nanotime();
 		scavenge(k, now, limit);
+		// The memory the rest of the runtime maps can grow between
+		// collections too.
+		MHeap_ReleaseOverLimit(h, 0);
 		runtime_unlock(h);
+		updatehuge(h);
 	}
 }
 
@@ -578,6 +669,7 @@ runtime_debug_freeOSMemory(void)
 	runtime_lock(&runtime_mheap);
 	scavenge(-1, ~(uintptr)0, 0);
 	runtime_unlock(&runtime_mheap);
+	updatehuge(&runtime_mheap);
 }
 
 // Initialize a new span with the given start and npages.
@@ -78,10 +78,15 @@ runtime_closeonexec(int32 fd)
 }
 
 static int32 epfd = -1;  // epoll descriptor
+static bool uring;  // using netpoll_uring.c instead
 
 void
 runtime_netpollinit(void)
 {
+	if(runtime_debug.netpolluring && runtime_netpolluringinit()) {
+		uring = true;
+		return;
+	}
 	epfd = runtime_epollcreate1(EPOLL_CLOEXEC);
 	if(epfd >= 0)
 		return;
@@ -100,6 +105,8 @@ runtime_netpollopen(uintptr fd, PollDesc *pd)
 	EpollEvent ev;
 	int32 res;
 
+	if(uring)
+		return runtime_netpolluringopen(fd, pd);
 	ev.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
 	ev.data.ptr = (void*)pd;
 	res = runtime_epollctl(epfd, EPOLL_CTL_ADD, (int32)fd, &ev);
@@ -107,11 +114,13 @@ runtime_netpollopen(uintptr fd, PollDesc *pd)
 }
 
 int32
-runtime_netpollclose(uintptr fd)
+runtime_netpollclose(uintptr fd, PollDesc *pd)
 {
 	EpollEvent ev;
 	int32 res;
 
+	if(uring)
+		return runtime_netpolluringclose(fd, pd);
 	res = runtime_epollctl(epfd, EPOLL_CTL_DEL, (int32)fd, &ev);
 	return -res;
 }
@@ -124,6 +133,29 @@ runtime_netpollarm(PollDesc* pd, int32 mode)
 	runtime_throw("unused");
 }
 
+// Report whether runtime_netpollio can be used.
+bool
+runtime_netpollcompletion(void)
+{
+	return uring;
+}
+
+void
+runtime_netpollio(PollDesc *pd, int32 op, byte *p, uintptr n)
+{
+	if(!uring)
+		runtime_throw("runtime_netpollio: not using io_uring");
+	runtime_netpolluringio(pd, op, p, n);
+}
+
+void
+runtime_netpollcancel(PollDesc *pd, int32 op)
+{
+	if(!uring)
+		runtime_throw("runtime_netpollcancel: not using io_uring");
+	runtime_netpolluringcancel(pd, op);
+}
+
 // polls for ready network connections
 // returns list of goroutines that become runnable
 G*
@@ -134,6 +166,8 @@ runtime_netpoll(bool block)
 	int32 n, i, waitms, mode;
 	G *gp;
 
+	if(uring)
+		return runtime_netpolluring(block);
 	if(epfd == -1)
 		return nil;
 	waitms = -1;
@@ -51,11 +51,12 @@ runtime_netpollopen(uintptr fd, PollDesc *pd)
 }
 
 int32
-runtime_netpollclose(uintptr fd)
+runtime_netpollclose(uintptr fd, PollDesc *pd)
 {
 	// Don't need to unregister because calling close()
 	// on fd will remove any kevents that reference the descriptor.
 	USED(fd);
+	USED(pd);
 	return 0;
 }
 
@@ -66,6 +67,30 @@ runtime_netpollarm(PollDesc* pd, int32 mode)
 	runtime_throw("unused");
 }
 
+bool
+runtime_netpollcompletion(void)
+{
+	return false;
+}
+
+void
+runtime_netpollio(PollDesc *pd, int32 op, byte *p, uintptr n)
+{
+	USED(pd);
+	USED(op);
+	USED(p);
+	USED(n);
+	runtime_throw("unused");
+}
+
+void
+runtime_netpollcancel(PollDesc *pd, int32 op)
+{
+	USED(pd);
+	USED(op);
+	runtime_throw("unused");
+}
+
 // Polls for ready network connections.
 // Returns list of goroutines that become runnable.
 G*
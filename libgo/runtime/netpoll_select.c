@@ -101,10 +101,12 @@ runtime_netpollopen(uintptr fd, PollDesc *pd)
 }
 
 int32
-runtime_netpollclose(uintptr fd)
+runtime_netpollclose(uintptr fd, PollDesc *pd)
 {
 	byte b;
 
+	USED(pd);
+
 	runtime_lock(&selectlock);
 
 	FD_CLR(fd, &fds);
@@ -118,6 +120,30 @@ runtime_netpollclose(uintptr fd)
 	return 0;
 }
 
+bool
+runtime_netpollcompletion(void)
+{
+	return false;
+}
+
+void
+runtime_netpollio(PollDesc *pd, int32 op, byte *p, uintptr n)
+{
+	USED(pd);
+	USED(op);
+	USED(p);
+	USED(n);
+	runtime_throw("unused");
+}
+
+void
+runtime_netpollcancel(PollDesc *pd, int32 op)
+{
+	USED(pd);
+	USED(op);
+	runtime_throw("unused");
+}
+
 /* Used to avoid using too much stack memory.  */
 static bool inuse;
 static fd_set grfds, gwfds, gefds, gtfds;
@@ -0,0 +1,684 @@
+// Copyright 2014 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// +build linux
+
+// Network poller using io_uring, selected with GODEBUG=netpolluring=1.
+// netpoll_epoll.c calls these functions instead of its own when
+// runtime_netpolluringinit succeeds.
+//
+// Each descriptor gets one multishot poll request, which posts a
+// completion every time the descriptor becomes ready, like EPOLLET.
+// The user data of a request is its PollDesc tagged with the number
+// of the request, so that a late completion of an earlier request for
+// the PollDesc, which may now be used for another descriptor, is
+// recognized and dropped.
+// Requests are queued in the submission ring and submitted together
+// by the next runtime_netpoll, so opening a batch of descriptors costs
+// one system call instead of one epoll_ctl each.  Completions are read
+// straight from the shared completion ring, so a non-blocking poll
+// with nothing to submit makes no system call at all.
+//
+// Package net also hands reads, writes and accepts that would block to
+// the ring, through runtime_pollIO in netpoll.goc, so that the kernel
+// does them when the descriptor is ready and the goroutine wakes up
+// with the result instead of making the system call again.  Those
+// requests are tagged with their kind instead of a number, because a
+// PollDesc is not closed or reused while one of them is outstanding.
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "runtime.h"
+#include "defs.h"
+#include "malloc.h"
+
+#ifndef POLLRDHUP
+#define POLLRDHUP 0x2000
+#endif
+
+#ifdef __NR_io_uring_setup
+
+// The kernel interface, from <linux/io_uring.h>, which older C
+// libraries do not have.
+
+typedef struct SqringOffsets SqringOffsets;
+typedef struct CqringOffsets CqringOffsets;
+typedef struct UringParams UringParams;
+typedef struct Sqe Sqe;
+typedef struct Cqe Cqe;
+
+struct SqringOffsets
+{
+	uint32	head;
+	uint32	tail;
+	uint32	ring_mask;
+	uint32	ring_entries;
+	uint32	flags;
+	uint32	dropped;
+	uint32	array;
+	uint32	resv1;
+	uint64	resv2;
+};
+
+struct CqringOffsets
+{
+	uint32	head;
+	uint32	tail;
+	uint32	ring_mask;
+	uint32	ring_entries;
+	uint32	overflow;
+	uint32	cqes;
+	uint32	flags;
+	uint32	resv1;
+	uint64	resv2;
+};
+
+struct UringParams
+{
+	uint32	sq_entries;
+	uint32	cq_entries;
+	uint32	flags;
+	uint32	sq_thread_cpu;
+	uint32	sq_thread_idle;
+	uint32	features;
+	uint32	wq_fd;
+	uint32	resv[3];
+	SqringOffsets	sq_off;
+	CqringOffsets	cq_off;
+};
+
+struct Sqe
+{
+	uint8	opcode;
+	uint8	flags;
+	uint16	ioprio;
+	int32	fd;
+	uint64	off;
+	uint64	addr;
+	uint32	len;
+	uint32	opflags;	// poll32_events, accept_flags, ...
+	uint64	user_data;
+	uint64	pad[3];
+};
+
+struct Cqe
+{
+	uint64	user_data;
+	int32	res;
+	uint32	flags;
+};
+
+enum
+{
+	IORING_SETUP_CQSIZE = 1<<3,
+	IORING_FEAT_SINGLE_MMAP = 1<<0,
+	IORING_OFF_SQ_RING = 0,
+	IORING_OFF_CQ_RING = 0x8000000,
+	IORING_OFF_SQES = 0x10000000,
+	IORING_ENTER_GETEVENTS = 1<<0,
+	IORING_SQ_CQ_OVERFLOW = 1<<1,
+	IORING_OP_POLL_ADD = 6,
+	IORING_OP_POLL_REMOVE = 7,
+	IORING_OP_ACCEPT = 13,
+	IORING_OP_ASYNC_CANCEL = 14,
+	IORING_OP_READ = 22,
+	IORING_OP_WRITE = 23,
+	IORING_POLL_ADD_MULTI = 1<<0,
+	IORING_CQE_F_MORE = 1<<1,
+
+	SqEntries = 256,
+	CqEntries = 4096,
+
+	// User data layout on 64-bit systems, as in the gc runtime's
+	// tagged pointers: user addresses fit in 48 bits, and a PollDesc
+	// is 8-byte aligned, which leaves 19 bits for the request number.
+	// On 32-bit systems the number gets the upper 32 bits.
+	TagAddrBits = 48,
+	TagBits = 64 - TagAddrBits + 3,
+
+	// The low two bits of the request number give its kind.  A poll
+	// request is numbered from PollDesc.uringseq, the others only
+	// have a kind.
+	UringPoll = 0,
+	UringRead,
+	UringWrite,
+	UringAccept,
+};
+
+static struct
+{
+	Lock;		// protects the submission ring and reading completions
+	int32	fd;
+	int32	waiting;	// number of threads blocked in io_uring_enter
+	uint32	pending;	// requests queued but not submitted
+
+	uint32	*sqhead;
+	uint32	*sqtail;
+	uint32	sqmask;
+	uint32	*sqflags;
+	uint32	*sqarray;
+	Sqe	*sqes;
+
+	uint32	*cqhead;
+	uint32	*cqtail;
+	uint32	cqmask;
+	Cqe	*cqes;
+} uring;
+
+static int32
+uringsetup(uint32 entries, UringParams *p)
+{
+	int32 r;
+
+	r = syscall(__NR_io_uring_setup, entries, p);
+	if(r >= 0)
+		return r;
+	return - errno;
+}
+
+static int32
+uringenter(uint32 tosubmit, uint32 mincomplete, uint32 flags)
+{
+	int32 r;
+
+	r = syscall(__NR_io_uring_enter, uring.fd, tosubmit, mincomplete, flags, nil, 0);
+	if(r >= 0)
+		return r;
+	return - errno;
+}
+
+static uint64
+uringtag(PollDesc *pd, uintptr seq)
+{
+	if(sizeof(void*) == 4)
+		return (uint64)seq<<32 | (uintptr)pd;
+	return (uint64)(uintptr)pd<<(64-TagAddrBits) | (seq & ((1<<TagBits)-1));
+}
+
+static PollDesc*
+uringtagpd(uint64 tag)
+{
+	if(sizeof(void*) == 4)
+		return (PollDesc*)(uintptr)(uint32)tag;
+	return (PollDesc*)(uintptr)(tag>>TagBits<<3);
+}
+
+static int32
+uringtagkind(uint64 tag)
+{
+	if(sizeof(void*) == 4)
+		return (tag>>32) & 3;
+	return tag & 3;
+}
+
+// The number of the current poll request of pd.
+static uintptr
+uringpollnum(PollDesc *pd)
+{
+	return *runtime_netpolluringseq(pd)<<2 | UringPoll;
+}
+
+// Report whether tag names the current poll request of its PollDesc.
+// Called with uring locked.
+static bool
+uringtagcurrent(uint64 tag)
+{
+	return tag == uringtag(uringtagpd(tag), uringpollnum(uringtagpd(tag)));
+}
+
+static uint32
+uringevents(uint32 events)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	events = events<<16 | events>>16;
+#endif
+	return events;
+}
+
+static Sqe *uringsqe(void);
+static void uringqueue(bool);
+
+// Report whether the kernel has multishot poll requests, which came in
+// Linux 5.13.  No feature bit or probed opcode shows them, so try one
+// on a pipe that is ready to read, and cancel it.  Older kernels
+// reject the request with EINVAL.
+static bool
+uringprobemulti(void)
+{
+	int32 p[2], n;
+	uint32 head, tail;
+	Sqe *sqe;
+	Cqe *cqe;
+	bool ok, polldone, removedone;
+
+	if(pipe(p) < 0)
+		return false;
+	ok = false;
+	if(write(p[1], "x", 1) != 1)
+		goto out;
+	runtime_lock(&uring);
+	sqe = uringsqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = p[0];
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->opflags = uringevents(POLLIN);
+	sqe->user_data = 1;
+	uringqueue(false);
+	sqe = uringsqe();
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = 1;
+	sqe->user_data = 2;
+	uringqueue(true);
+	polldone = false;
+	removedone = false;
+	while(!polldone || !removedone) {
+		n = uringenter(0, 1, IORING_ENTER_GETEVENTS);
+		if(n < 0 && n != -EINTR)
+			break;
+		head = *uring.cqhead;
+		tail = runtime_atomicload(uring.cqtail);
+		for(; head != tail; head++) {
+			cqe = &uring.cqes[head & uring.cqmask];
+			if(cqe->user_data == 2)
+				removedone = true;
+			else if(cqe->user_data == 1) {
+				if(cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE) != 0)
+					ok = true;
+				if((cqe->flags & IORING_CQE_F_MORE) == 0)
+					polldone = true;
+			}
+		}
+		runtime_atomicstore(uring.cqhead, head);
+	}
+	runtime_unlock(&uring);
+	if(!polldone || !removedone)
+		ok = false;
+out:
+	close(p[0]);
+	close(p[1]);
+	return ok;
+}
+
+// Set up the rings.  Returns false if the kernel does not support
+// what we need, in which case the caller uses epoll.
+bool
+runtime_netpolluringinit(void)
+{
+	UringParams p;
+	byte *sq, *cq;
+	uintptr sqsize, cqsize;
+	int32 fd;
+
+	runtime_memclr((byte*)&p, sizeof p);
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = CqEntries;
+	fd = uringsetup(SqEntries, &p);
+	if(fd < 0)
+		return false;
+	if((p.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+		close(fd);
+		return false;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	sqsize = p.sq_off.array + p.sq_entries*sizeof(uint32);
+	cqsize = p.cq_off.cqes + p.cq_entries*sizeof(Cqe);
+	if(cqsize > sqsize)
+		sqsize = cqsize;
+	sq = runtime_mmap(nil, sqsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(sq == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	cq = sq;
+	uring.sqes = runtime_mmap(nil, p.sq_entries*sizeof(Sqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(uring.sqes == MAP_FAILED) {
+		runtime_munmap(sq, sqsize);
+		close(fd);
+		return false;
+	}
+
+	uring.fd = fd;
+	uring.sqhead = (uint32*)(sq + p.sq_off.head);
+	uring.sqtail = (uint32*)(sq + p.sq_off.tail);
+	uring.sqmask = *(uint32*)(sq + p.sq_off.ring_mask);
+	uring.sqflags = (uint32*)(sq + p.sq_off.flags);
+	uring.sqarray = (uint32*)(sq + p.sq_off.array);
+	uring.cqhead = (uint32*)(cq + p.cq_off.head);
+	uring.cqtail = (uint32*)(cq + p.cq_off.tail);
+	uring.cqmask = *(uint32*)(cq + p.cq_off.ring_mask);
+	uring.cqes = (Cqe*)(cq + p.cq_off.cqes);
+
+	if(!uringprobemulti()) {
+		runtime_munmap(uring.sqes, p.sq_entries*sizeof(Sqe));
+		runtime_munmap(sq, sqsize);
+		close(fd);
+		return false;
+	}
+	return true;
+}
+
+// Submit the queued requests.  Called with uring locked.
+static void
+uringsubmit(void)
+{
+	int32 n;
+
+	while(uring.pending > 0) {
+		n = uringenter(uring.pending, 0, 0);
+		if(n < 0) {
+			if(n == -EINTR || n == -EAGAIN || n == -EBUSY)
+				continue;
+			runtime_printf("runtime: io_uring_enter failed with %d\n", -n);
+			runtime_throw("runtime: netpoll failed");
+		}
+		uring.pending -= n;
+	}
+}
+
+// Return a free submission queue entry.  Called with uring locked.
+static Sqe*
+uringsqe(void)
+{
+	uint32 tail;
+	Sqe *sqe;
+
+	tail = *uring.sqtail;
+	if(tail - runtime_atomicload(uring.sqhead) > uring.sqmask)
+		uringsubmit();
+	sqe = &uring.sqes[tail & uring.sqmask];
+	runtime_memclr((byte*)sqe, sizeof *sqe);
+	uring.sqarray[tail & uring.sqmask] = tail & uring.sqmask;
+	return sqe;
+}
+
+// Make the entry returned by uringsqe visible to the kernel.
+// If a thread is waiting for completions it will not submit it,
+// so submit it now.  Called with uring locked.
+static void
+uringqueue(bool now)
+{
+	runtime_atomicstore(uring.sqtail, *uring.sqtail + 1);
+	uring.pending++;
+	if(now || uring.waiting > 0)
+		uringsubmit();
+}
+
+// Queue a multishot poll request for fd, which replaces any earlier
+// request for pd.  Called with uring locked.
+static void
+uringpoll(uintptr fd, PollDesc *pd)
+{
+	Sqe *sqe;
+
+	(*runtime_netpolluringseq(pd))++;
+	sqe = uringsqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = (int32)fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->opflags = uringevents(POLLIN|POLLOUT|POLLRDHUP);
+	sqe->user_data = uringtag(pd, uringpollnum(pd));
+	uringqueue(false);
+}
+
+int32
+runtime_netpolluringopen(uintptr fd, PollDesc *pd)
+{
+	runtime_lock(&uring);
+	uringpoll(fd, pd);
+	runtime_unlock(&uring);
+	return 0;
+}
+
+int32
+runtime_netpolluringclose(uintptr fd, PollDesc *pd)
+{
+	Sqe *sqe;
+
+	USED(fd);
+
+	// The poll request holds a reference to the file, so it must be
+	// gone before the caller closes the descriptor.  Its completion
+	// reports -ECANCELED, and the removal itself reports nothing
+	// useful, so it gets no PollDesc.
+	runtime_lock(&uring);
+	sqe = uringsqe();
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uringtag(pd, uringpollnum(pd));
+	sqe->user_data = 0;
+	uringqueue(true);
+	runtime_unlock(&uring);
+	return 0;
+}
+
+static int32
+uringiokind(int32 op)
+{
+	switch(op) {
+	case 'r':
+		return UringRead;
+	case 'w':
+		return UringWrite;
+	case 'a':
+		return UringAccept;
+	}
+	runtime_throw("runtime: bad netpoll operation");
+	return 0;
+}
+
+// Read into p, write from p or accept a connection on pd's
+// descriptor, as op is 'r', 'w' or 'a'; the result is passed to
+// runtime_netpolliodone.  The request is submitted at once, because
+// the goroutine is about to park waiting for it.
+void
+runtime_netpolluringio(PollDesc *pd, int32 op, byte *p, uintptr n)
+{
+	Sqe *sqe;
+
+	runtime_lock(&uring);
+	sqe = uringsqe();
+	sqe->fd = (int32)runtime_netpollfd(pd);
+	switch(op) {
+	case 'r':
+	case 'w':
+		sqe->opcode = op == 'r' ? IORING_OP_READ : IORING_OP_WRITE;
+		sqe->off = (uint64)-1;	// the current position, which sockets ignore
+		sqe->addr = (uintptr)p;
+		if(n > 1<<30)
+			n = 1<<30;  // a short read or write, which fits in len
+		sqe->len = n;
+		break;
+	case 'a':
+		// The peer address is left to getpeername, because
+		// only package syscall can convert it.
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->opflags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+		break;
+	}
+	sqe->user_data = uringtag(pd, uringiokind(op));
+	uringqueue(true);
+	runtime_unlock(&uring);
+}
+
+// Cancel the request made by runtime_netpolluringio.  The request
+// still completes, with -ECANCELED unless it was already done.
+void
+runtime_netpolluringcancel(PollDesc *pd, int32 op)
+{
+	Sqe *sqe;
+
+	runtime_lock(&uring);
+	sqe = uringsqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = uringtag(pd, uringiokind(op));
+	sqe->user_data = 0;
+	uringqueue(true);
+	runtime_unlock(&uring);
+}
+
+// polls for ready network connections
+// returns list of goroutines that become runnable
+G*
+runtime_netpolluring(bool block)
+{
+	static int32 lasterr;
+	Cqe cqes[128], *cqe;
+	uint32 head, tail;
+	int32 n, i, mode;
+	PollDesc *pd;
+	G *gp;
+
+	gp = nil;
+retry:
+	runtime_lock(&uring);
+	uringsubmit();
+	head = *uring.cqhead;
+	tail = runtime_atomicload(uring.cqtail);
+	if(head == tail && (runtime_atomicload(uring.sqflags) & IORING_SQ_CQ_OVERFLOW) != 0) {
+		// Completions that did not fit in the ring are
+		// held by the kernel until we ask for them.
+		uringenter(0, 0, IORING_ENTER_GETEVENTS);
+		tail = runtime_atomicload(uring.cqtail);
+	}
+	if(head == tail && block) {
+		uring.waiting++;
+		runtime_unlock(&uring);
+		n = uringenter(0, 1, IORING_ENTER_GETEVENTS);
+		if(n < 0 && n != -EINTR && n != -EAGAIN && n != -EBUSY && n != lasterr) {
+			lasterr = n;
+			runtime_printf("runtime: io_uring_enter on fd %d failed with %d\n", uring.fd, -n);
+		}
+		runtime_lock(&uring);
+		uring.waiting--;
+		head = *uring.cqhead;
+		tail = runtime_atomicload(uring.cqtail);
+	}
+	n = 0;
+	for(; head != tail && n < (int32)nelem(cqes); head++)
+		cqes[n++] = uring.cqes[head & uring.cqmask];
+	runtime_atomicstore(uring.cqhead, head);
+
+	for(i = 0; i < n; i++) {
+		cqe = &cqes[i];
+		if(cqe->user_data != 0 && uringtagkind(cqe->user_data) != UringPoll)
+			continue;  // a read, write or accept, delivered below
+		if(cqe->user_data == 0 || !uringtagcurrent(cqe->user_data)) {
+			// A removal, or a late completion of a request
+			// that was replaced or removed.
+			cqe->user_data = 0;
+			continue;
+		}
+		pd = uringtagpd(cqe->user_data);
+		if(cqe->res == -ECANCELED || runtime_netpollclosing(pd)) {
+			cqe->user_data = 0;
+			continue;
+		}
+		if(cqe->res < 0) {
+			// The poll failed.  Wake both modes, so that the
+			// goroutines retry and find any error themselves,
+			// and poll again if the failure was transient.
+			if(cqe->res == -ENOMEM || cqe->res == -EAGAIN || cqe->res == -EINTR || cqe->res == -EBUSY)
+				uringpoll(runtime_netpollfd(pd), pd);
+			cqe->res = POLLERR;
+		} else if((cqe->flags & IORING_CQE_F_MORE) == 0) {
+			// The kernel stopped the request, which it does
+			// when the completion ring overflows.
+			uringpoll(runtime_netpollfd(pd), pd);
+		}
+	}
+	runtime_unlock(&uring);
+
+	for(i = 0; i < n; i++) {
+		cqe = &cqes[i];
+		if(cqe->user_data == 0)
+			continue;
+		pd = uringtagpd(cqe->user_data);
+		switch(uringtagkind(cqe->user_data)) {
+		case UringRead:
+		case UringAccept:
+			runtime_netpolliodone(pd, 'r', cqe->res);
+			runtime_netpollready(&gp, pd, 'r');
+			continue;
+		case UringWrite:
+			runtime_netpolliodone(pd, 'w', cqe->res);
+			runtime_netpollready(&gp, pd, 'w');
+			continue;
+		}
+		if(cqe->res <= 0)
+			continue;
+		mode = 0;
+		if(cqe->res & (POLLIN|POLLRDHUP|POLLHUP|POLLERR))
+			mode += 'r';
+		if(cqe->res & (POLLOUT|POLLHUP|POLLERR))
+			mode += 'w';
+		if(mode)
+			runtime_netpollready(&gp, pd, mode);
+	}
+	if(block && gp == nil)
+		goto retry;
+	return gp;
+}
+
+#else /* !defined(__NR_io_uring_setup) */
+
+bool
+runtime_netpolluringinit(void)
+{
+	return false;
+}
+
+int32
+runtime_netpolluringopen(uintptr fd, PollDesc *pd)
+{
+	USED(fd);
+	USED(pd);
+	runtime_throw("runtime_netpolluringopen: io_uring is not supported");
+	return 0;
+}
+
+int32
+runtime_netpolluringclose(uintptr fd, PollDesc *pd)
+{
+	USED(fd);
+	USED(pd);
+	runtime_throw("runtime_netpolluringclose: io_uring is not supported");
+	return 0;
+}
+
+G*
+runtime_netpolluring(bool block)
+{
+	USED(block);
+	runtime_throw("runtime_netpolluring: io_uring is not supported");
+	return nil;
+}
+
+void
+runtime_netpolluringio(PollDesc *pd, int32 op, byte *p, uintptr n)
+{
+	USED(pd);
+	USED(op);
+	USED(p);
+	USED(n);
+	runtime_throw("runtime_netpolluringio: io_uring is not supported");
+}
+
+void
+runtime_netpolluringcancel(PollDesc *pd, int32 op)
+{
+	USED(pd);
+	USED(op);
+	runtime_throw("runtime_netpolluringcancel: io_uring is not supported");
+}
+
+#endif /* !defined(__NR_io_uring_setup) */
@@ -56,6 +56,7 @@ extern void __splitstack_block_signals_context (void *context[10], int *,
 uintptr runtime_stacks_sys;
 
 static void gtraceback(G*);
+static void handoffdone(void);
 
 #ifdef __rtems__
 #define __thread
@@ -64,7 +65,9 @@ static void gtraceback(G*);
 static __thread G *g;
 static __thread M *m;
 
-#ifndef SETCONTEXT_CLOBBERS_TLS
+// The TLS problems below are in setcontext, which we only use when
+// we can't use our own context switch.
+#if !defined(SETCONTEXT_CLOBBERS_TLS) || defined(USING_GO_CONTEXT)
 
 static inline void
 initcontext(void)
@@ -72,7 +75,7 @@ initcontext(void)
 }
 
 static inline void
-fixcontext(ucontext_t *c __attribute__ ((unused)))
+fixcontext(__go_context_t *c __attribute__ ((unused)))
 {
 }
 
@@ -228,6 +231,8 @@ kickoff(void)
 {
 	void (*fn)(void*);
 
+	handoffdone();
+
 	if(g->traceback != nil)
 		gtraceback(g);
 
@@ -247,14 +252,14 @@ runtime_gogo(G* newg)
 	g = newg;
 	newg->fromgogo = true;
 	fixcontext(&newg->context);
-	setcontext(&newg->context);
+	__go_setcontext(&newg->context);
 	runtime_throw("gogo setcontext returned");
 }
 
 // Save context and call fn passing g as a parameter.  This is like
-// setjmp.  Because getcontext always returns 0, unlike setjmp, we use
-// g->fromgogo as a code.  It will be true if we got here via
-// setcontext.  g == nil the first time this is called in a new m.
+// setjmp.  Because __go_getcontext always returns 0, unlike setjmp,
+// we use g->fromgogo as a code.  It will be true if we got here via
+// __go_setcontext.  g == nil the first time this is called in a new m.
 void runtime_mcall(void (*)(G*)) __attribute__ ((noinline));
 void
 runtime_mcall(void (*pfn)(G*))
@@ -279,9 +284,9 @@ runtime_mcall(void (*pfn)(G*))
 		gp->gcnext_sp = &pfn;
 #endif
 		gp->fromgogo = false;
-		getcontext(&gp->context);
+		__go_getcontext(&gp->context);
 
-		// When we return from getcontext, we may be running
+		// When we return from __go_getcontext, we may be running
 		// in a new thread.  That means that m and g may have
 		// changed.  They are global variables so we will
 		// reload them, but the addresses of m and g may be
@@ -291,6 +296,9 @@ runtime_mcall(void (*pfn)(G*))
 		mp = runtime_m();
 		gp = runtime_g();
 
+		if(gp->fromgogo)
+			handoffdone();
+
 		if(gp->traceback != nil)
 			gtraceback(gp);
 	}
@@ -302,12 +310,12 @@ runtime_mcall(void (*pfn)(G*))
 		mp->g0->param = gp;
 
 		// It's OK to set g directly here because this case
-		// can not occur if we got here via a setcontext to
-		// the getcontext call just above.
+		// can not occur if we got here via a __go_setcontext
+		// to the __go_getcontext call just above.
 		g = mp->g0;
 
 		fixcontext(&mp->g0->context);
-		setcontext(&mp->g0->context);
+		__go_setcontext(&mp->g0->context);
 		runtime_throw("runtime: mcall function returned");
 	}
 }
@@ -339,10 +347,13 @@ struct Sched {
 	uint32	npidle;
 	uint32	nmspinning;
 
-	// Global runnable queue.
+	// Global runnable queue: see globrunq below.  The list holds
+	// the G's that did not fit in the ring.
+	Lock	runqlock;	// protects runqhead, runqtail and runqover
 	G*	runqhead;
 	G*	runqtail;
-	int32	runqsize;
+	int32	runqover;	// number of G's on the list
+	int32	runqsize;	// number of G's in the ring and on the list
 
 	// Global cache of dead G's.
 	Lock	gflock;
@@ -367,6 +378,10 @@ enum
 	// Number of goroutine ids to grab from runtime_sched.goidgen to local per-P cache at once.
 	// 16 seems to provide enough amortization, but other than that it's mostly arbitrary number.
 	GoidCacheBatch = 16,
+
+	// Number of slots in the global runnable queue's ring.
+	// Must be a power of 2.
+	GlobRunqSize = 1<<12,
 };
 
 Sched	runtime_sched;
@@ -381,9 +396,36 @@ P**	runtime_allp;
 M*	runtime_extram;
 int8*	runtime_goos;
 int32	runtime_ncpu;
+CPUTopology	runtime_cputopology;
 bool	runtime_precisestack;
 static int32	newprocs;
 
+// The ring of the global runnable queue, which P's put G's on and
+// take G's from without a lock.  enq and deq count the G's ever put
+// and taken; slot i of the ring holds G number i modulo its size.
+// The seq of a slot says whose turn it is: it is n when the slot is
+// free for G number n, and n+1 when it holds G number n.  A producer
+// or consumer claims its turn by advancing enq or deq with a cas,
+// and hands the slot on by storing the next seq.  When the ring is
+// full, G's go on the list in runtime_sched instead, and they keep
+// going there until the list is empty.  The order is close to FIFO
+// but not strict: a producer checks runqover without the lock, so one
+// that saw an empty list can still put its G's in the ring ahead of
+// G's that went on the list just before.  The list is drained into the
+// ring whenever the ring runs dry, so no G waits forever.
+static struct
+{
+	uintptr	enq;
+	byte	pad1[CacheLineSize];
+	uintptr	deq;
+	byte	pad2[CacheLineSize];
+	struct
+	{
+		uintptr	seq;
+		G*	gp;
+	} slot[GlobRunqSize];
+} globrunq;
+
 static	Lock allglock;	// the following vars are protected by this lock or by stoptheworld
 G**	runtime_allg;
 uintptr runtime_allglen;
@@ -391,9 +433,14 @@ static	uintptr allgcap;
 
 void* runtime_mstart(void*);
 static void runqput(P*, G*);
+static void runqputnext(P*, G*);
+static void runqflushnext(P*);
 static G* runqget(P*);
+static bool runqempty(P*);
 static bool runqputslow(P*, G*, uint32, uint32);
 static G* runqsteal(P*, P*);
+static G* runqstealnear(P*);
+static int32 cpudomain(void);
 static void mput(M*);
 static M* mget(void);
 static void mcommoninit(M*);
@@ -414,6 +461,8 @@ static void incidlelocked(int32);
 static void checkdead(void);
 static void exitsyscall0(G*);
 static void park0(G*);
+static G* handoffget(void);
+static void handoff(G*);
 static void goexit0(G*);
 static void gfput(P*, G*);
 static G* gfget(P*);
@@ -421,10 +470,12 @@ static void gfpurge(P*);
 static void globrunqput(G*);
 static void globrunqputbatch(G*, G*, int32);
 static G* globrunqget(P*, int32);
+static G* globrunqtake(void);
 static P* pidleget(void);
 static void pidleput(P*);
 static void injectglist(G*);
 static bool preemptall(void);
+static bool preemptone(P*);
 static bool exitsyscallfast(void);
 static void allgadd(G*);
 
@@ -453,10 +504,13 @@ runtime_schedinit(void)
 
 	runtime_sched.maxmcount = 10000;
 	runtime_precisestack = 0;
+	for(n = 0; n < GlobRunqSize; n++)
+		globrunq.slot[n].seq = n;
 
 	// runtime_symtabinit();
 	runtime_mallocinit();
 	mcommoninit(m);
+	runtime_hashinit();
 	
 	// Initialize the itable value for newErrorCString,
 	// so that the next time it gets called, possibly
@@ -471,6 +525,7 @@ runtime_schedinit(void)
 	runtime_goargs();
 	runtime_goenvs();
 	runtime_parsedebugvars();
+	getproctopology(&runtime_cputopology);
 
 	runtime_sched.lastpoll = runtime_nanotime();
 	procs = 1;
@@ -644,7 +699,7 @@ runtime_tracebackothers(G * volatile me)
 #ifdef USING_SPLIT_STACK
 		__splitstack_getcontext(&me->stack_context[0]);
 #endif
-		getcontext(&me->context);
+		__go_getcontext(&me->context);
 
 		if(gp->traceback != nil) {
 		  runtime_gogo(gp);
@@ -685,7 +740,7 @@ runtime_tracebackothers(G * volatile me)
 #ifdef USING_SPLIT_STACK
 			__splitstack_getcontext(&me->stack_context[0]);
 #endif
-			getcontext(&me->context);
+			__go_getcontext(&me->context);
 
 			if(gp->traceback != nil) {
 				runtime_gogo(gp);
@@ -758,7 +813,10 @@ runtime_ready(G *gp)
 		runtime_throw("bad g->status in ready");
 	}
 	gp->status = Grunnable;
-	runqput(m->p, gp);
+	// Run gp next on this P.  If we are about to block, as when
+	// answering a channel message, gp picks up where we left off,
+	// with the caches still warm.
+	runqputnext(m->p, gp);
 	if(runtime_atomicload(&runtime_sched.npidle) != 0 && runtime_atomicload(&runtime_sched.nmspinning) == 0)  // TODO: fast atomic
 		wakep();
 	m->locks--;
@@ -923,7 +981,7 @@ runtime_starttheworld(void)
 	while((p = pidleget()) != nil) {
 		// procresize() puts p's with work at the beginning of the list.
 		// Once we reach a p without a run queue, the rest don't have one either.
-		if(p->runqhead == p->runqtail) {
+		if(runqempty(p)) {
 			pidleput(p);
 			break;
 		}
@@ -991,7 +1049,7 @@ runtime_mstart(void* mp)
 	g->gcstack_size = 0;
 	g->gcnext_sp = &mp;
 #endif
-	getcontext(&g->context);
+	__go_getcontext(&g->context);
 
 	if(g->entry != nil) {
 		// Got here from mcall.
@@ -1172,7 +1230,7 @@ runtime_needm(void)
 	g->gcstack_size = 0;
 	g->gcnext_sp = &mp;
 #endif
-	getcontext(&g->context);
+	__go_getcontext(&g->context);
 
 	if(g->entry != nil) {
 		// Got here from mcall.
@@ -1222,10 +1280,7 @@ runtime_newextram(void)
 
 	// The context for gp will be set up in runtime_needm.  But
 	// here we need to set up the context for g0.
-	getcontext(&mp->g0->context);
-	mp->g0->context.uc_stack.ss_sp = g0_sp;
-	mp->g0->context.uc_stack.ss_size = g0_spsize;
-	makecontext(&mp->g0->context, kickoff, 0);
+	__go_makecontext(&mp->g0->context, kickoff, g0_sp, g0_spsize);
 
 	// Add m to the extra list.
 	mnext = lockextra(true);
@@ -1432,7 +1487,7 @@ static void
 handoffp(P *p)
 {
 	// if it has local work, start it straight away
-	if(p->runqhead != p->runqtail || runtime_sched.runqsize) {
+	if(!runqempty(p) || runtime_sched.runqsize) {
 		startm(p, false);
 		return;
 	}
@@ -1465,6 +1520,10 @@ handoffp(P *p)
 	}
 	pidleput(p);
 	runtime_unlock(&runtime_sched);
+	// G's are put on the global queue without the sched lock, and
+	// the M that put one there may have found no idle P to wake.
+	if(runtime_atomicload(&runtime_sched.runqsize) != 0)
+		wakep();
 }
 
 // Tries to add one more P to execute G's.
@@ -1591,9 +1650,7 @@ top:
 		return gp;
 	// global runq
 	if(runtime_sched.runqsize) {
-		runtime_lock(&runtime_sched);
 		gp = globrunqget(m->p, 0);
-		runtime_unlock(&runtime_sched);
 		if(gp)
 			return gp;
 	}
@@ -1613,7 +1670,10 @@ top:
 		m->spinning = true;
 		runtime_xadd(&runtime_sched.nmspinning, 1);
 	}
-	// random steal from other P's
+	// steal from nearby P's first, then from random ones
+	gp = runqstealnear(m->p);
+	if(gp)
+		return gp;
 	for(i = 0; i < 2*runtime_gomaxprocs; i++) {
 		if(runtime_sched.gcwaiting)
 			goto top;
@@ -1635,7 +1695,9 @@ stop:
 	if(runtime_sched.runqsize) {
 		gp = globrunqget(m->p, 0);
 		runtime_unlock(&runtime_sched);
-		return gp;
+		if(gp)
+			return gp;
+		goto top;  // a G is still being put on the queue
 	}
 	p = releasep();
 	pidleput(p);
@@ -1644,10 +1706,20 @@ stop:
 		m->spinning = false;
 		runtime_xadd(&runtime_sched.nmspinning, -1);
 	}
-	// check all runqueues once again
+	// check all runqueues once again; the global one is filled
+	// without the sched lock, so a G may have arrived after we looked
+	if(runtime_atomicload(&runtime_sched.runqsize) != 0) {
+		runtime_lock(&runtime_sched);
+		p = pidleget();
+		runtime_unlock(&runtime_sched);
+		if(p) {
+			acquirep(p);
+			goto top;
+		}
+	}
 	for(i = 0; i < runtime_gomaxprocs; i++) {
 		p = runtime_allp[i];
-		if(p && p->runqhead != p->runqtail) {
+		if(p && !runqempty(p)) {
 			runtime_lock(&runtime_sched);
 			p = pidleget();
 			runtime_unlock(&runtime_sched);
@@ -1712,19 +1784,28 @@ injectglist(G *glist)
 
 	if(glist == nil)
 		return;
-	runtime_lock(&runtime_sched);
 	for(n = 0; glist; n++) {
 		gp = glist;
 		glist = gp->schedlink;
 		gp->status = Grunnable;
 		globrunqput(gp);
 	}
-	runtime_unlock(&runtime_sched);
 
-	for(; n && runtime_sched.npidle; n--)
+	for(; n && runtime_atomicload(&runtime_sched.npidle); n--)
 		startm(nil, false);
 }
 
+// Reports whether the scheduler should look past the goroutines it
+// normally runs first, so that they can not keep the others waiting
+// forever.
+static inline bool
+schedfairtick(uint32 tick)
+{
+	// This is a fancy way to say tick%61==0,
+	// it uses 2 MUL instructions instead of a single DIV and so is faster on modern processors.
+	return tick - (((uint64)tick*0x4325c53fu)>>36)*61 == 0;
+}
+
 // One round of scheduler: find a runnable goroutine and execute it.
 // Never returns.
 static void
@@ -1747,16 +1828,20 @@ top:
 	// Otherwise two goroutines can completely occupy the local runqueue
 	// by constantly respawning each other.
 	tick = m->p->schedtick;
-	// This is a fancy way to say tick%61==0,
-	// it uses 2 MUL instructions instead of a single DIV and so is faster on modern processors.
-	if(tick - (((uint64)tick*0x4325c53fu)>>36)*61 == 0 && runtime_sched.runqsize > 0) {
-		runtime_lock(&runtime_sched);
-		gp = globrunqget(m->p, 1);
-		runtime_unlock(&runtime_sched);
-		if(gp)
-			resetspinning();
+	if(schedfairtick(tick)) {
+		// The OS may have moved us since we took the P.
+		m->p->domain = cpudomain();
+		if(runtime_sched.runqsize > 0) {
+			gp = globrunqget(m->p, 1);
+			if(gp)
+				resetspinning();
+		}
 	}
 	if(gp == nil) {
+		// Likewise two goroutines readying each other can keep
+		// the rest of the local queue waiting behind runnext.
+		if(schedfairtick(tick))
+			runqflushnext(m->p);
 		gp = runqget(m->p);
 		if(gp && m->spinning)
 			runtime_throw("schedule: spinning with local work");
@@ -1781,11 +1866,20 @@ top:
 void
 runtime_park(bool(*unlockf)(G*, void*), void *lock, const char *reason)
 {
+	G *next;
+
 	if(g->status != Grunning)
 		runtime_throw("bad g status");
 	m->waitlock = lock;
 	m->waitunlockf = unlockf;
 	g->waitreason = reason;
+	// A direct switch leaves unlockf to the next goroutine.
+	// Without one we could be readied as soon as we are marked as
+	// waiting, while still running on our own stack.
+	if(unlockf != nil && (next = handoffget()) != nil) {
+		handoff(next);
+		return;
+	}
 	runtime_mcall(park0);
 }
 
@@ -1830,6 +1924,96 @@ park0(G *gp)
 	schedule();
 }
 
+// Returns the G that schedule would run after the current G parks,
+// if it is the one in runnext and nothing else needs the scheduler.
+static G*
+handoffget(void)
+{
+	P *p;
+	G *gp;
+
+	p = m->p;
+	if(m->lockedg != nil || runtime_sched.gcwaiting || schedfairtick(p->schedtick))
+		return nil;
+	gp = p->runnext;
+	if(gp == nil || !runtime_casp(&p->runnext, gp, nil))
+		return nil;
+	if(gp->lockedm != nil) {
+		// schedule hands off the P to gp's M.
+		runqputnext(p, gp);
+		return nil;
+	}
+	return gp;
+}
+
+// Parks the current goroutine and switches straight to next, which
+// is runnable on this P, rather than going through g0 with
+// runtime_mcall(park0) and schedule, which costs a second switch.
+// Until the switch we are on the stack of the parking goroutine,
+// which another M may resume as soon as m->waitunlockf has run, so
+// that is left to next, in handoffdone.
+static void handoff(G*) __attribute__ ((noinline));
+static void
+handoff(G *next)
+{
+	M *mp;
+	G *gp;
+
+	// Ensure that all registers are on the stack for the garbage
+	// collector.
+	__builtin_unwind_init();
+
+	gp = g;
+#ifdef USING_SPLIT_STACK
+	__splitstack_getcontext(&gp->stack_context[0]);
+#else
+	gp->gcnext_sp = &next;
+#endif
+	gp->fromgogo = false;
+	__go_getcontext(&gp->context);
+
+	// As in runtime_mcall, we may be running in a new thread.
+	mp = runtime_m();
+	gp = runtime_g();
+
+	if(gp->fromgogo) {
+		handoffdone();
+		if(gp->traceback != nil)
+			gtraceback(gp);
+		return;
+	}
+
+	gp->status = Gwaiting;
+	gp->m = nil;
+	mp->curg = nil;
+	mp->handoffg = gp;
+	execute(next);  // Never returns.
+}
+
+// Called by a goroutine as soon as it is resumed, to finish parking
+// the goroutine it was switched to from by handoff.
+static void
+handoffdone(void)
+{
+	M *mp;
+	G *gp;
+	bool ok;
+
+	mp = runtime_m();
+	gp = mp->handoffg;
+	if(gp == nil)
+		return;
+	mp->handoffg = nil;
+	ok = mp->waitunlockf(gp, mp->waitlock);
+	mp->waitunlockf = nil;
+	mp->waitlock = nil;
+	if(!ok) {
+		// park0 would resume gp at once.
+		gp->status = Grunnable;
+		runqputnext(mp->p, gp);
+	}
+}
+
 // Scheduler yield.
 void
 runtime_gosched(void)
@@ -1839,6 +2023,25 @@ runtime_gosched(void)
 	runtime_mcall(runtime_gosched0);
 }
 
+// Called by code compiled with -fgo-optimize-preempt every so often
+// on a loop back-edge.  Yield if the goroutine has been asked to stop,
+// either by sysmon because it has run too long or because the world is
+// being stopped.
+void
+__go_preempt_check(void)
+{
+	G *gp;
+
+	gp = g;
+	if(!gp->preempt && !runtime_sched.gcwaiting)
+		return;
+	gp->preempt = false;
+	if(m->locks || m->mallocing || m->gcing || gp == m->g0 ||
+	   m->p == nil || m->p->status != Prunning || gp->status != Grunning)
+		return;
+	runtime_gosched();
+}
+
 // runtime_gosched continuation on g0.
 void
 runtime_gosched0(G *gp)
@@ -1846,9 +2049,7 @@ runtime_gosched0(G *gp)
 	gp->status = Grunnable;
 	gp->m = nil;
 	m->curg = nil;
-	runtime_lock(&runtime_sched);
 	globrunqput(gp);
-	runtime_unlock(&runtime_sched);
 	if(m->lockedg) {
 		stoplockedm();
 		execute(gp);  // Never returns.
@@ -1880,6 +2081,7 @@ goexit0(G *gp)
 	gp->paniconfault = 0;
 	gp->defer = nil; // should be true already but just in case.
 	gp->panic = nil; // non-nil for Goexit during panic. points at stack-allocated data.
+	gp->framemap = nil; // Goexit does not unwind, so the frames never popped their maps.
 	gp->writenbuf = 0;
 	gp->writebuf = nil;
 	gp->waitreason = nil;
@@ -1912,17 +2114,17 @@ runtime_entersyscall()
 {
 	// Save the registers in the g structure so that any pointers
 	// held in registers will be seen by the garbage collector.
-	getcontext(&g->gcregs);
+	__go_getcontext(&g->gcregs);
 
 	// Do the work in a separate function, so that this function
 	// doesn't save any registers on its own stack.  If this
 	// function does save any registers, we might store the wrong
-	// value in the call to getcontext.
+	// value in the call to __go_getcontext.
 	//
 	// FIXME: This assumes that we do not need to save any
 	// callee-saved registers to access the TLS variable g.  We
-	// don't want to put the ucontext_t on the stack because it is
-	// large and we can not split the stack here.
+	// don't want to put the context on the stack because it may
+	// be large and we can not split the stack here.
 	doentersyscall();
 }
 
@@ -1991,7 +2193,7 @@ runtime_entersyscallblock(void)
 
 	// Save the registers in the g structure so that any pointers
 	// held in registers will be seen by the garbage collector.
-	getcontext(&g->gcregs);
+	__go_getcontext(&g->gcregs);
 
 	g->status = Gsyscall;
 
@@ -2251,28 +2453,14 @@ __go_go(void (*fn)(void*), void* arg)
 	}
 	newg->goid = p->goidcache++;
 
-	{
-		// Avoid warnings about variables clobbered by
-		// longjmp.
-		byte * volatile vsp = sp;
-		size_t volatile vspsize = spsize;
-		G * volatile vnewg = newg;
-
-		getcontext(&vnewg->context);
-		vnewg->context.uc_stack.ss_sp = vsp;
-#ifdef MAKECONTEXT_STACK_TOP
-		vnewg->context.uc_stack.ss_sp += vspsize;
-#endif
-		vnewg->context.uc_stack.ss_size = vspsize;
-		makecontext(&vnewg->context, kickoff, 0);
+	__go_makecontext(&newg->context, kickoff, sp, spsize);
 
-		runqput(p, vnewg);
+	runqput(p, newg);
 
-		if(runtime_atomicload(&runtime_sched.npidle) != 0 && runtime_atomicload(&runtime_sched.nmspinning) == 0 && fn != runtime_main)  // TODO: fast atomic
-			wakep();
-		m->locks--;
-		return vnewg;
-	}
+	if(runtime_atomicload(&runtime_sched.npidle) != 0 && runtime_atomicload(&runtime_sched.nmspinning) == 0 && fn != runtime_main)  // TODO: fast atomic
+		wakep();
+	m->locks--;
+	return newg;
 }
 
 static void
@@ -2605,9 +2793,9 @@ runtime_setcpuprofilerate(void (*fn)(uintptr*, int32), int32 hz)
 static void
 procresize(int32 new)
 {
-	int32 i, old;
+	int32 i, n, old;
 	bool empty;
-	G *gp;
+	G *gp, *ghead, *gtail;
 	P *p;
 
 	old = runtime_gomaxprocs;
@@ -2620,6 +2808,7 @@ procresize(int32 new)
 			p = (P*)runtime_mallocgc(sizeof(*p), 0, FlagNoInvokeGC);
 			p->id = i;
 			p->status = Pgcstop;
+			p->domain = -1;
 			runtime_atomicstorep(&runtime_allp[i], p);
 		}
 		if(p->mcache == nil) {
@@ -2631,39 +2820,59 @@ procresize(int32 new)
 	}
 
 	// redistribute runnable G's evenly
-	// collect all runnable goroutines in global queue preserving FIFO order
+	// collect all runnable goroutines in a list, the ones in local queues
+	// followed by the global queue, preserving FIFO order
 	// FIFO order is required to ensure fairness even during frequent GCs
 	// see http://golang.org/issue/7126
+	ghead = gtail = nil;
+	n = 0;
+	while((gp = globrunqtake()) != nil) {
+		gp->schedlink = nil;
+		if(gtail)
+			gtail->schedlink = gp;
+		else
+			ghead = gp;
+		gtail = gp;
+		n++;
+	}
+	runtime_xadd(&runtime_sched.runqsize, -n);
 	empty = false;
 	while(!empty) {
 		empty = true;
 		for(i = 0; i < old; i++) {
 			p = runtime_allp[i];
-			if(p->runqhead == p->runqtail)
+			if(p->runqhead != p->runqtail) {
+				// pop from tail of local queue
+				p->runqtail--;
+				gp = p->runq[p->runqtail%nelem(p->runq)];
+			} else if(p->runnext != nil) {
+				// runnext comes before the local queue
+				gp = p->runnext;
+				p->runnext = nil;
+			} else
 				continue;
 			empty = false;
-			// pop from tail of local queue
-			p->runqtail--;
-			gp = p->runq[p->runqtail%nelem(p->runq)];
-			// push onto head of global queue
-			gp->schedlink = runtime_sched.runqhead;
-			runtime_sched.runqhead = gp;
-			if(runtime_sched.runqtail == nil)
-				runtime_sched.runqtail = gp;
-			runtime_sched.runqsize++;
+			// push onto head of list
+			gp->schedlink = ghead;
+			ghead = gp;
+			if(gtail == nil)
+				gtail = gp;
 		}
 	}
 	// fill local queues with at most nelem(p->runq)/2 goroutines
 	// start at 1 because current M already executes some G and will acquire allp[0] below,
 	// so if we have a spare G we want to put it into allp[1].
-	for(i = 1; (uint32)i < (uint32)new * nelem(p->runq)/2 && runtime_sched.runqsize > 0; i++) {
-		gp = runtime_sched.runqhead;
-		runtime_sched.runqhead = gp->schedlink;
-		if(runtime_sched.runqhead == nil)
-			runtime_sched.runqtail = nil;
-		runtime_sched.runqsize--;
+	for(i = 1; (uint32)i < (uint32)new * nelem(p->runq)/2 && ghead != nil; i++) {
+		gp = ghead;
+		ghead = gp->schedlink;
 		runqput(runtime_allp[i%new], gp);
 	}
+	// the rest go back on the global queue
+	n = 0;
+	for(gp = ghead; gp != nil; gp = gp->schedlink)
+		n++;
+	if(n > 0)
+		globrunqputbatch(ghead, gtail, n);
 
 	// free unused P's
 	for(i = new; i < old; i++) {
@@ -2705,6 +2914,7 @@ acquirep(P *p)
 	m->p = p;
 	p->m = m;
 	p->status = Prunning;
+	p->domain = cpudomain();
 }
 
 // Disassociate p and the current m.
@@ -2884,7 +3094,7 @@ retake(int64 now)
 			// On the one hand we don't want to retake Ps if there is no other work to do,
 			// but on the other hand we want to retake them eventually
 			// because they can prevent the sysmon thread from deep sleep.
-			if(p->runqhead == p->runqtail &&
+			if(runqempty(p) &&
 				runtime_atomicload(&runtime_sched.nmspinning) + runtime_atomicload(&runtime_sched.npidle) > 0 &&
 				pd->syscallwhen + 10*1000*1000 > now)
 				continue;
@@ -2908,7 +3118,7 @@ retake(int64 now)
 			}
 			if(pd->schedwhen + 10*1000*1000 > now)
 				continue;
-			// preemptone(p);
+			preemptone(p);
 		}
 	}
 	return n;
@@ -2922,7 +3132,41 @@ retake(int64 now)
 static bool
 preemptall(void)
 {
-	return false;
+	P *p;
+	int32 i;
+	bool res;
+
+	res = false;
+	for(i = 0; i < runtime_gomaxprocs; i++) {
+		p = runtime_allp[i];
+		if(p == nil || p->status != Prunning)
+			continue;
+		res |= preemptone(p);
+	}
+	return res;
+}
+
+// Tell the goroutine running on processor P to stop.
+// This function is purely best-effort.  It can fail to inform the
+// goroutine, or inform the wrong one if P has just switched goroutines.
+// The request is only seen by code compiled with -fgo-optimize-preempt,
+// which calls __go_preempt_check on loop back-edges.
+// No lock needs to be held.
+// Returns true if preemption request was issued.
+static bool
+preemptone(P *p)
+{
+	M *mp;
+	G *gp;
+
+	mp = p->m;
+	if(mp == nil || mp == m)
+		return false;
+	gp = mp->curg;
+	if(gp == nil || gp == mp->g0)
+		return false;
+	gp->preempt = true;
+	return true;
 }
 
 void
@@ -2962,8 +3206,8 @@ runtime_schedtrace(bool detailed)
 		h = runtime_atomicload(&p->runqhead);
 		t = runtime_atomicload(&p->runqtail);
 		if(detailed)
-			runtime_printf("  P%d: status=%d schedtick=%d syscalltick=%d m=%d runqsize=%d gfreecnt=%d\n",
-				i, p->status, p->schedtick, p->syscalltick, mp ? mp->id : -1, t-h, p->gfreecnt);
+			runtime_printf("  P%d: status=%d schedtick=%d syscalltick=%d m=%d runqsize=%d gfreecnt=%d domain=%d\n",
+				i, p->status, p->schedtick, p->syscalltick, mp ? mp->id : -1, t-h, p->gfreecnt, p->domain);
 		else {
 			// In non-detailed mode format lengths of per-P run queues as:
 			// [len1 len2 len3 len4]
@@ -3038,62 +3282,159 @@ mget(void)
 	return mp;
 }
 
+// Try to put gp in the ring of the global runnable queue.
+// Returns false if the ring is full.
+static bool
+globrunqpush(G *gp)
+{
+	uintptr pos, seq;
+
+	pos = runtime_atomicload(&globrunq.enq);
+	for(;;) {
+		seq = runtime_atomicload(&globrunq.slot[pos%GlobRunqSize].seq);
+		if(seq == pos) {
+			// The slot is free for us, if no other producer
+			// gets it first.
+			if(runtime_cas(&globrunq.enq, pos, pos+1))
+				break;
+		} else if((intptr)(seq - pos) < 0)
+			return false;  // full: the slot still holds G number pos-GlobRunqSize
+		pos = runtime_atomicload(&globrunq.enq);
+	}
+	globrunq.slot[pos%GlobRunqSize].gp = gp;
+	runtime_atomicstore(&globrunq.slot[pos%GlobRunqSize].seq, pos+1);  // store-release, hands the slot to the consumer
+	return true;
+}
+
+// Try to take a G from the ring of the global runnable queue.
+// Returns nil if it is empty.
+static G*
+globrunqpop(void)
+{
+	uintptr pos, seq;
+	G *gp;
+
+	pos = runtime_atomicload(&globrunq.deq);
+	for(;;) {
+		seq = runtime_atomicload(&globrunq.slot[pos%GlobRunqSize].seq);
+		if(seq == pos+1) {
+			if(runtime_cas(&globrunq.deq, pos, pos+1))
+				break;
+		} else if((intptr)(seq - (pos+1)) < 0)
+			return nil;  // empty, or the producer of G number pos has not finished
+		pos = runtime_atomicload(&globrunq.deq);
+	}
+	gp = globrunq.slot[pos%GlobRunqSize].gp;
+	globrunq.slot[pos%GlobRunqSize].gp = nil;
+	runtime_atomicstore(&globrunq.slot[pos%GlobRunqSize].seq, pos+GlobRunqSize);  // store-release, frees the slot for the next round
+	return gp;
+}
+
 // Put gp on the global runnable queue.
-// Sched must be locked.
 static void
 globrunqput(G *gp)
 {
-	gp->schedlink = nil;
-	if(runtime_sched.runqtail)
-		runtime_sched.runqtail->schedlink = gp;
-	else
-		runtime_sched.runqhead = gp;
-	runtime_sched.runqtail = gp;
-	runtime_sched.runqsize++;
+	globrunqputbatch(gp, gp, 1);
 }
 
 // Put a batch of runnable goroutines on the global runnable queue.
-// Sched must be locked.
 static void
 globrunqputbatch(G *ghead, G *gtail, int32 n)
 {
+	G *gp;
+
+	// Count them first, so that a P that sees runqsize of 0 after
+	// pidleput can be sure that no G is on its way.
+	runtime_xadd(&runtime_sched.runqsize, n);
 	gtail->schedlink = nil;
+	while(ghead != nil && runtime_atomicload(&runtime_sched.runqover) == 0) {
+		gp = ghead;
+		ghead = gp->schedlink;
+		if(!globrunqpush(gp)) {
+			gp->schedlink = ghead;
+			ghead = gp;
+			break;
+		}
+	}
+	if(ghead == nil)
+		return;
+	n = 0;
+	for(gp = ghead; gp != nil; gp = gp->schedlink)
+		n++;
+	runtime_lock(&runtime_sched.runqlock);
 	if(runtime_sched.runqtail)
 		runtime_sched.runqtail->schedlink = ghead;
 	else
 		runtime_sched.runqhead = ghead;
 	runtime_sched.runqtail = gtail;
-	runtime_sched.runqsize += n;
+	runtime_atomicstore(&runtime_sched.runqover, runtime_sched.runqover + n);
+	runtime_unlock(&runtime_sched.runqlock);
+}
+
+// Take one G from the global runnable queue, without updating
+// runqsize.  The ring holds the oldest G's, so it goes first.  When
+// it is empty, take the G at the head of the list and move the ones
+// after it into the ring, so that producers can use the ring again.
+static G*
+globrunqtake(void)
+{
+	G *gp, *gp1, *next;
+	int32 n;
+
+	gp = globrunqpop();
+	if(gp != nil || runtime_atomicload(&runtime_sched.runqover) == 0)
+		return gp;
+	runtime_lock(&runtime_sched.runqlock);
+	gp = runtime_sched.runqhead;
+	if(gp != nil) {
+		n = 1;
+		// Once a G is in the ring another P can run it and put it
+		// back on the queue, which rewrites its schedlink, so read
+		// the link before the push.
+		for(gp1 = gp->schedlink; gp1 != nil; gp1 = next) {
+			next = gp1->schedlink;
+			if(!globrunqpush(gp1))
+				break;
+			n++;
+		}
+		runtime_sched.runqhead = gp1;
+		if(gp1 == nil)
+			runtime_sched.runqtail = nil;
+		runtime_atomicstore(&runtime_sched.runqover, runtime_sched.runqover - n);
+	}
+	runtime_unlock(&runtime_sched.runqlock);
+	return gp;
 }
 
 // Try get a batch of G's from the global runnable queue.
-// Sched must be locked.
 static G*
 globrunqget(P *p, int32 max)
 {
 	G *gp, *gp1;
-	int32 n;
+	int32 n, size, got;
 
-	if(runtime_sched.runqsize == 0)
+	size = runtime_atomicload(&runtime_sched.runqsize);
+	if(size <= 0)
 		return nil;
-	n = runtime_sched.runqsize/runtime_gomaxprocs+1;
-	if(n > runtime_sched.runqsize)
-		n = runtime_sched.runqsize;
+	n = size/runtime_gomaxprocs+1;
+	if(n > size)
+		n = size;
 	if(max > 0 && n > max)
 		n = max;
 	if((uint32)n > nelem(p->runq)/2)
 		n = nelem(p->runq)/2;
-	runtime_sched.runqsize -= n;
-	if(runtime_sched.runqsize == 0)
-		runtime_sched.runqtail = nil;
-	gp = runtime_sched.runqhead;
-	runtime_sched.runqhead = gp->schedlink;
-	n--;
-	while(n--) {
-		gp1 = runtime_sched.runqhead;
-		runtime_sched.runqhead = gp1->schedlink;
-		runqput(p, gp1);
+	gp = nil;
+	for(got = 0; got < n; got++) {
+		gp1 = globrunqtake();
+		if(gp1 == nil)
+			break;  // taken by other P's, or not there yet
+		if(gp == nil)
+			gp = gp1;
+		else
+			runqput(p, gp1);
 	}
+	if(got > 0)
+		runtime_xadd(&runtime_sched.runqsize, -got);
 	return gp;
 }
 
@@ -3166,13 +3507,40 @@ runqputslow(P *p, G *gp, uint32 h, uint32 t)
 	for(i=0; i<n; i++)
 		batch[i]->schedlink = batch[i+1];
 	// Now put the batch on global queue.
-	runtime_lock(&runtime_sched);
 	globrunqputbatch(batch[0], batch[n], n+1);
-	runtime_unlock(&runtime_sched);
 	return true;
 }
 
-// Get g from local runnable queue.
+// Put g in the runnext slot of p, so that it runs before the local
+// queue.  The G that was there goes to the tail of the queue.
+// Executed only by the owner P.
+static void
+runqputnext(P *p, G *gp)
+{
+	G *old;
+
+	for(;;) {
+		old = p->runnext;
+		if(runtime_casp(&p->runnext, old, gp))  // other P's may steal old
+			break;
+	}
+	if(old != nil)
+		runqput(p, old);
+}
+
+// Move the G in runnext of p to the tail of the local queue.
+// Executed only by the owner P.
+static void
+runqflushnext(P *p)
+{
+	G *gp;
+
+	gp = p->runnext;
+	if(gp != nil && runtime_casp(&p->runnext, gp, nil))
+		runqput(p, gp);
+}
+
+// Get g from local runnable queue, taking runnext first.
 // Executed only by the owner P.
 static G*
 runqget(P *p)
@@ -3180,6 +3548,13 @@ runqget(P *p)
 	G *gp;
 	uint32 t, h;
 
+	for(;;) {
+		gp = p->runnext;
+		if(gp == nil)
+			break;
+		if(runtime_casp(&p->runnext, gp, nil))
+			return gp;
+	}
 	for(;;) {
 		h = runtime_atomicload(&p->runqhead);  // load-acquire, synchronize with other consumers
 		t = p->runqtail;
@@ -3191,12 +3566,68 @@ runqget(P *p)
 	}
 }
 
+// Return the domain of the CPU we are running on, or -1.
+static int32
+cpudomain(void)
+{
+	int32 cpu;
+
+	if(runtime_cputopology.ndomain <= 1)
+		return -1;
+	cpu = getproccpu();
+	if(cpu < 0 || cpu >= runtime_cputopology.ncpuid)
+		return -1;
+	return runtime_cputopology.domain[cpu];
+}
+
+// Steal from a P running in the same CPU domain as p, or failing that
+// on the same NUMA node.  A goroutine stolen from further away leaves
+// its data in another cache.
+// Returns one of the stolen elements (or nil if failed).
+static G*
+runqstealnear(P *p)
+{
+	P *p2;
+	G *gp;
+	int32 d, d2, node, pass, i;
+	uint32 off;
+
+	d = cpudomain();
+	p->domain = d;
+	if(d < 0)
+		return nil;
+	node = runtime_cputopology.node[d];
+	off = runtime_fastrand1();
+	for(pass = 0; pass < 2; pass++) {
+		for(i = 0; i < runtime_gomaxprocs; i++) {
+			p2 = runtime_allp[(off+i)%runtime_gomaxprocs];
+			d2 = p2->domain;
+			if(p2 == p || d2 < 0)
+				continue;
+			if(pass == 0 ? d2 != d : d2 == d || runtime_cputopology.node[d2] != node)
+				continue;
+			gp = runqsteal(p, p2);
+			if(gp)
+				return gp;
+		}
+	}
+	return nil;
+}
+
+// Reports whether p has no goroutines in its local queue or runnext.
+static bool
+runqempty(P *p)
+{
+	return p->runqhead == p->runqtail && p->runnext == nil;
+}
+
 // Grabs a batch of goroutines from local runnable queue.
 // batch array must be of size nelem(p->runq)/2. Returns number of grabbed goroutines.
 // Can be executed by any P.
 static uint32
 runqgrab(P *p, G **batch)
 {
+	G *gp;
 	uint32 t, h, n, i;
 
 	for(;;) {
@@ -3204,8 +3635,21 @@ runqgrab(P *p, G **batch)
 		t = runtime_atomicload(&p->runqtail);  // load-acquire, synchronize with the producer
 		n = t-h;
 		n = n - n/2;
-		if(n == 0)
+		if(n == 0) {
+			gp = p->runnext;
+			if(gp == nil)
+				break;
+			// A running P usually readies runnext just before
+			// it blocks and runs it.  Give it the chance, rather
+			// than bounce the goroutine between P's.
+			if(p->status == Prunning)
+				runtime_usleep(3);
+			if(!runtime_casp(&p->runnext, gp, nil))
+				continue;
+			batch[0] = gp;
+			n = 1;
 			break;
+		}
 		if(n > nelem(p->runq)/2)  // read inconsistent h and t
 			continue;
 		for(i=0; i<n; i++)
@@ -321,8 +321,11 @@ static struct {
 } dbgvar[] = {
 	{"allocfreetrace", &runtime_debug.allocfreetrace},
 	{"efence", &runtime_debug.efence},
+	{"gcconcurrent", &runtime_debug.gcconcurrent},
 	{"gctrace", &runtime_debug.gctrace},
 	{"gcdead", &runtime_debug.gcdead},
+	{"lockprof", &runtime_debug.lockprof},
+	{"netpolluring", &runtime_debug.netpolluring},
 	{"scheddetail", &runtime_debug.scheddetail},
 	{"schedtrace", &runtime_debug.schedtrace},
 };
@@ -24,6 +24,7 @@
 
 #include "interface.h"
 #include "go-alloc.h"
+#include "go-context.h"
 
 #define _STRINGIFY2_(x) #x
 #define _STRINGIFY_(x) _STRINGIFY2_(x)
@@ -76,6 +77,8 @@ typedef	struct	ParForThread	ParForThread;
 typedef	struct	CgoMal		CgoMal;
 typedef	struct	PollDesc	PollDesc;
 typedef	struct	DebugVars	DebugVars;
+typedef	struct	CPUTopology	CPUTopology;
+typedef	struct	FrameMap	FrameMap;
 
 typedef	struct	__go_open_array		Slice;
 typedef struct	__go_interface		Iface;
@@ -155,6 +158,9 @@ struct	Lock
 	// while sema-based impl as M* waitm.
 	// Used to be a union, but unions break precise GC.
 	uintptr	key;
+	// The futex-based impl uses these to decide whether to spin.
+	M*	owner;	// M holding the lock
+	uint32	spins;	// 8 times the average spins needed to acquire it
 };
 struct	Note
 {
@@ -184,6 +190,23 @@ struct	GCStats
 	uint64	nsleep;
 };
 
+// A FrameMap is the stack map of a function compiled with
+// -fgo-optimize-stackmaps.  It describes variables in the function's
+// frame, which the garbage collector scans by their type rather than
+// conservatively.  The function links it into G.framemap while it
+// runs.  A variable's addr is nil until its
+// declaration has run.
+struct	FrameMap
+{
+	FrameMap*	next;
+	uintptr	n;
+	struct
+	{
+		void*	addr;
+		const Type*	type;
+	} vars[];
+};
+
 // A location in the program, used for backtraces.
 struct	Location
 {
@@ -197,6 +220,7 @@ struct	G
 {
 	Defer*	defer;
 	Panic*	panic;
+	FrameMap*	framemap;	// stack maps of running functions, innermost first
 	void*	exception;	// current exception being thrown
 	bool	is_foreign;	// whether current exception from other language
 	void	*gcstack;	// if status==Gsyscall, gcstack = stackbase to use during gc
@@ -204,7 +228,7 @@ struct	G
 	void*	gcnext_segment;
 	void*	gcnext_sp;
 	void*	gcinitial_sp;
-	ucontext_t gcregs;
+	__go_context_t gcregs;
 	byte*	entry;		// initial function
 	void*	param;		// passed parameter on wakeup
 	bool	fromgogo;	// reached from gogo
@@ -218,6 +242,7 @@ struct	G
 	bool	issystem;	// do not output in stack dump
 	bool	isbackground;	// ignore in deadlock detector
 	bool	paniconfault;	// panic (instead of crash) on unexpected fault address
+	bool	preempt;	// preemption signal, checked on loop back-edges
 	M*	m;		// for debuggers, but offset not hard-coded
 	M*	lockedm;
 	int32	sig;
@@ -233,7 +258,7 @@ struct	G
 
 	Traceback* traceback;
 
-	ucontext_t	context;
+	__go_context_t	context;
 	void*		stack_context[10];
 };
 
@@ -261,6 +286,7 @@ struct	M
 	bool	blocked;	// M is blocked on a Note
 	uint32	fastrand;
 	uint64	ncgocall;	// number of cgo calls in total
+	uint64	itabhits;	// interface conversions found in the method table cache
 	int32	ncgo;		// number of cgo calls currently in progress
 	CgoMal*	cgomal;
 	Note	park;
@@ -280,6 +306,7 @@ struct	M
 	uint8	traceback;
 	bool	(*waitunlockf)(G*, void*);
 	void*	waitlock;
+	G*	handoffg;	// G parking after a direct switch, see handoff
 	uintptr	end[];
 };
 
@@ -304,6 +331,9 @@ struct P
 	uint32	runqhead;
 	uint32	runqtail;
 	G*	runq[256];
+	// If non-nil, the G readied last, which runs before runq.
+	G*	runnext;
+	int32	domain;		// CPU domain its M last ran in, -1 if unknown
 
 	// Available G's (status == Gdead)
 	G*	gfree;
@@ -399,6 +429,7 @@ struct	Timers
 // If this struct changes, adjust ../syscall/net_nacl.go:/runtimeTimer.
 struct	Timer
 {
+	Timers	*tb;	// heap the timer was added to, or nil
 	intgo	i;	// heap index
 
 	// Timer wakes up at when, and then at when+period, ... (period > 0 only)
@@ -448,15 +479,29 @@ struct CgoMal
 	void	*alloc;
 };
 
+// The CPUs the process may run on, grouped into domains which share
+// a last level cache.  The scheduler prefers to steal work from P's
+// running in the same domain, then from those on the same NUMA node.
+struct CPUTopology
+{
+	int32	ndomain;	// 0 if the topology is unknown
+	int32	ncpuid;		// all CPU numbers are less than this
+	int16*	domain;		// domain of each CPU number, -1 if not usable
+	int16*	node;		// NUMA node of each domain
+};
+
 // Holds variables parsed from GODEBUG env var.
 struct DebugVars
 {
 	int32	allocfreetrace;
 	int32	efence;
 	int32	gctrace;
+	int32	gcconcurrent;
 	int32	gcdead;
+	int32	lockprof;
 	int32	scheddetail;
 	int32	schedtrace;
+	int32	netpolluring;
 };
 
 extern bool runtime_precisestack;
@@ -507,6 +552,7 @@ extern	int32	runtime_ncpu;
 extern 	void	(*runtime_sysargs)(int32, uint8**);
 extern	uint32	runtime_Hchansize;
 extern	DebugVars	runtime_debug;
+extern	CPUTopology	runtime_cputopology;
 extern	uintptr	runtime_maxstacksize;
 
 /*
@@ -607,8 +653,10 @@ void	runtime_entersyscall(void) __asm__ (GOSYM_PREFIX "syscall.Entersyscall");
 void	runtime_entersyscallblock(void);
 void	runtime_exitsyscall(void) __asm__ (GOSYM_PREFIX "syscall.Exitsyscall");
 G*	__go_go(void (*pfn)(void*), void*);
+void	__go_preempt_check(void);
 void	siginit(void);
 bool	__go_sigsend(int32 sig);
+void	__go_itab_cache_stats(uint64*, uint64*);
 int32	runtime_callers(int32, Location*, int32, bool keep_callers);
 int64	runtime_nanotime(void);	// monotonic time
 int64	runtime_unixnanotime(void); // real time, can skip
@@ -629,14 +677,25 @@ bool	runtime_deltimer(Timer*);
 G*	runtime_netpoll(bool);
 void	runtime_netpollinit(void);
 int32	runtime_netpollopen(uintptr, PollDesc*);
-int32   runtime_netpollclose(uintptr);
+int32   runtime_netpollclose(uintptr, PollDesc*);
 void	runtime_netpollready(G**, PollDesc*, int32);
 uintptr	runtime_netpollfd(PollDesc*);
 void	runtime_netpollarm(PollDesc*, int32);
+bool	runtime_netpollcompletion(void);
+void	runtime_netpollio(PollDesc*, int32, byte*, uintptr);
+void	runtime_netpollcancel(PollDesc*, int32);
+void	runtime_netpolliodone(PollDesc*, int32, int32);
 void**	runtime_netpolluser(PollDesc*);
 bool	runtime_netpollclosing(PollDesc*);
+uintptr*	runtime_netpolluringseq(PollDesc*);
 void	runtime_netpolllock(PollDesc*);
 void	runtime_netpollunlock(PollDesc*);
+bool	runtime_netpolluringinit(void);
+int32	runtime_netpolluringopen(uintptr, PollDesc*);
+int32	runtime_netpolluringclose(uintptr, PollDesc*);
+G*	runtime_netpolluring(bool);
+void	runtime_netpolluringio(PollDesc*, int32, byte*, uintptr);
+void	runtime_netpolluringcancel(PollDesc*, int32);
 void	runtime_crash(void);
 void	runtime_parsedebugvars(void);
 void	_rt0_go(void);
@@ -657,6 +716,7 @@ extern uint32 runtime_worldsema;
  */
 void	runtime_lock(Lock*);
 void	runtime_unlock(Lock*);
+intgo	runtime_readlockstats(uint64*, intgo);
 
 /*
  * sleep and wakeup on one-time events.
@@ -829,6 +889,8 @@ extern void runtime_main(void*);
 extern uint32 runtime_in_callers;
 
 int32 getproccount(void);
+void getproctopology(CPUTopology*);
+int32 getproccpu(void);
 
 #define PREFETCH(p) __builtin_prefetch(p)
 